@@ -34,6 +34,7 @@
 #include "cc3000_chibios_config.h"
 #include "wlan.h"
 #include "netapp.h"
+#include "socket.h"
 
 /** @defgroup api API
  *  @brief The API which will need to be used in order to correctly use this
@@ -57,12 +58,211 @@ void cc3000ChibiosWlanInit(SPIDriver * initialisedSpiDriver,
 void cc3000ChibiosShutdown(void);
 
 
+/** @brief Statistics gathered by the SPI driver.
+ *  @details Counters are free running and will wrap. */
+typedef struct {
+    /** @brief Packets received entirely by the first read.
+     *  @details See #CHIBIOS_CC3000_SPI_FIRST_READ_B. */
+    uint32_t rxSingleRead;
+    /** @brief Packets which required a second read. */
+    uint32_t rxSecondRead;
+    /** @brief Bytes read from the CC3000, including SPI headers. */
+    uint32_t rxBytes;
+    /** @brief Bytes written to the CC3000, including SPI headers. */
+    uint32_t txBytes;
+    uint32_t rxPackets;         ///< Packets read from the CC3000.
+    uint32_t rxDataPackets;     ///< Received packets which were HCI data.
+    uint32_t rxEventPackets;    ///< Received packets which were HCI events.
+    /** @brief Longest packet read, including SPI headers.
+     *  @details Limited to #CC3000_RX_BUFFER_SIZE less its magic number. */
+    uint32_t rxMaxPacket;
+    uint32_t txPackets;         ///< Packets written to the CC3000.
+    /** @brief Bytes added to written packets to make their length odd. */
+    uint32_t txPadBytes;
+    /** @brief Longest packet written, including SPI headers. */
+    uint32_t txMaxPacket;
+    /** @brief Asynchronous events dropped as the dispatch queue was full.
+     *  @details See #CHIBIOS_CC3000_EVENT_DISPATCH. */
+    uint32_t asyncEventsDropped;
+    /** @brief Paced sends which had to wait for a TX credit. */
+    uint32_t txCreditWaits;
+    /** @brief Received packets passed to the host driver before it was ready
+     *         for them.
+     *  @details The host driver has no signal for when it starts waiting on
+     *           a response, so the driver polls for it for up to
+     *           #CHIBIOS_CC3000_RX_HANDSHAKE_TIMEOUT_MS. A packet passed on
+     *           after that is most likely discarded by the host driver. */
+    uint32_t rxHandshakeTimeouts;
+    /** @brief Time the host driver was blocked in SpiWrite() waiting on the
+     *         CC3000 or another transaction.
+     *  @details In units of #timeFrequency. */
+    uint64_t txWaitTime;
+    /** @brief Time received packets waited on the host driver having paused
+     *         SPI or being busy with an earlier packet.
+     *  @details In units of #timeFrequency. */
+    uint64_t rxPausedTime;
+    /** @brief Frequency, in Hz, of the times in these statistics.
+     *  @details The HAL's realtime counter, or the system tick if the HAL does
+     *           not implement one. */
+    uint32_t timeFrequency;
+    /** @brief State changes not permitted by the driver's state machine.
+     *  @details Non-zero values indicate a driver bug. */
+    uint32_t illegalTransitions;
+    uint8_t lastIllegalFrom;        ///< State of the last illegal change.
+    uint8_t lastIllegalTo;          ///< Target of the last illegal change.
+} cc3000SpiStatistics;
+
+void cc3000ChibiosGetSpiStatistics(cc3000SpiStatistics * stats);
+
+/** @brief Reasons the SPI clock has been lowered. */
+typedef enum {
+    CC3000_SPI_FALLBACK_NONE = 0,   ///< No fall back has occurred.
+    /** @brief A negotiation round trip returned different data to the
+     *         slowest speed. */
+    CC3000_SPI_FALLBACK_ROUND_TRIP,
+    CC3000_SPI_FALLBACK_BAD_TYPE,   ///< A received packet had an unknown type.
+    /** @brief A received packet was too long for a receive buffer. */
+    CC3000_SPI_FALLBACK_BAD_LENGTH,
+    CC3000_SPI_FALLBACK_COUNT       ///< Number of reasons. Not a reason.
+} cc3000SpiFallback;
+
+/** @brief SPI config in use, set up by cc3000ChibiosNegotiateSpiSpeed(). */
+typedef struct {
+    unsigned int index;             ///< Index of the config in use.
+    unsigned int count;             ///< Number of configs available.
+    cc3000SpiFallback lastFallback; ///< Reason for the most recent fall back.
+    /** @brief Number of fall backs for each reason. */
+    uint32_t fallbacks[CC3000_SPI_FALLBACK_COUNT];
+} cc3000SpiSpeed;
+
+unsigned int cc3000ChibiosNegotiateSpiSpeed(const SPIConfig * speeds,
+                                            unsigned int count);
+
+void cc3000ChibiosGetSpiSpeed(cc3000SpiSpeed * speed);
+
+/** @brief Events recorded in the trace.
+ *  @details Values are part of the dump format read by
+ *           util/trace_decode.py, so should only be appended to. */
+typedef enum {
+    CC3000_TRACE_EXT_IRQ = 1,       ///< EXT interrupt on the IRQ line.
+    CC3000_TRACE_IRQ_WAKE,          ///< IRQ thread woken.
+    CC3000_TRACE_STATE,             ///< State change, arg from, value to.
+    CC3000_TRACE_SELECT,            ///< CC3000 selected.
+    CC3000_TRACE_UNSELECT,          ///< CC3000 unselected.
+    CC3000_TRACE_SPI_WRITE_START,   ///< SPI write started, value bytes.
+    CC3000_TRACE_SPI_WRITE_END,     ///< SPI write completed.
+    CC3000_TRACE_SPI_READ_START,    ///< SPI read started, value bytes.
+    CC3000_TRACE_SPI_READ_END,      ///< SPI read completed.
+    CC3000_TRACE_RX_DISPATCH_START, ///< Packet passed to the host driver.
+    CC3000_TRACE_RX_DISPATCH_END,   ///< Host driver returned.
+    CC3000_TRACE_WRITE_REQUEST,     ///< Host driver write, value bytes.
+    CC3000_TRACE_WRITE_DONE         ///< Host driver write completed.
+} cc3000TraceEvent;
+
+/** @brief A record of the trace. */
+typedef struct {
+    /** @brief Time of the event.
+     *  @details The HAL's realtime counter, or system ticks if the HAL does
+     *           not implement one. */
+    uint32_t time;
+    uint8_t event;      ///< A #cc3000TraceEvent.
+    uint8_t arg;        ///< Event specific.
+    uint16_t value;     ///< Event specific.
+} cc3000TraceRecord;
+
+unsigned int cc3000ChibiosGetTrace(cc3000TraceRecord * records,
+                                   unsigned int max);
+
+void cc3000ChibiosDumpTrace(cc3000PrintCb print);
+
+/** @brief Times at which each phase of starting the CC3000 was reached.
+ *  @details Values are of the HAL's realtime counter, or system ticks if the
+ *           HAL does not implement one. A phase not yet reached is 0. */
+typedef struct {
+    uint32_t powerOff;      ///< WLAN_EN was last driven low.
+    uint32_t powerOn;       ///< WLAN_EN was driven high by wlan_start().
+    uint32_t irqAsserted;   ///< The CC3000 pulled IRQ low after power on.
+    uint32_t firstWrite;    ///< The first command was written.
+    uint32_t started;       ///< cc3000ChibiosWlanStart() returned.
+} cc3000BootTimeline;
+
+void cc3000ChibiosWlanStart(unsigned short patchesAvailableAtHost);
+
+void cc3000ChibiosGetBootTimeline(cc3000BootTimeline * timeline);
+
+int cc3000ChibiosSendZeroCopy(long sd, const void *buf, long len, long flags,
+                              const sockaddr *to, socklen_t tolen);
+
+unsigned int cc3000ChibiosTxCredits(void);
+
+bool cc3000ChibiosWaitTxCredit(systime_t timeout);
+
+int cc3000ChibiosSendPaced(long sd, const void *buf, long len, long flags,
+                           const sockaddr *to, socklen_t tolen,
+                           systime_t timeout);
+
+
 /** @brief Holds ping report information. */
 typedef struct {
     bool present;                       ///< If a ping report is present.
     netapp_pingreport_args_t report;    ///< Ping report. See TI doxygen API.
 } pingInformation;
 
+/** @name Asynchronous event flags
+ *  @brief Flags broadcast by an instance's event source, see
+ *         cc3000ChibiosGetEventSource().
+ *  @{ */
+#define CC3000_EVENT_CONNECT            ((flagsmask_t)1 << 0) ///< Connected.
+#define CC3000_EVENT_DISCONNECT         ((flagsmask_t)1 << 1) ///< Disconnected.
+/** @brief DHCP information received. Check cc3000AsyncData.dhcp.present. */
+#define CC3000_EVENT_DHCP               ((flagsmask_t)1 << 2)
+#define CC3000_EVENT_PING_REPORT        ((flagsmask_t)1 << 3) ///< Ping report.
+/** @brief The CC3000 may be shut down. */
+#define CC3000_EVENT_SHUTDOWN_OK        ((flagsmask_t)1 << 4)
+/** @brief Smart config finished. */
+#define CC3000_EVENT_SMART_CONFIG_DONE  ((flagsmask_t)1 << 5)
+/** @brief The remote end of a TCP socket closed it. */
+#define CC3000_EVENT_TCP_CLOSE_WAIT     ((flagsmask_t)1 << 6)
+/** @brief The CC3000 freed transmit buffers. Broadcast by the TX credit
+ *         source only, see cc3000ChibiosWaitTxCredit(). */
+#define CC3000_EVENT_TX_CREDIT          ((flagsmask_t)1 << 7)
+/** @} */
+
+/** @brief An asynchronous event, as passed to a #cc3000EventHandler. */
+typedef struct {
+    long type;                  ///< Event type, e.g. HCI_EVNT_WLAN_UNSOL_DHCP.
+    /** @brief When the event was received.
+     *  @details In units of cc3000SpiStatistics::timeFrequency. */
+    uint32_t time;
+    /** @brief Length of the payload as received.
+     *  @details Only the first #CHIBIOS_CC3000_EVENT_PAYLOAD_B bytes are
+     *           held in #payload. */
+    uint8_t length;
+    /** @brief Payload of the event. */
+    uint8_t payload[CHIBIOS_CC3000_EVENT_PAYLOAD_B];
+} cc3000Event;
+
+/** @brief Handler of asynchronous events, see
+ *         #CHIBIOS_CC3000_EVENT_DISPATCH. Called from the dispatcher
+ *         thread. */
+typedef void (*cc3000EventHandler)(const cc3000Event * event);
+
+/** @brief Handler of one type of asynchronous event.
+ *  @details Called on the thread receiving packets with the arguments TI's
+ *           host driver passes to the asynchronous callback. Must not block
+ *           or call the host driver. See #CHIBIOS_CC3000_EVENT_DISPATCH for
+ *           handlers which need to. */
+typedef void (*cc3000AsyncHandler)(long eventType, char * data,
+                                   unsigned char length);
+
+/** @brief Event type to register a handler of every event type the library
+ *         does not know. See cc3000ChibiosSetAsyncHandler(). */
+#define CC3000_ASYNC_OTHER              (-1L)
+
+/** @brief Number of asynchronous event handlers of each instance.
+ *  @details One for each known event type and one for #CC3000_ASYNC_OTHER. */
+#define CC3000_ASYNC_SLOTS              14
+
 /** @brief Holds DHCP information. */
 typedef struct {
     bool present;                   ///< If DHCP information is present
@@ -91,7 +291,512 @@ typedef struct {
     pingInformation ping;
 } cc3000AsynchronousData;
 
-extern volatile cc3000AsynchronousData cc3000AsyncData;
+/** @name cc3000AsyncData parts
+ *  @brief Parts of #cc3000AsynchronousData cleared by
+ *         cc3000ChibiosClearAsyncData().
+ *  @{ */
+#define CC3000_ASYNC_DATA_SHUTDOWN_OK   (1U << 0) ///< shutdownOk
+#define CC3000_ASYNC_DATA_SMART_CONFIG  (1U << 1) ///< smartConfigFinished
+#define CC3000_ASYNC_DATA_CONNECTED     (1U << 2) ///< connected
+#define CC3000_ASYNC_DATA_DHCP          (1U << 3) ///< dhcp
+#define CC3000_ASYNC_DATA_PING          (1U << 4) ///< ping
+#define CC3000_ASYNC_DATA_ALL           0x1FU     ///< All of the above.
+/** @} */
+
+/** @brief How cc3000ChibiosFastConnect() connected. */
+typedef enum {
+    CC3000_CONNECT_FAILED = 0,  ///< Not connected.
+    CC3000_CONNECT_FAST,        ///< Connected with the cached configuration.
+    CC3000_CONNECT_DHCP         ///< Connected with a full DHCP.
+} cc3000ConnectPath;
+
+/** @brief Application storage of the fast connect cache.
+ *  @details Replaces the NVMEM file #CHIBIOS_CC3000_FAST_CONNECT_FILE. */
+typedef struct {
+    /** @brief Reads @p length bytes of the cache into @p data.
+     *  @return False if nothing is stored. */
+    bool (*load)(void * data, uint32_t length);
+    /** @brief Stores @p length bytes of the cache from @p data.
+     *  @return False if the cache could not be stored. */
+    bool (*save)(const void * data, uint32_t length);
+} cc3000ConnectStorage;
+
+/** @brief Results of cc3000ChibiosFastConnect().
+ *  @details Times are in system ticks, from the call until connected with
+ *           DHCP information. */
+typedef struct {
+    uint32_t fastAttempts;      ///< Connections tried with the cache.
+    uint32_t fastConnects;      ///< Connections made with the cache.
+    uint32_t dhcpConnects;      ///< Connections made with a full DHCP.
+    uint32_t failures;          ///< Calls which did not connect.
+    systime_t lastFastTime;     ///< Time of the last fast connection.
+    systime_t lastDhcpTime;     ///< Time of the last full DHCP connection.
+} cc3000ConnectStatistics;
+
+/** @brief A host driver call made by the command worker thread.
+ *  @param arg The argument given to cc3000ChibiosCommandInit().
+ *  @return The result, passed back to the submitter. */
+typedef long (*cc3000CommandFn)(void * arg);
+
+/** @brief A command for the worker thread, and the future of its result.
+ *  @details Owned by the submitter, and must remain valid until the command
+ *           is complete. See cc3000ChibiosCommandSubmit(). */
+typedef struct {
+    cc3000CommandFn fn;         ///< Call to make.
+    void * arg;                 ///< Argument of #fn.
+    volatile long result;       ///< Result of #fn, once #done.
+    volatile bool done;         ///< Set once #fn has returned.
+    BinarySemaphore doneSem;    ///< Signalled once #fn has returned.
+} cc3000Command;
+
+/** @brief Callback of a socket registered with the reactor.
+ *  @details Called on the reactor thread without cc3000ChibiosLock(), which
+ *           must be taken around any host driver call made.
+ *  @param sd The socket.
+ *  @param arg The argument given to cc3000ChibiosReactorAdd(). */
+typedef void (*cc3000SocketCallback)(long sd, void * arg);
+
+/** @brief Statistics of the socket reactor. */
+typedef struct {
+    uint32_t polls;             ///< Calls to select().
+    uint32_t idlePolls;         ///< Calls which found no socket ready.
+    uint32_t reads;             ///< Read callbacks made.
+    uint32_t writes;            ///< Write callbacks made.
+    uint32_t errors;            ///< Calls to select() which failed.
+    uint32_t timeoutMs;         ///< The current select() timeout.
+} cc3000ReactorStatistics;
+
+/** @brief Access point the connection supervisor keeps connected to.
+ *  @details The strings must remain valid while the supervisor runs. */
+typedef struct {
+    long secType;                   ///< See wlan_connect().
+    const char * ssid;              ///< See wlan_connect().
+    long ssidLen;                   ///< See wlan_connect().
+    const unsigned char * bssid;    ///< See wlan_connect(), may be NULL.
+    const unsigned char * key;      ///< See wlan_connect().
+    long keyLen;                    ///< See wlan_connect().
+    /** @brief Passed to wlan_start() if the CC3000 is restarted. */
+    unsigned short patchesAvailableAtHost;
+} cc3000NetworkConfig;
+
+/** @name Connection supervisor flags
+ *  @brief Flags broadcast by cc3000ChibiosSupervisorGetEventSource().
+ *  @{ */
+#define CC3000_NETWORK_UP       ((flagsmask_t)1 << 0) ///< Network usable.
+#define CC3000_NETWORK_DOWN     ((flagsmask_t)1 << 1) ///< Network lost.
+/** @} */
+
+/** @brief Number of reconnect latency buckets of the supervisor. */
+#define CC3000_SUPERVISOR_LATENCY_BUCKETS 16
+
+/** @brief Statistics of the connection supervisor.
+ *  @details Times are in system ticks. */
+typedef struct {
+    uint32_t connects;          ///< Times the network became usable.
+    uint32_t disconnects;       ///< Times the network was lost.
+    uint32_t failedAttempts;    ///< Connection attempts which failed.
+    systime_t uptime;           ///< Time the network has been usable for.
+    /** @brief Time since the network became usable, 0 if not usable. */
+    systime_t currentUptime;
+    systime_t minReconnectTime; ///< Shortest time to reconnect.
+    systime_t maxReconnectTime; ///< Longest time to reconnect.
+    /** @brief Times to reconnect, from losing the network until usable.
+     *  @details Bucket n counts times under 2^n milliseconds, and at least
+     *           2^(n-1). The last bucket also counts longer times. */
+    uint32_t reconnectTimes[CC3000_SUPERVISOR_LATENCY_BUCKETS];
+} cc3000SupervisorStatistics;
+
+/** @brief Rolling statistics of a ping monitor target.
+ *  @details Times are in milliseconds. The minimum, average, maximum and
+ *           percentile cover the last #CHIBIOS_CC3000_PING_WINDOW reports
+ *           with replies. */
+typedef struct {
+    uint32_t ip;                ///< Target, as given to netapp_ping_send().
+    uint32_t rounds;            ///< Rounds of pings sent to the target.
+    uint32_t sent;              ///< Pings sent.
+    uint32_t received;          ///< Replies received.
+    /** @brief Rounds without a report, or with an inconsistent one. */
+    uint32_t badReports;
+    uint32_t samples;           ///< Reports the statistics below cover.
+    uint32_t minRtt;            ///< Minimum round trip time.
+    uint32_t avgRtt;            ///< Average round trip time.
+    uint32_t maxRtt;            ///< Maximum round trip time.
+    /** @brief #CHIBIOS_CC3000_PING_PERCENTILE percentile of the average
+     *         round trip time of each report.
+     *  @details A percentile of per-round averages, not of individual
+     *           pings, so it understates outliers within a round. */
+    uint32_t percentileRtt;
+    /** @brief Percentage of pings lost over the reports covered. */
+    uint8_t lossPercent;
+    /** @brief If #avgRtt or #lossPercent exceed the target's thresholds. */
+    bool alert;
+} cc3000PingStatistics;
+
+/** @brief Hardware connections of a CC3000 module.
+ *  @details Used to give each driver instance its own pins. */
+typedef struct {
+    ioportid_t irqPort;         ///< Port of the interrupt pin.
+    uint16_t irqPad;            ///< Interrupt pin. Also the EXT channel used.
+    uint32_t irqExtMode;        ///< EXT mode selecting @p irqPort.
+    ioportid_t wlanEnPort;      ///< Port of the WLAN enable pin.
+    uint16_t wlanEnPad;         ///< WLAN enable pin.
+    ioportid_t nssPort;         ///< Port of the SPI chip select pin.
+    uint16_t nssPad;            ///< SPI chip select pin.
+} cc3000DriverConfig;
+
+/** @brief The various states of the CC3000 SPI driver.
+ *  @details Internal to the driver. */
+typedef enum
+{
+    SPI_STATE_POWERUP,         ///< CC3000 powered up (Enable pin high).
+    SPI_STATE_INITIALIZED,     ///< CC3000 has responded to powerup (IRQ low).
+    SPI_STATE_IDLE,            ///< Idle.
+    SPI_STATE_WRITE_REQUESTED, ///< Write has been requested by selecting CC3000.
+    SPI_STATE_WRITE_PERMITTED, ///< Write has been permitted by CC3000 acknowledging.
+    SPI_STATE_READ             ///< Performing a read operation.
+} spiState;
+
+/** @brief Information required by CC3000 SPI driver.
+ *  @details Internal to the driver. */
+typedef struct
+{
+    void (*rxHandlerCb)(void *p);   ///< Handler function for received data.
+    unsigned short txPacketLength;  ///< Number of bytes to transmit.
+    unsigned short rxPacketLength;  ///< Number of bytes received. (DEBUG)
+    spiState spiState;              ///< Current state of the driver.
+    unsigned char *pTxPacket;       ///< Points to data to be transmitted.
+    unsigned char *pRxPacket;       ///< Points to where to store received data.
+} tSpiInformation;
+
+/** @brief State of an asynchronous SPI transfer.
+ *  @details Internal to the driver. Progressed from the SPI end callback one
+ *           chunk at a time. */
+typedef struct
+{
+    const unsigned char *pTx;   ///< Data still to be sent. NULL when receiving.
+    unsigned char *pRx;         ///< Where to store data still to be received.
+    size_t remaining;           ///< Number of bytes still to be transferred.
+} tSpiAsyncTransfer;
+
+/** @brief A CC3000 driver instance.
+ *  @details Holds everything needed to communicate with one CC3000 module:
+ *           its drivers, pins, threads and buffers. Fields are internal to
+ *           the driver and should only be accessed through the API. */
+typedef struct {
+    /** @brief ChibiOS SPI driver being used for CC3000 communications. */
+    SPIDriver * spiDriver;
+    /** @brief Holds the SPI driver config. */
+    SPIConfig spiConfig;
+    /** @brief ChibiOS EXT driver being used for IRQ line monitoring. */
+    EXTDriver * extDriver;
+    /** @brief The EXT driver config. */
+    EXTConfig * extConfig;
+    /** @brief Pins of this CC3000. */
+    const cc3000DriverConfig * config;
+    /** @brief Patch callbacks passed to wlan_init() when this instance is
+     *         made active. */
+    tFWPatches fwPatches;
+    /** @brief See #fwPatches. */
+    tDriverPatches driverPatches;
+    /** @brief See #fwPatches. */
+    tBootLoaderPatches bootLoaderPatches;
+    /** @brief CC3000 SPI driver data. */
+    volatile tSpiInformation spiInformation;
+    /** @brief Receive buffer.
+     *  @details A ring of #CHIBIOS_CC3000_RX_SLOTS slots, allowing a packet
+     *           to be read while the host driver is still processing earlier
+     *           ones. Each slot ends in its own magic number. */
+    unsigned char rxBuffer[CHIBIOS_CC3000_RX_SLOTS][CC3000_RX_BUFFER_SIZE];
+    /** @brief Semaphore signalling the IRQ thread. */
+    Semaphore irqSem;
+    /** @brief Semaphore used to wake threads waiting on a change of
+     *         spiInformation.spiState.
+     *  @details Never signalled, only reset, which releases every waiting
+     *           thread at once. */
+    Semaphore spiStateSem;
+    /** @brief Number of threads waiting on #spiStateSem.
+     *  @details Only changed within a lock zone, by the waiters. */
+    volatile cnt_t spiStateWaiters;
+    /** @brief Counts the #rxBuffer slots free to receive into. */
+    Semaphore rxFreeSem;
+    /** @brief Indexes of #rxBuffer slots holding packets waiting to be passed
+     *         to the host driver, in the order they were received. */
+    Mailbox rxReadyMb;
+    /** @brief Buffer of #rxReadyMb. */
+    msg_t rxReadyMbBuffer[CHIBIOS_CC3000_RX_SLOTS];
+    /** @brief Index of the next #rxBuffer slot to receive into. */
+    unsigned int rxSlotWrite;
+    /** @brief Set while a packet has been passed to the host driver which it
+     *         has not yet finished with. */
+    bool rxSlotDelivered;
+    /** @brief Signalled when the host driver may be ready for another
+     *         packet. */
+    BinarySemaphore hostReadySem;
+    /** @brief Set while passing received packets to the host driver is
+     *         deferred by SpiPauseSpi(). */
+    volatile bool spiPaused;
+    /** @brief The asynchronous transfer in progress. */
+    tSpiAsyncTransfer spiAsyncTransfer;
+    /** @brief Signalled when a whole asynchronous transfer has completed. */
+    BinarySemaphore spiAsyncDoneSem;
+    /** @brief Table of SPI configs, slowest first, set by
+     *         cc3000ChibiosNegotiateSpiSpeed(). NULL if #spiConfig is to be
+     *         used throughout. */
+    const SPIConfig * spiSpeedTable;
+    /** @brief The SPI config in use and reasons for falling back from faster
+     *         ones. */
+    cc3000SpiSpeed spiSpeed;
+    /** @brief Set when spiSpeed.index has changed but #spiConfig has not
+     *         yet been updated. */
+    bool spiSpeedChanged;
+    /** @brief Set while the IRQ thread holds a shared SPI bus on behalf of
+     *         the whole instance. */
+    volatile bool spiBusHeld;
+    /** @brief Number of transactions completed while #spiBusHeld. */
+    volatile unsigned int spiBusHeldCount;
+    /** @brief Set if the current transaction acquired the shared SPI bus
+     *         itself, rather than using the bus held by the IRQ thread. */
+    bool spiBusAcquired;
+    /** @brief Statistics gathered by this instance. */
+    cc3000SpiStatistics spiStatistics;
+#if CHIBIOS_CC3000_TRACE == TRUE
+    /** @brief Trace ring. See #CHIBIOS_CC3000_TRACE. */
+    cc3000TraceRecord trace[CHIBIOS_CC3000_TRACE_SIZE];
+    /** @brief Number of records ever written to #trace. */
+    volatile uint32_t traceHead;
+#endif
+    /** @brief Progress of the last start of the CC3000. */
+    cc3000BootTimeline bootTimeline;
+    /** @brief System time at which the CC3000 was last powered off. */
+    systime_t powerOffTime;
+#if CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS == TRUE
+    /** @brief Information updated by the asynchronous callback. */
+    volatile cc3000AsynchronousData asyncData;
+    /** @brief Sequence count of #asyncData.
+     *  @details Odd while #asyncData is being written. See
+     *           cc3000ChibiosGetAsyncData(). */
+    volatile uint32_t asyncDataSeq;
+#endif
+    /** @brief Handlers registered with cc3000ChibiosSetAsyncHandler().
+     *  @details Indexed by the slot of the event type. Unused entries are
+     *           NULL. */
+    volatile cc3000AsyncHandler asyncHandlers[CC3000_ASYNC_SLOTS];
+    /** @brief Broadcasts CC3000_EVENT flags as asynchronous events are
+     *         received. */
+    EventSource asyncEventSource;
+    /** @brief Serialises use of TI's host driver. See
+     *         cc3000ChibiosLock(). */
+    Mutex hostMtx;
+    /** @brief Broadcasts CC3000_EVENT_TX_CREDIT when the CC3000 frees
+     *         transmit buffers. */
+    EventSource txCreditSource;
+    /** @brief Free transmit buffers when last checked. */
+    unsigned short txCreditsLast;
+#if CHIBIOS_CC3000_EVENT_DISPATCH == TRUE
+    /** @brief Events waiting for the dispatcher thread.
+     *  @details Written only by the thread receiving packets and read only
+     *           by the dispatcher thread. */
+    cc3000Event eventQueue[CHIBIOS_CC3000_EVENT_QUEUE_SIZE];
+    /** @brief Number of events ever added to #eventQueue. */
+    volatile uint32_t eventHead;
+    /** @brief Number of events ever taken from #eventQueue. */
+    volatile uint32_t eventTail;
+    /** @brief Signalled when an event is added to #eventQueue. */
+    BinarySemaphore eventSem;
+    /** @brief Registered event handlers. Unused entries are NULL. */
+    volatile cc3000EventHandler eventHandlers[CHIBIOS_CC3000_EVENT_HANDLERS];
+    /** @brief The thread passing events to #eventHandlers. */
+    Thread * pEventThd;
+    /** @brief Working area of #pEventThd. */
+    WORKING_AREA(eventThreadWorkingArea, CHIBIOS_CC3000_EVENT_THD_AREA);
+#endif
+    /** @brief The thread used to process CC3000 interrupts. */
+    Thread * pSignalHandlerThd;
+    /** @brief The thread used to pass received packets to the host driver.*/
+    Thread * pRxDeliveryThd;
+    /** @brief Working area of #pSignalHandlerThd. */
+    WORKING_AREA(irqSignalHandlerThreadWorkingArea,
+                 CHIBIOS_CC3000_IRQ_THD_AREA);
+    /** @brief Working area of #pRxDeliveryThd. */
+    WORKING_AREA(rxDeliveryThreadWorkingArea, CHIBIOS_CC3000_RX_THD_AREA);
+} cc3000Driver;
+
+/** @brief The instance used by cc3000ChibiosWlanInit(). */
+extern cc3000Driver CC3000D1;
+
+/** @brief The instance TI's host driver is currently bound to.
+ *  @details TI's host driver only supports one CC3000, so the rest of the
+ *           host driver API, and this library's API functions which do not
+ *           take an instance, act on this one. */
+extern cc3000Driver * cc3000ActiveDriver;
+
+/** @brief Asynchronous information provided by the CC3000 of the active
+ *         instance.
+ *  @details This is updated whenever the asynchronous callback is fired.
+ *           Its elements will require to be manually cleared in some 
+ *           circumstances to ensure the information is still relevant.
+ *           See #cc3000ActiveDriver. Single flags may be read directly, but
+ *           the DHCP and ping information should be read with
+ *           cc3000ChibiosGetAsyncData(), and cleared with
+ *           cc3000ChibiosClearAsyncData(), to avoid seeing a partial
+ *           update. */
+#if CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS == TRUE
+#define cc3000AsyncData     (cc3000ActiveDriver->asyncData)
+#endif
+
+EventSource * cc3000ChibiosGetEventSource(void);
+
+flagsmask_t cc3000ChibiosWaitEvents(flagsmask_t flags, systime_t timeout);
+
+#if CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS == TRUE
+bool cc3000ChibiosWaitConnected(systime_t timeout);
+
+bool cc3000ChibiosWaitDhcp(systime_t timeout);
+
+bool cc3000ChibiosWaitPingReport(systime_t timeout);
+
+void cc3000ChibiosGetAsyncData(cc3000AsynchronousData * data);
+
+void cc3000ChibiosClearAsyncData(unsigned int parts);
+#endif
+
+#if CHIBIOS_CC3000_FAST_CONNECT == TRUE
+cc3000ConnectPath cc3000ChibiosFastConnect(long secType,
+                                           const char * ssid,
+                                           long ssidLen,
+                                           const unsigned char * bssid,
+                                           const unsigned char * key,
+                                           long keyLen,
+                                           unsigned short patchesAvailableAtHost,
+                                           systime_t timeout);
+
+void cc3000ChibiosFastConnectSetStorage(const cc3000ConnectStorage * storage);
+
+void cc3000ChibiosFastConnectForget(void);
+
+void cc3000ChibiosFastConnectGetStatistics(cc3000ConnectStatistics * stats);
+#endif
+
+#if CHIBIOS_CC3000_COMMAND_QUEUE == TRUE
+void cc3000ChibiosCommandStart(void);
+
+void cc3000ChibiosCommandStop(void);
+
+void cc3000ChibiosCommandInit(cc3000Command * command, cc3000CommandFn fn,
+                              void * arg);
+
+bool cc3000ChibiosCommandSubmit(cc3000Command * command, systime_t timeout);
+
+bool cc3000ChibiosCommandDone(const cc3000Command * command);
+
+bool cc3000ChibiosCommandWait(cc3000Command * command, systime_t timeout,
+                              long * result);
+
+long cc3000ChibiosCommandCall(cc3000CommandFn fn, void * arg);
+#endif
+
+#if CHIBIOS_CC3000_REACTOR == TRUE
+void cc3000ChibiosReactorStart(void);
+
+void cc3000ChibiosReactorStop(void);
+
+bool cc3000ChibiosReactorAdd(long sd, cc3000SocketCallback onRead,
+                             cc3000SocketCallback onWrite, void * arg);
+
+void cc3000ChibiosReactorWantWrite(long sd, bool want);
+
+void cc3000ChibiosReactorRemove(long sd);
+
+void cc3000ChibiosReactorGetStatistics(cc3000ReactorStatistics * stats);
+#endif
+
+#if CHIBIOS_CC3000_SUPERVISOR == TRUE
+void cc3000ChibiosSupervisorStart(const cc3000NetworkConfig * config);
+
+void cc3000ChibiosSupervisorStop(void);
+
+bool cc3000ChibiosWaitNetwork(systime_t timeout);
+
+EventSource * cc3000ChibiosSupervisorGetEventSource(void);
+
+void cc3000ChibiosSupervisorGetStatistics(cc3000SupervisorStatistics * stats);
+#endif
+
+#if CHIBIOS_CC3000_PING_MONITOR == TRUE
+void cc3000ChibiosPingMonitorStart(void);
+
+void cc3000ChibiosPingMonitorStop(void);
+
+int cc3000ChibiosPingMonitorAdd(uint32_t ip, uint32_t maxRtt,
+                                uint8_t maxLossPercent);
+
+void cc3000ChibiosPingMonitorRemove(int target);
+
+bool cc3000ChibiosPingMonitorGetStatistics(int target,
+                                           cc3000PingStatistics * stats);
+
+EventSource * cc3000ChibiosPingMonitorGetEventSource(void);
+#endif
+
+void cc3000ChibiosLock(void);
+
+void cc3000ChibiosUnlock(void);
+
+bool cc3000ChibiosSetAsyncHandler(long eventType, cc3000AsyncHandler handler);
+
+bool cc3000ChibiosAddEventHandler(cc3000EventHandler handler);
+
+void cc3000ChibiosRemoveEventHandler(cc3000EventHandler handler);
+
+bool cc3000ChibiosDriverInit(cc3000Driver * drv,
+                             const cc3000DriverConfig * config,
+                             SPIDriver * initialisedSpiDriver,
+                             SPIConfig * configuredSpi,
+                             EXTDriver * initialisedExtDriver,
+                             EXTConfig * configuredExt,
+                             tFWPatches sFWPatches,
+                             tDriverPatches sDriverPatches,
+                             tBootLoaderPatches sBootLoaderPatches,
+                             cc3000PrintCb printCallback);
+
+void cc3000ChibiosDriverActivate(cc3000Driver * drv);
+
+void cc3000ChibiosDriverShutdown(cc3000Driver * drv);
+
+void cc3000ChibiosDriverLock(cc3000Driver * drv);
+
+void cc3000ChibiosDriverUnlock(cc3000Driver * drv);
+
+EventSource * cc3000ChibiosDriverGetEventSource(cc3000Driver * drv);
+
+bool cc3000ChibiosDriverSetAsyncHandler(cc3000Driver * drv, long eventType,
+                                        cc3000AsyncHandler handler);
+
+#if CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS == TRUE
+void cc3000ChibiosDriverGetAsyncData(cc3000Driver * drv,
+                                     cc3000AsynchronousData * data);
+
+void cc3000ChibiosDriverClearAsyncData(cc3000Driver * drv,
+                                       unsigned int parts);
+#endif
+
+bool cc3000ChibiosDriverAddEventHandler(cc3000Driver * drv,
+                                        cc3000EventHandler handler);
+
+void cc3000ChibiosDriverRemoveEventHandler(cc3000Driver * drv,
+                                           cc3000EventHandler handler);
+
+void cc3000ChibiosDriverGetBootTimeline(cc3000Driver * drv,
+                                        cc3000BootTimeline * timeline);
+
+unsigned int cc3000ChibiosDriverGetTrace(cc3000Driver * drv,
+                                         cc3000TraceRecord * records,
+                                         unsigned int max);
+
+void cc3000ChibiosDriverDumpTrace(cc3000Driver * drv, cc3000PrintCb print);
+
+void cc3000ChibiosDriverGetStatistics(cc3000Driver * drv,
+                                      cc3000SpiStatistics * stats);
 
 /** @} */
 
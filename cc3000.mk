@@ -7,6 +7,16 @@ CC3000_HOST_DIR=CC3000HostDriver
 # Append to CSRC
 CC3000SRC=$(CC3000_CHIBIOS_DIR)/src/cc3000_spi.c \
 		  $(CC3000_CHIBIOS_DIR)/src/async_handler.c \
+		  $(CC3000_CHIBIOS_DIR)/src/event_dispatch.c \
+		  $(CC3000_CHIBIOS_DIR)/src/ping_monitor.c \
+		  $(CC3000_CHIBIOS_DIR)/src/fast_connect.c \
+		  $(CC3000_CHIBIOS_DIR)/src/supervisor.c \
+		  $(CC3000_CHIBIOS_DIR)/src/command_queue.c \
+		  $(CC3000_CHIBIOS_DIR)/src/socket_reactor.c \
+		  $(CC3000_CHIBIOS_DIR)/src/zero_copy_send.c \
+		  $(CC3000_CHIBIOS_DIR)/src/tx_credits.c \
+		  $(CC3000_CHIBIOS_DIR)/src/cc3000_delay.c \
+		  $(CC3000_CHIBIOS_DIR)/src/cc3000_debug.c \
 		  $(wildcard $(CC3000_CHIBIOS_DIR)/$(CC3000_HOST_DIR)/*.c) 
 
 
@@ -58,6 +58,282 @@
  *           library.  */
 #define CHIBIOS_CC3000_SPI_EXCLUSIVE        TRUE
 
+/** @brief Set to TRUE to leave a shared SPI driver started between
+ *         transactions.
+ *  @details Only used if #CHIBIOS_CC3000_SPI_EXCLUSIVE is FALSE. spiStart()
+ *           is skipped when the driver is still started with this library's
+ *           config, i.e. no other user of the bus has reconfigured it. When
+ *           FALSE the driver is started and stopped around every
+ *           transaction. */
+#define CHIBIOS_CC3000_SPI_CACHE_CONFIG     TRUE
+
+/** @brief Maximum number of back to back transactions a shared SPI bus is
+ *         held across.
+ *  @details Only used if #CHIBIOS_CC3000_SPI_EXCLUSIVE is FALSE. The bus is
+ *           held after a read in case the CC3000 has more to send, rather
+ *           than being released and acquired again. 0 to always release the
+ *           bus after each transaction. */
+#define CHIBIOS_CC3000_SPI_HOLD_MAX         0
+
+/** @brief Time, in milliseconds, a held SPI bus is kept waiting for the
+ *         next transaction before being released.
+ *  @details See #CHIBIOS_CC3000_SPI_HOLD_MAX. Other users of the bus may be
+ *           delayed by this long. */
+#define CHIBIOS_CC3000_SPI_HOLD_MS          2
+
+/** @brief Set to TRUE to perform SPI transfers asynchronously.
+ *  @details Transfers are started with spiStartExchange(), spiStartSend() and
+ *           spiStartReceive() and progressed from the SPI end callback, with
+ *           the calling thread sleeping until the whole transfer is done.
+ *           When FALSE the synchronous SPI API is used. */
+#define CHIBIOS_CC3000_SPI_ASYNC            FALSE
+
+/** @brief Largest number of bytes started in a single asynchronous transfer.
+ *  @details Larger transfers are split into chunks of this size, chained
+ *           from the SPI end callback. Should be reduced if the SPI low level
+ *           driver cannot transfer #CC3000_RX_BUFFER_SIZE bytes at once. */
+#define CHIBIOS_CC3000_SPI_ASYNC_MAX_XFER   0xFFFF
+
+/** @brief Number of round trips which must succeed at a SPI speed for
+ *         cc3000ChibiosNegotiateSpiSpeed() to accept it. */
+#define CHIBIOS_CC3000_SPI_NEGOTIATE_ROUNDS 10
+
+/** @brief Maximum number of driver instances which can be initialised at
+ *         once.
+ *  @details Only needed above 1 if several CC3000 modules are used, see
+ *           cc3000ChibiosDriverInit(). */
+#define CHIBIOS_CC3000_MAX_DRIVERS          1
+
+/**** Protocol delays ****/
+/** @brief Delays are made by sleeping, rounded up to whole system ticks. */
+#define CHIBIOS_CC3000_DELAY_SLEEP          0
+/** @brief Delays are made by polling the HAL's realtime counter. */
+#define CHIBIOS_CC3000_DELAY_POLLED         1
+/** @brief Delays are made by sleeping on a one shot of a GPT timer. */
+#define CHIBIOS_CC3000_DELAY_GPT            2
+
+/** @brief How the microsecond delays required by the CC3000 are made.
+ *  @details One of #CHIBIOS_CC3000_DELAY_SLEEP, #CHIBIOS_CC3000_DELAY_POLLED
+ *           or #CHIBIOS_CC3000_DELAY_GPT. The delays are short, 50 us after
+ *           power up, so sleeping will usually wait far longer than needed.
+ *           #CHIBIOS_CC3000_DELAY_POLLED is preferred where the HAL
+ *           implements counters (HAL_IMPLEMENTS_COUNTERS). */
+#define CHIBIOS_CC3000_DELAY_BACKEND        CHIBIOS_CC3000_DELAY_SLEEP
+
+/** @brief GPT driver used by #CHIBIOS_CC3000_DELAY_GPT.
+ *  @details Started by the CC3000 driver and not to be used elsewhere. */
+#define CHIBIOS_CC3000_DELAY_GPT_DRIVER     GPTD2
+/** @brief Counting frequency, in Hz, of #CHIBIOS_CC3000_DELAY_GPT_DRIVER. */
+#define CHIBIOS_CC3000_DELAY_GPT_FREQ       1000000
+
+/**** Boot ****/
+/** @brief Set to TRUE to start the CC3000 as soon as it signals it is ready.
+ *  @details Rather than sleeping for a fixed 100 ms on initialisation and in
+ *           SpiOpen(), the CC3000 is only kept powered off for
+ *           #CHIBIOS_CC3000_POWER_OFF_HOLD_MS, counted from when it was
+ *           powered off, and wlan_start() waits on the IRQ falling edge
+ *           instead of polling the pin. */
+#define CHIBIOS_CC3000_FAST_BOOT            FALSE
+
+/** @brief Minimum time, in milliseconds, the CC3000 is held powered off
+ *         before being powered on again.
+ *  @details Only used if #CHIBIOS_CC3000_FAST_BOOT is TRUE. */
+#define CHIBIOS_CC3000_POWER_OFF_HOLD_MS    100
+
+/** @brief Maximum time, in milliseconds, to wait for the CC3000 to pull IRQ
+ *         low after power on.
+ *  @details Only used if #CHIBIOS_CC3000_FAST_BOOT is TRUE. On a timeout
+ *           starting is left to the host driver, which polls the pin. */
+#define CHIBIOS_CC3000_BOOT_TIMEOUT_MS      1000
+
+/**** Transmit pacing ****/
+/** @brief Transmit buffers of the CC3000 left free by
+ *         cc3000ChibiosSendPaced().
+ *  @details Keeps buffers for sends made directly through the host driver,
+ *           which would otherwise spin waiting for one. */
+#define CHIBIOS_CC3000_TX_CREDIT_RESERVE    0
+
+/**** Asynchronous events ****/
+/** @brief Event ID used by the cc3000ChibiosWait functions in the calling
+ *         thread.
+ *  @details Must not be used by the calling thread for anything else. */
+#define CHIBIOS_CC3000_WAIT_EVENT_ID        31
+
+/** @brief Set to TRUE for the library to keep cc3000AsyncData up to date.
+ *  @details If FALSE cc3000AsyncData, and the cc3000ChibiosWait functions
+ *           which check it, are not available. CC3000_EVENT flags are still
+ *           broadcast and handlers registered with
+ *           cc3000ChibiosSetAsyncHandler() are still called. */
+#define CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS TRUE
+
+/**** Fast connect ****/
+/** @brief Set to TRUE to build cc3000ChibiosFastConnect().
+ *  @details Caches the last DHCP lease and access point, and reuses them as
+ *           a static IP configuration on the next connection. Requires
+ *           #CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS. */
+#define CHIBIOS_CC3000_FAST_CONNECT         FALSE
+
+/** @brief NVMEM file holding the fast connect cache, unless the application
+ *         provides its own storage. */
+#define CHIBIOS_CC3000_FAST_CONNECT_FILE    NVMEM_USER_FILE_1_FILEID
+
+/** @brief Offset of the fast connect cache in
+ *         #CHIBIOS_CC3000_FAST_CONNECT_FILE. */
+#define CHIBIOS_CC3000_FAST_CONNECT_OFFSET  0
+
+/** @brief Maximum time, in milliseconds, the cached configuration is given
+ *         to connect before falling back to DHCP. */
+#define CHIBIOS_CC3000_FAST_CONNECT_MS      3000
+
+/** @brief Number of fast connections made with a cached lease before it is
+ *         renewed by a full DHCP. */
+#define CHIBIOS_CC3000_FAST_CONNECT_USES    16
+
+/**** Connection supervisor ****/
+/** @brief Set to TRUE to build the connection supervisor.
+ *  @details A thread keeping the CC3000 connected, see
+ *           cc3000ChibiosSupervisorStart(). Requires
+ *           #CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS. */
+#define CHIBIOS_CC3000_SUPERVISOR           FALSE
+
+/** @brief Maximum time, in milliseconds, the supervisor waits for each
+ *         connection attempt. */
+#define CHIBIOS_CC3000_SUPERVISOR_CONNECT_MS 10000
+
+/** @brief Delay, in milliseconds, before retrying the first failed
+ *         connection attempt. Doubles with each further failure. */
+#define CHIBIOS_CC3000_SUPERVISOR_BACKOFF_MIN_MS 500
+
+/** @brief Maximum delay, in milliseconds, between connection attempts. */
+#define CHIBIOS_CC3000_SUPERVISOR_BACKOFF_MAX_MS 30000
+
+/** @brief Working area size of the supervisor thread. */
+#define CHIBIOS_CC3000_SUPERVISOR_THD_AREA  768
+
+/** @brief Priority of the supervisor thread. */
+#define CHIBIOS_CC3000_SUPERVISOR_THD_PRIO  NORMALPRIO
+
+/**** Command queue ****/
+/** @brief Set to TRUE to build the command queue.
+ *  @details A worker thread making host driver calls submitted by other
+ *           threads, see cc3000ChibiosCommandSubmit(). */
+#define CHIBIOS_CC3000_COMMAND_QUEUE        FALSE
+
+/** @brief Number of commands which may wait for the worker thread. */
+#define CHIBIOS_CC3000_COMMAND_QUEUE_SIZE   8
+
+/** @brief Working area size of the command worker thread.
+ *  @details Commands, and so the host driver, run on this thread. */
+#define CHIBIOS_CC3000_COMMAND_THD_AREA     1024
+
+/** @brief Priority of the command worker thread. */
+#define CHIBIOS_CC3000_COMMAND_THD_PRIO     NORMALPRIO
+
+/**** Socket reactor ****/
+/** @brief Set to TRUE to build the socket reactor.
+ *  @details One thread waiting on all registered sockets with select() and
+ *           calling their callbacks, see cc3000ChibiosReactorStart(). */
+#define CHIBIOS_CC3000_REACTOR              FALSE
+
+/** @brief Number of sockets the reactor can serve.
+ *  @details Socket descriptors must be below this. The CC3000 has 8. */
+#define CHIBIOS_CC3000_REACTOR_SOCKETS      8
+
+/** @brief Shortest select() timeout, in milliseconds, used while sockets
+ *         are busy. The CC3000 does not accept less than 5. */
+#define CHIBIOS_CC3000_REACTOR_MIN_MS       5
+
+/** @brief Longest select() timeout, in milliseconds, reached while sockets
+ *         are idle.
+ *  @details A thread wanting the host driver during a select() waits up to
+ *           this long. Threads already waiting when it starts shorten it to
+ *           #CHIBIOS_CC3000_REACTOR_MIN_MS. */
+#define CHIBIOS_CC3000_REACTOR_MAX_MS       100
+
+/** @brief Working area size of the reactor thread.
+ *  @details Socket callbacks run on this thread. */
+#define CHIBIOS_CC3000_REACTOR_THD_AREA     1024
+
+/** @brief Priority of the reactor thread. */
+#define CHIBIOS_CC3000_REACTOR_THD_PRIO     NORMALPRIO
+
+/**** Ping monitor ****/
+/** @brief Set to TRUE to build the ping monitor.
+ *  @details A background thread pinging a set of targets and keeping
+ *           rolling round trip time and loss statistics of each. See
+ *           cc3000ChibiosPingMonitorStart(). Requires
+ *           #CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS. */
+#define CHIBIOS_CC3000_PING_MONITOR         FALSE
+
+/** @brief Maximum number of targets of the ping monitor. */
+#define CHIBIOS_CC3000_PING_TARGETS         4
+
+/** @brief Number of ping reports of each target the rolling statistics
+ *         cover. */
+#define CHIBIOS_CC3000_PING_WINDOW          16
+
+/** @brief Time, in milliseconds, between rounds of pings. */
+#define CHIBIOS_CC3000_PING_INTERVAL_MS     10000
+
+/** @brief Pings sent to a target each round. */
+#define CHIBIOS_CC3000_PING_ATTEMPTS        3
+
+/** @brief Size of each ping, in bytes. */
+#define CHIBIOS_CC3000_PING_SIZE            32
+
+/** @brief Time, in milliseconds, the CC3000 waits for each ping reply. */
+#define CHIBIOS_CC3000_PING_TIMEOUT_MS      1000
+
+/** @brief Percentile of the round trip time reported by the ping monitor.
+ *  @details Between 1 and 100. Taken over the average round trip time of
+ *           each round of pings in the window, not over individual pings,
+ *           as the CC3000 only reports a minimum, average and maximum. */
+#define CHIBIOS_CC3000_PING_PERCENTILE      90
+
+/** @brief Working area size of the ping monitor thread. */
+#define CHIBIOS_CC3000_PING_THD_AREA        512
+
+/** @brief Priority of the ping monitor thread. */
+#define CHIBIOS_CC3000_PING_THD_PRIO        (NORMALPRIO - 1)
+
+/** @brief Set to TRUE to pass asynchronous events to user handlers from a
+ *         dispatcher thread.
+ *  @details Events are copied into a queue by the thread receiving packets,
+ *           so handlers, added with cc3000ChibiosAddEventHandler(), do not
+ *           delay receiving the next packet. If the queue is full the event
+ *           is dropped and counted in
+ *           cc3000SpiStatistics::asyncEventsDropped. */
+#define CHIBIOS_CC3000_EVENT_DISPATCH       FALSE
+
+/** @brief Number of events the dispatch queue holds. Must be a power of 2. */
+#define CHIBIOS_CC3000_EVENT_QUEUE_SIZE     8
+
+/** @brief Number of payload bytes copied with each queued event.
+ *  @details Longer payloads are truncated. 32 is enough for DHCP and ping
+ *           reports. */
+#define CHIBIOS_CC3000_EVENT_PAYLOAD_B      32
+
+/** @brief Maximum number of event handlers of each instance. */
+#define CHIBIOS_CC3000_EVENT_HANDLERS       4
+
+/** @brief Working area size of the event dispatcher thread.
+ *  @details Event handlers run on this thread. */
+#define CHIBIOS_CC3000_EVENT_THD_AREA       512
+
+/** @brief Priority of the event dispatcher thread. */
+#define CHIBIOS_CC3000_EVENT_THD_PRIO       (NORMALPRIO)
+
+/**** Tracing ****/
+/** @brief Set to TRUE to record a timestamped trace of each driver instance.
+ *  @details Records are kept in a ring, overwriting the oldest, at each
+ *           interrupt, state change and SPI transfer. Recording takes a few
+ *           cycles and no lock zone on cores with atomic instructions. See
+ *           cc3000ChibiosDumpTrace() and util/trace_decode.py. */
+#define CHIBIOS_CC3000_TRACE                FALSE
+
+/** @brief Number of records held by the trace ring. Must be a power of 2. */
+#define CHIBIOS_CC3000_TRACE_SIZE           64
+
 /**** Interrupt pin ****/
 /** @brief Port being used for interrupt pin monitoring. */
 #define CHIBIOS_CC3000_IRQ_PORT             GPIOC
@@ -93,45 +369,157 @@
  *  @warning Should be higher than the thread using the CC3000 API. */
 #define CHIBIOS_CC3000_IRQ_THD_PRIO         (HIGHPRIO)
 
+/**** Receive ****/
+/** @brief Number of receive buffer slots, each #CC3000_RX_BUFFER_SIZE bytes.
+ *  @details With more than one slot, the next packet can be read from the
+ *           CC3000 while the host driver is still processing the previous. */
+#define CHIBIOS_CC3000_RX_SLOTS             2
+
+/** @brief Working area size of the thread passing received packets to the
+ *         host driver.
+ *  @details The host driver's receive handler and the asynchronous event
+ *           callback run on this thread. */
+#define CHIBIOS_CC3000_RX_THD_AREA          256
+/** @brief Priority of the thread passing received packets to the host
+ *         driver.
+ *  @warning Should be lower than #CHIBIOS_CC3000_IRQ_THD_PRIO, so reading a
+ *           packet can preempt processing of the last, but higher than the
+ *           thread using the CC3000 API. */
+#define CHIBIOS_CC3000_RX_THD_PRIO          (HIGHPRIO - 1)
+
+/** @brief Number of bytes read by the first SPI read of each packet.
+ *  @details The minimum, 10, reads just the SPI and HCI headers, with the
+ *           rest of the packet fetched by a second read. A larger value lets
+ *           short packets be received in a single read, at the cost of
+ *           clocking out padding for packets shorter than this. */
+#define CHIBIOS_CC3000_SPI_FIRST_READ_B     10
+
+/** @brief Maximum time, in milliseconds, a received response to a command is
+ *         held while waiting on the host driver to be ready for it.
+ *  @details The host driver will discard a response which arrives before the
+ *           sending thread has started waiting on it. Normally no wait is
+ *           needed. The host driver gives no signal when it starts waiting,
+ *           so its state is polled every system tick. A response still not
+ *           wanted after this time is passed on anyway and will most likely
+ *           be discarded; see cc3000SpiStatistics::rxHandshakeTimeouts. */
+#define CHIBIOS_CC3000_RX_HANDSHAKE_TIMEOUT_MS  100
+
 /**** Debug Helpers  ****/
 /**@brief Set to TRUE to enable basic debug print callbacks from the SPI Driver. 
  * @details To facilitate this, it will alter some of the API functions. */
 #define CHIBIOS_CC3000_DBG_PRINT_ENABLED    FALSE
 
+/** @brief Set to TRUE to defer formatting of debug prints.
+ *  @details Only used if #CHIBIOS_CC3000_DBG_PRINT_ENABLED is TRUE. Each
+ *           print stores its format string, location and raw arguments in a
+ *           ring, without a lock zone on cores with atomic instructions. A
+ *           low priority thread later formats them through the print
+ *           callback, so printing barely changes the driver's timing. */
+#define CHIBIOS_CC3000_DBG_PRINT_DEFERRED   FALSE
+
+/** @brief Number of deferred debug records held. Must be a power of 2.
+ *  @details Records are dropped, and counted, if the ring fills before it is
+ *           drained. */
+#define CHIBIOS_CC3000_DBG_LOG_SIZE         32
+
+/** @brief Interval, in milliseconds, at which deferred debug records are
+ *         printed. */
+#define CHIBIOS_CC3000_DBG_LOG_DRAIN_MS     10
+
+/** @brief Working area size of the thread printing deferred debug records.
+ *  @details Needs to be large enough for the print callback. */
+#define CHIBIOS_CC3000_DBG_LOG_THD_AREA     512
+
+/** @brief Priority of the thread printing deferred debug records. */
+#define CHIBIOS_CC3000_DBG_LOG_THD_PRIO     (LOWPRIO + 1)
+
 /*****************************************************************************/
 /* Under ordinary circumstances, below here should not need to be altered.   */
 /*****************************************************************************/
 
 /** @def CHIBIOS_CC3000_DBG_PRINT
  *  @brief Debug message print.
- *  @details Only if #CHIBIOS_CC3000_DBG_PRINT_ENABLED is TRUE.
+ *  @details Only if #CHIBIOS_CC3000_DBG_PRINT_ENABLED is TRUE. If
+ *           #CHIBIOS_CC3000_DBG_PRINT_DEFERRED is TRUE, at most 4 arguments,
+ *           each no larger than 32 bits, are stored.
+ *  @param fmt Formatted string, appropriate for chprintf().
+ *  @param ... Values for placeholders in @p fmt. */
+
+/** @def CHIBIOS_CC3000_DBG_PRINT_ISR
+ *  @brief Debug message print from an interrupt handler.
+ *  @details Only if #CHIBIOS_CC3000_DBG_PRINT_DEFERRED is TRUE, as the print
+ *           callback cannot be called from an interrupt handler. Otherwise
+ *           it does nothing.
  *  @param fmt Formatted string, appropriate for chprintf().
  *  @param ... Values for placeholders in @p fmt. */
 
 /** @def CHIBIOS_CC3000_DBG_PRINT_HEX
  *  @brief Debug hex print.
- *  @details Only if #CHIBIOS_CC3000_DBG_PRINT_ENABLED is TRUE. 
+ *  @details Only if #CHIBIOS_CC3000_DBG_PRINT_ENABLED is TRUE. If
+ *           #CHIBIOS_CC3000_DBG_PRINT_DEFERRED is TRUE the bytes are copied
+ *           into the ring and printed later.
  *  @param DATA Memory address of first element to print.
  *  @param LEN  Length of data to print. */
 
+/** @def CHIBIOS_CC3000_DBG_FLUSH
+ *  @brief Prints any deferred debug prints immediately.
+ *  @details Only if #CHIBIOS_CC3000_DBG_PRINT_DEFERRED is TRUE, otherwise
+ *           prints are never held and it does nothing. Used before the
+ *           driver halts on a fatal error, when the printing thread will
+ *           not run again. */
+
 #if CHIBIOS_CC3000_DBG_PRINT_ENABLED == FALSE
 
     #define CHIBIOS_CC3000_DBG_PRINT(fmt, ...)
+    #define CHIBIOS_CC3000_DBG_PRINT_ISR(fmt, ...)
     #define CHIBIOS_CC3000_DBG_PRINT_HEX(DATA, LEN)
+    #define CHIBIOS_CC3000_DBG_FLUSH()
+#elif CHIBIOS_CC3000_DBG_PRINT_DEFERRED == TRUE
+    void cc3000DbgLog(const char * file, int line, const char * fmt,
+                      unsigned int count, ...);
+    void cc3000DbgLogFromIsr(const char * file, int line, const char * fmt,
+                             unsigned int count, ...);
+    void cc3000DbgLogHex(const char * file, int line, const void * data,
+                         unsigned int len);
+    void cc3000DbgLogFlush(void);
+    void cc3000DbgLogStart(void);
+
+    /* Number of arguments passed, up to 4. */
+    #define CHIBIOS_CC3000_DBG_ARGS(...)                                    \
+                CHIBIOS_CC3000_DBG_ARGS_(__VA_ARGS__, 4, 3, 2, 1, 0)
+    #define CHIBIOS_CC3000_DBG_ARGS_(a, b, c, d, n, ...)    n
+
+    #define CHIBIOS_CC3000_DBG_PRINT(fmt, ...)                              \
+                cc3000DbgLog(__FILE__, __LINE__, fmt,                       \
+                             CHIBIOS_CC3000_DBG_ARGS(__VA_ARGS__), __VA_ARGS__)
+
+    #define CHIBIOS_CC3000_DBG_PRINT_ISR(fmt, ...)                          \
+                cc3000DbgLogFromIsr(__FILE__, __LINE__, fmt,                \
+                             CHIBIOS_CC3000_DBG_ARGS(__VA_ARGS__), __VA_ARGS__)
+
+    #define CHIBIOS_CC3000_DBG_PRINT_HEX(DATA, LEN)                         \
+                cc3000DbgLogHex(__FILE__, __LINE__, DATA, LEN)
+
+    #define CHIBIOS_CC3000_DBG_FLUSH()      cc3000DbgLogFlush()
 #else 
-    extern  cc3000PrintCb cc3000Print;
+    extern void (*cc3000Print)(const char * fmt, ...);
     #define CHIBIOS_CC3000_DBG_PRINT(fmt, ...)                              \
                 cc3000Print("(%s:%d) " fmt "\n\r", __FILE__, __LINE__, __VA_ARGS__)
 
+    #define CHIBIOS_CC3000_DBG_PRINT_ISR(fmt, ...)
+
     #define CHIBIOS_CC3000_DBG_PRINT_HEX(DATA, LEN)                         \
+    do                                                                      \
     {                                                                       \
-        int i = 0;                                                          \
-        while (i++ != LEN)                                                  \
+        unsigned int i;                                                     \
+        for (i = 0; i < (unsigned int)(LEN); i++)                           \
         {                                                                   \
-            cc3000Print("0x%02x ", DATA[i]);                                \
+            cc3000Print("0x%02x ", ((const uint8_t *)(DATA))[i]);           \
         }                                                                   \
-        cc3000Print("\r\n", NULL)
-    }
+        cc3000Print("\r\n", NULL);                                          \
+    } while (0)
+
+    #define CHIBIOS_CC3000_DBG_FLUSH()
 #endif
 
 /* If the SPI bus is not exclusive, we need mutex protection enabled. */
@@ -0,0 +1,843 @@
+/* Benchmarks of the CC3000 SPI driver.
+ * Each benchmark prints its results over serial. They are intended to be ran
+ * against different builds of this library to compare the effect of a
+ * change.
+ *
+ * CH_DBG_THREADS_PROFILING must be TRUE in chconf.h so the CPU time used by
+ * the benchmarking thread can be read. */
+
+#include "ch.h"
+#include "hal.h"
+#include "board.h"
+#include "chstreams.h"
+#include "chprintf.h"
+#include "string.h"
+#include "cc3000_chibios_api.h"
+#include "cc3000_spi_state.h"
+#include "async_handler.h"
+#include "socket.h"
+#include "hci.h"
+#include "nvmem.h"
+#include "netapp.h"
+
+#if !defined(CH_DBG_THREADS_PROFILING) || CH_DBG_THREADS_PROFILING != TRUE
+#error "CH_DBG_THREADS_PROFILING needs to be TRUE for the benchmarks."
+#endif
+
+/* Serial driver to be used */
+#define SERIAL_DRIVER       SD1
+
+/* SPI driver being used for CC3000 */
+#define SPI_DRIVER          SPID2
+
+/* EXT driver being used for CC3000 */
+#define EXT_DRIVER          EXTD1
+
+/* LED for notification setup */
+#define LED_PORT            GPIOB
+#define LED_PIN             GPIOB_LED3
+
+/* LED for error setup */
+#define LED_ERROR_PORT      GPIOB
+#define LED_ERROR_PIN       GPIOB_LED4
+
+/* Remote information. udp_server.py in the udp_client example can be used. */
+#define REMOTE_IP           0xA000001 /* 10.0.0.1 */
+#define REMOTE_PORT         44444
+
+/* Access point config - arguments to wlan_connect */
+#define SSID                "FYP"
+#define SSID_LEN            strlen(SSID)
+#define SEC_TYPE            WLAN_SEC_UNSEC
+#define KEY                 NULL
+#define KEY_LEN             0
+#define BSSID               NULL
+
+#define SUCCESS             0
+#define ERROR               -1
+
+/* Number of iterations of each benchmark */
+#define ITERATIONS          100
+
+/* Number of state changes timed by the state machine benchmark */
+#define STATE_ITERATIONS    10000
+
+/* Size of each datagram sent by the send benchmark */
+#define SEND_SIZE           1024
+
+Mutex printMtx;
+
+static SPIConfig chSpiConfig;
+static EXTConfig chExtConfig;
+
+static uint8_t sendBuffer[SEND_SIZE];
+
+static void print(const char * fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    chMtxLock(&printMtx);
+    chvprintf((BaseSequentialStream*)&SERIAL_DRIVER, fmt, ap);
+    chMtxUnlock();
+    va_end(ap);
+}
+
+/* Measures the CPU time used by this thread in the host driver to complete a
+ * command. Each nvmem_read_sp_version() is exactly one SpiWrite() followed by
+ * waiting on the response from the CC3000. A SpiWrite() which spins will
+ * consume close to all of the elapsed time. */
+static void benchSpiWrite(void)
+{
+    uint8_t patchVer[2];
+    systime_t cpuStart;
+    systime_t wallStart;
+    systime_t cpu;
+    systime_t wall;
+    int i;
+
+    print("--Start of SpiWrite benchmark--", NULL);
+
+    cpuStart = chThdSelf()->p_time;
+    wallStart = chTimeNow();
+
+    for (i = 0; i < ITERATIONS; i++)
+    {
+        nvmem_read_sp_version(patchVer);
+    }
+
+    cpu = chThdSelf()->p_time - cpuStart;
+    wall = chTimeNow() - wallStart;
+
+    print("Iterations: %d", ITERATIONS);
+    print("Tick frequency: %u Hz", CH_FREQUENCY);
+    print("Elapsed ticks: %u", wall);
+    print("CPU ticks: %u", cpu);
+    print("CPU ticks per 100 SpiWrite(): %u", (cpu * 100) / ITERATIONS);
+    print("--End of SpiWrite benchmark--", NULL);
+}
+
+/* Measures the round trip latency of a command, from the start of the write
+ * until the host driver has been passed the response. */
+static void benchRxLatency(void)
+{
+    uint8_t patchVer[2];
+    halrtcnt_t start;
+    halrtcnt_t elapsed;
+    halrtcnt_t min = (halrtcnt_t)-1;
+    halrtcnt_t max = 0;
+    uint64_t total = 0;
+    int i;
+
+    print("--Start of RX latency benchmark--", NULL);
+
+    for (i = 0; i < ITERATIONS; i++)
+    {
+        start = halGetCounterValue();
+        nvmem_read_sp_version(patchVer);
+        elapsed = halGetCounterValue() - start;
+
+        total += elapsed;
+        min = elapsed < min ? elapsed : min;
+        max = elapsed > max ? elapsed : max;
+    }
+
+    print("Iterations: %d", ITERATIONS);
+    print("Counter frequency: %u Hz", halGetCounterFrequency());
+    print("Min round trip: %u counts", min);
+    print("Max round trip: %u counts", max);
+    print("Avg round trip: %u counts", (halrtcnt_t)(total / ITERATIONS));
+    print("--End of RX latency benchmark--", NULL);
+}
+
+/* Starts the CC3000, measuring the time taken by wlan_start() and printing
+ * the boot timeline relative to when the CC3000 was powered off. The first
+ * write handshake delays are set by CHIBIOS_CC3000_DELAY_BACKEND and the
+ * waits around power on by CHIBIOS_CC3000_FAST_BOOT, so comparing builds
+ * with each shows the time saved. */
+static void benchBoot(void)
+{
+    cc3000BootTimeline timeline;
+    halrtcnt_t start;
+    halrtcnt_t elapsed;
+
+    print("--Start of boot benchmark--", NULL);
+    print("Delay backend: %d", CHIBIOS_CC3000_DELAY_BACKEND);
+    print("Fast boot: %d", CHIBIOS_CC3000_FAST_BOOT);
+
+    start = halGetCounterValue();
+    cc3000ChibiosWlanStart(0);
+    elapsed = halGetCounterValue() - start;
+
+    cc3000ChibiosGetBootTimeline(&timeline);
+
+    print("Counter frequency: %u Hz", halGetCounterFrequency());
+    print("wlan_start(): %u counts", elapsed);
+    print("wlan_start(): %u us",
+          (uint32_t)(((uint64_t)elapsed * 1000000) / halGetCounterFrequency()));
+    print("Power on: +%u counts", timeline.powerOn - timeline.powerOff);
+    print("IRQ asserted: +%u counts", timeline.irqAsserted - timeline.powerOff);
+    print("First write: +%u counts", timeline.firstWrite - timeline.powerOff);
+    print("Started: +%u counts", timeline.started - timeline.powerOff);
+    print("--End of boot benchmark--", NULL);
+}
+
+/* Measures the cost of a validated SPI state change, as made by the driver,
+ * against the lock zone it replaced. Both cycle through a read and a write
+ * on a local state so no other thread is involved. */
+static void benchStateTransition(void)
+{
+    static const spiState cycle[] = {
+        SPI_STATE_READ, SPI_STATE_IDLE, SPI_STATE_WRITE_REQUESTED,
+        SPI_STATE_WRITE_PERMITTED, SPI_STATE_IDLE
+    };
+    volatile spiState state = SPI_STATE_IDLE;
+    uint32_t illegal = 0;
+    halrtcnt_t start;
+    halrtcnt_t validated;
+    halrtcnt_t locked;
+    spiState from;
+    int i;
+
+    print("--Start of state transition benchmark--", NULL);
+
+    start = halGetCounterValue();
+    for (i = 0; i < STATE_ITERATIONS; i++)
+    {
+        from = state;
+        do
+        {
+            if (!spiStateTransitionValid(from, cycle[i % 5]))
+            {
+                illegal++;
+                break;
+            }
+        } while (!spiStateCompareSwap(&state, &from, cycle[i % 5]));
+    }
+    validated = halGetCounterValue() - start;
+
+    start = halGetCounterValue();
+    for (i = 0; i < STATE_ITERATIONS; i++)
+    {
+        chSysLock();
+        state = cycle[i % 5];
+        chSysUnlock();
+    }
+    locked = halGetCounterValue() - start;
+
+    print("Iterations: %d", STATE_ITERATIONS);
+    print("Illegal transitions: %u", illegal);
+    print("Validated compare and swap: %u counts per 100",
+          (validated * 100) / STATE_ITERATIONS);
+    print("Lock zone: %u counts per 100", (locked * 100) / STATE_ITERATIONS);
+    print("--End of state transition benchmark--", NULL);
+}
+
+#if CHIBIOS_CC3000_COMMAND_QUEUE == TRUE
+/* Makes the call timed by the command queue benchmark. */
+static long commandReadVersion(void *arg)
+{
+    return nvmem_read_sp_version(arg);
+}
+
+/* Compares the same call made directly under cc3000ChibiosLock(), through
+ * cc3000ChibiosCommandCall(), and submitted in batches filling the queue
+ * before waiting on any. The worker holds the host driver lock for each
+ * command, so batching only saves the hand offs between threads; the
+ * commands themselves are still made one at a time. */
+static void benchCommandQueue(void)
+{
+    cc3000Command commands[CHIBIOS_CC3000_COMMAND_QUEUE_SIZE];
+    uint8_t patchVer[CHIBIOS_CC3000_COMMAND_QUEUE_SIZE][2];
+    halrtcnt_t start;
+    halrtcnt_t direct;
+    halrtcnt_t called;
+    halrtcnt_t batched;
+    uint32_t failed = 0;
+    long result;
+    int i;
+    int j;
+
+    print("--Start of command queue benchmark--", NULL);
+
+    cc3000ChibiosCommandStart();
+
+    start = halGetCounterValue();
+    for (i = 0; i < ITERATIONS; i++)
+    {
+        cc3000ChibiosLock();
+        nvmem_read_sp_version(patchVer[0]);
+        cc3000ChibiosUnlock();
+    }
+    direct = halGetCounterValue() - start;
+
+    start = halGetCounterValue();
+    for (i = 0; i < ITERATIONS; i++)
+    {
+        if (cc3000ChibiosCommandCall(commandReadVersion, patchVer[0]) != 0)
+        {
+            failed++;
+        }
+    }
+    called = halGetCounterValue() - start;
+
+    start = halGetCounterValue();
+    for (i = 0; i < ITERATIONS; i += CHIBIOS_CC3000_COMMAND_QUEUE_SIZE)
+    {
+        for (j = 0; j < CHIBIOS_CC3000_COMMAND_QUEUE_SIZE; j++)
+        {
+            cc3000ChibiosCommandInit(&commands[j], commandReadVersion,
+                                     patchVer[j]);
+            cc3000ChibiosCommandSubmit(&commands[j], TIME_INFINITE);
+        }
+        for (j = 0; j < CHIBIOS_CC3000_COMMAND_QUEUE_SIZE; j++)
+        {
+            cc3000ChibiosCommandWait(&commands[j], TIME_INFINITE, &result);
+            if (result != 0)
+            {
+                failed++;
+            }
+        }
+    }
+    batched = halGetCounterValue() - start;
+
+    cc3000ChibiosCommandStop();
+
+    print("Iterations: %d", ITERATIONS);
+    print("Failed commands: %u", failed);
+    print("Direct: %u counts per call", direct / ITERATIONS);
+    print("Command call: %u counts per call", called / ITERATIONS);
+    print("Batches of %u: %u counts per call",
+          CHIBIOS_CC3000_COMMAND_QUEUE_SIZE,
+          batched / (((ITERATIONS + CHIBIOS_CC3000_COMMAND_QUEUE_SIZE - 1) /
+                      CHIBIOS_CC3000_COMMAND_QUEUE_SIZE) *
+                     CHIBIOS_CC3000_COMMAND_QUEUE_SIZE));
+    print("--End of command queue benchmark--", NULL);
+}
+#endif
+
+/* Prints the statistics of a driver instance. Each instance counts its own
+ * traffic, so with several CC3000s each can be checked independently. */
+static void printStatistics(cc3000Driver * drv)
+{
+    cc3000SpiStatistics stats;
+
+    cc3000ChibiosDriverGetStatistics(drv, &stats);
+
+    print("--Start of driver statistics--", NULL);
+    print("RX single read: %u", stats.rxSingleRead);
+    print("RX second read: %u", stats.rxSecondRead);
+    print("RX bytes: %u", stats.rxBytes);
+    print("TX bytes: %u", stats.txBytes);
+    print("RX packets: %u (data %u, events %u)", stats.rxPackets,
+          stats.rxDataPackets, stats.rxEventPackets);
+    print("RX max packet: %u of %u", stats.rxMaxPacket, CC3000_RX_BUFFER_SIZE);
+    print("TX packets: %u", stats.txPackets);
+    print("TX padding bytes: %u", stats.txPadBytes);
+    print("TX max packet: %u of %u", stats.txMaxPacket, CC3000_TX_BUFFER_SIZE);
+    print("TX wait: %u us",
+          (uint32_t)((stats.txWaitTime * 1000000) / stats.timeFrequency));
+    print("RX paused: %u us",
+          (uint32_t)((stats.rxPausedTime * 1000000) / stats.timeFrequency));
+    print("TX credit waits: %u", stats.txCreditWaits);
+    print("RX handshake timeouts: %u", stats.rxHandshakeTimeouts);
+    print("Illegal transitions: %u", stats.illegalTransitions);
+    if (stats.illegalTransitions != 0)
+    {
+        print("Last illegal transition: %u -> %u",
+              stats.lastIllegalFrom, stats.lastIllegalTo);
+    }
+    print("--End of driver statistics--", NULL);
+}
+
+/* Sends ITERATIONS datagrams with sendto(), or cc3000ChibiosSendZeroCopy()
+ * if zeroCopy, timing each call with the realtime counter. Returns false if
+ * a send failed. */
+static bool benchSendPath(const char * name, bool zeroCopy, int sock,
+                          sockaddr *destAddr)
+{
+    halrtcnt_t start;
+    halrtcnt_t elapsed;
+    halrtcnt_t min = (halrtcnt_t)-1;
+    uint64_t total = 0;
+    uint64_t bytes = 0;
+    int res;
+    int i;
+
+    for (i = 0; i < ITERATIONS; i++)
+    {
+        start = halGetCounterValue();
+        if (zeroCopy)
+        {
+            res = cc3000ChibiosSendZeroCopy(sock, sendBuffer, SEND_SIZE, 0,
+                                            destAddr, sizeof(sockaddr));
+        }
+        else
+        {
+            res = sendto(sock, sendBuffer, SEND_SIZE, 0,
+                         destAddr, sizeof(sockaddr));
+        }
+        elapsed = halGetCounterValue() - start;
+
+        if (res < 0)
+        {
+            print("%s returned error.", name);
+            return false;
+        }
+
+        total += elapsed;
+        min = elapsed < min ? elapsed : min;
+        bytes += SEND_SIZE;
+    }
+
+    print("%s bytes: %u", name, (uint32_t)bytes);
+    print("%s min counts per send: %u", name, min);
+    print("%s avg counts per send: %u", name, (uint32_t)(total / ITERATIONS));
+    print("%s bytes per 1000 counts: %u", name,
+          total ? (uint32_t)((bytes * 1000) / total) : 0);
+
+    return true;
+}
+
+/* Compares the cost of sendto() against cc3000ChibiosSendZeroCopy(). Each
+ * send is timed with the realtime counter, as the thread's CPU time only
+ * has a resolution of a system tick. Both wait the same for the CC3000, so
+ * the minimum counts per send show the copy saved best. */
+static void benchSend(int sock, sockaddr *destAddr)
+{
+    print("--Start of send benchmark--", NULL);
+    print("Counter frequency: %u Hz", halGetCounterFrequency());
+
+    memset(sendBuffer, 0xA5, sizeof(sendBuffer));
+
+    if (benchSendPath("sendto()", false, sock, destAddr))
+    {
+        benchSendPath("Zero copy", true, sock, destAddr);
+    }
+
+    print("--End of send benchmark--", NULL);
+}
+
+/* Compares the throughput of a burst of sendto() calls, which spin in the
+ * host driver when the CC3000 has no free buffer, against
+ * cc3000ChibiosSendPaced(), which waits for a TX credit. Run
+ * examples/udp_client/udp_server.py on REMOTE_IP to receive the packets.
+ * Results are printed in bytes per second, higher is better. */
+static void benchPacedSend(int sock, sockaddr *destAddr)
+{
+    cc3000SpiStatistics stats;
+    uint32_t creditWaits;
+    systime_t start;
+    systime_t elapsed;
+    uint64_t bytes;
+    int i;
+
+    print("--Start of paced send benchmark--", NULL);
+
+    memset(sendBuffer, 'A', sizeof(sendBuffer));
+
+    bytes = 0;
+    start = chTimeNow();
+    for (i = 0; i < ITERATIONS; i++)
+    {
+        if (sendto(sock, sendBuffer, SEND_SIZE, 0,
+                   destAddr, sizeof(sockaddr)) == ERROR)
+        {
+            print("sendto() returned error.", NULL);
+            return;
+        }
+        bytes += SEND_SIZE;
+    }
+    elapsed = chTimeElapsedSince(start);
+
+    print("sendto() bytes per second: %u",
+          elapsed ? (uint32_t)((bytes * CH_FREQUENCY) / elapsed) : 0);
+
+    cc3000ChibiosGetSpiStatistics(&stats);
+    creditWaits = stats.txCreditWaits;
+
+    bytes = 0;
+    start = chTimeNow();
+    for (i = 0; i < ITERATIONS; i++)
+    {
+        if (cc3000ChibiosSendPaced(sock, sendBuffer, SEND_SIZE, 0,
+                                   destAddr, sizeof(sockaddr),
+                                   TIME_INFINITE) < 0)
+        {
+            print("cc3000ChibiosSendPaced() returned error.", NULL);
+            return;
+        }
+        bytes += SEND_SIZE;
+    }
+    elapsed = chTimeElapsedSince(start);
+
+    cc3000ChibiosGetSpiStatistics(&stats);
+
+    print("Paced bytes per second: %u",
+          elapsed ? (uint32_t)((bytes * CH_FREQUENCY) / elapsed) : 0);
+    print("Paced sends waiting for a credit: %u",
+          stats.txCreditWaits - creditWaits);
+    print("Free TX buffers: %u", cc3000ChibiosTxCredits());
+
+    print("--End of paced send benchmark--", NULL);
+}
+
+#if CHIBIOS_CC3000_REACTOR == TRUE
+/* Number of sockets served by the reactor benchmark. */
+#define REACTOR_SOCKETS     4
+/* Duration of the reactor benchmark, in seconds. */
+#define REACTOR_SECONDS     10
+/* Message udp_server.py replies to. */
+#define REACTOR_MSG         "Hello World from CC3000"
+
+static sockaddr_in reactorDest;
+static volatile uint32_t reactorReplies;
+
+/* Reads a reply and sends the next message on the same socket, so each
+ * socket keeps one exchange with the server in flight. Runs on the reactor
+ * thread, which does not hold the host driver lock. */
+static void reactorOnRead(long sd, void *arg)
+{
+    char buf[32];
+    sockaddr from;
+    socklen_t fromLen = sizeof(from);
+
+    (void)arg;
+
+    cc3000ChibiosLock();
+    if (recvfrom(sd, buf, sizeof(buf), 0, &from, &fromLen) > 0)
+    {
+        reactorReplies++;
+        sendto(sd, REACTOR_MSG, sizeof(REACTOR_MSG) - 1, 0,
+               (sockaddr*)&reactorDest, sizeof(reactorDest));
+    }
+    cc3000ChibiosUnlock();
+}
+
+/* Measures how many replies from examples/udp_client/udp_server.py, running
+ * on REMOTE_IP, the reactor serves per second across REACTOR_SOCKETS
+ * sockets from one thread. */
+static void benchReactor(sockaddr_in *destAddr)
+{
+    cc3000ReactorStatistics stats;
+    long socks[REACTOR_SOCKETS];
+    int i;
+
+    print("--Start of reactor benchmark--", NULL);
+
+    reactorDest = *destAddr;
+    reactorReplies = 0;
+
+    for (i = 0; i < REACTOR_SOCKETS; i++)
+    {
+        if ((socks[i] = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == ERROR ||
+            !cc3000ChibiosReactorAdd(socks[i], reactorOnRead, NULL, NULL))
+        {
+            print("Unable to create socket %u.", i);
+            while (i-- > 0)
+            {
+                cc3000ChibiosReactorRemove(socks[i]);
+                closesocket(socks[i]);
+            }
+            return;
+        }
+    }
+
+    cc3000ChibiosReactorStart();
+
+    /* Start one exchange on each socket. */
+    for (i = 0; i < REACTOR_SOCKETS; i++)
+    {
+        cc3000ChibiosLock();
+        sendto(socks[i], REACTOR_MSG, sizeof(REACTOR_MSG) - 1, 0,
+               (sockaddr*)&reactorDest, sizeof(reactorDest));
+        cc3000ChibiosUnlock();
+    }
+
+    chThdSleep(S2ST(REACTOR_SECONDS));
+
+    cc3000ChibiosReactorStop();
+    cc3000ChibiosReactorGetStatistics(&stats);
+
+    for (i = 0; i < REACTOR_SOCKETS; i++)
+    {
+        cc3000ChibiosReactorRemove(socks[i]);
+        closesocket(socks[i]);
+    }
+
+    print("Sockets: %u", REACTOR_SOCKETS);
+    print("Replies served per second: %u", reactorReplies / REACTOR_SECONDS);
+    print("select() calls: %u (idle %u, errors %u)", stats.polls,
+          stats.idlePolls, stats.errors);
+    print("Read callbacks: %u", stats.reads);
+    print("Final select() timeout: %u ms", stats.timeoutMs);
+    print("--End of reactor benchmark--", NULL);
+}
+#endif
+
+#if CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS == TRUE
+/* Number of snapshots taken by each pass of the torn read test. */
+#define TORN_READS          100000
+/* Ping reports written each time the writer thread wakes. */
+#define TORN_WRITE_BURST    50
+
+static WORKING_AREA(tornWriterWorkingArea, 256);
+
+/* Feeds ping reports whose fields all hold the same count through the
+ * asynchronous callback, as the thread receiving packets would. Wakes every
+ * tick at a higher priority than the reader, so it preempts the reader at
+ * arbitrary points. */
+static msg_t tornWriterThread(void *arg)
+{
+    volatile uint32_t *writes = arg;
+    netapp_pingreport_args_t report;
+
+    while (!chThdShouldTerminate())
+    {
+        unsigned int i;
+
+        for (i = 0; i < TORN_WRITE_BURST; i++)
+        {
+            (*writes)++;
+            report.packets_sent = *writes;
+            report.packets_received = *writes;
+            report.min_round_time = *writes;
+            report.max_round_time = *writes;
+            report.avg_round_time = *writes;
+            chibiosCc3000AsyncCb(HCI_EVNT_WLAN_ASYNC_PING_REPORT,
+                                 (char *)&report, sizeof(report));
+        }
+        chThdSleep(1);
+    }
+
+    return 0;
+}
+
+/* Checks that a ping report was not torn, i.e. every field is from the same
+ * write. */
+static bool reportTorn(const netapp_pingreport_args_t *report)
+{
+    return report->packets_received != report->packets_sent ||
+           report->min_round_time != report->packets_sent ||
+           report->max_round_time != report->packets_sent ||
+           report->avg_round_time != report->packets_sent;
+}
+
+/* Hammers cc3000ChibiosGetAsyncData() against a writer and counts snapshots
+ * whose ping report fields disagree. A pass copying the report directly
+ * shows the test can see torn reads; the sequence count should leave none.
+ * Ran before the CC3000 is started, so the writer is the only source of
+ * asynchronous events. */
+static void benchTornReads(void)
+{
+    cc3000AsynchronousData data;
+    netapp_pingreport_args_t report;
+    volatile uint32_t writes = 0;
+    uint32_t tornDirect = 0;
+    uint32_t tornSeq = 0;
+    uint32_t start;
+    Thread *writer;
+    int i;
+
+    print("--Start of torn read test--", NULL);
+
+    writer = chThdCreateStatic(tornWriterWorkingArea,
+                               sizeof(tornWriterWorkingArea),
+                               chThdGetPriority() + 1,
+                               tornWriterThread, (void *)&writes);
+
+    start = writes;
+    for (i = 0; i < TORN_READS; i++)
+    {
+        memcpy(&report, (const void *)&cc3000AsyncData.ping.report,
+               sizeof(report));
+        if (reportTorn(&report))
+        {
+            tornDirect++;
+        }
+    }
+    print("Direct copies: %u, torn: %u, writes: %u", TORN_READS, tornDirect,
+          writes - start);
+
+    start = writes;
+    for (i = 0; i < TORN_READS; i++)
+    {
+        cc3000ChibiosGetAsyncData(&data);
+        if (reportTorn(&data.ping.report))
+        {
+            tornSeq++;
+        }
+    }
+    print("Snapshots: %u, torn: %u, writes: %u", TORN_READS, tornSeq,
+          writes - start);
+
+    chThdTerminate(writer);
+    chThdWait(writer);
+
+    cc3000ChibiosClearAsyncData(CC3000_ASYNC_DATA_PING);
+
+    print("--End of torn read test--", NULL);
+}
+#endif
+
+/* Connects to the access point and creates the UDP socket used by the
+ * network benchmarks. Returns ERROR on failure. */
+static int connectNetwork(void)
+{
+    int sock;
+
+    print("Attempting to connect to network...", NULL);
+    if (wlan_connect(SEC_TYPE, SSID, SSID_LEN, BSSID, KEY, KEY_LEN) != SUCCESS)
+    {
+        print("Unable to connect to access point.", NULL);
+        return ERROR;
+    }
+
+    cc3000ChibiosWaitConnected(TIME_INFINITE);
+    print("Connected!", NULL);
+
+    print("Waiting for DHCP...", NULL);
+    cc3000ChibiosWaitDhcp(TIME_INFINITE);
+    print("Received!", NULL);
+
+    if ((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == ERROR)
+    {
+        print("socket() returned error.", NULL);
+        return ERROR;
+    }
+
+    return sock;
+}
+
+static void cc3000Benchmark(void)
+{
+    sockaddr_in destAddr;
+    int sock;
+
+    print("Before cc3000ChibiosWlanInit", NULL);
+    cc3000ChibiosWlanInit(&SPI_DRIVER, &chSpiConfig,
+                          &EXT_DRIVER, &chExtConfig,
+                          0,0,0, print);
+    print("After cc3000ChibiosWlanInit", NULL);
+
+#if CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS == TRUE
+    benchTornReads();
+#endif
+
+    print("Before wlan_start", NULL);
+    benchBoot();
+    print("After wlan_start", NULL);
+
+    benchStateTransition();
+    benchSpiWrite();
+    benchRxLatency();
+#if CHIBIOS_CC3000_COMMAND_QUEUE == TRUE
+    benchCommandQueue();
+#endif
+
+    if ((sock = connectNetwork()) == ERROR)
+    {
+        return;
+    }
+
+    destAddr.sin_family = AF_INET;
+    destAddr.sin_port = htons(REMOTE_PORT);
+    destAddr.sin_addr.s_addr = htonl(REMOTE_IP);
+
+    benchSend(sock, (sockaddr*)&destAddr);
+    benchPacedSend(sock, (sockaddr*)&destAddr);
+
+#if CHIBIOS_CC3000_REACTOR == TRUE
+    benchReactor(&destAddr);
+#endif
+
+    printStatistics(cc3000ActiveDriver);
+
+#if CHIBIOS_CC3000_TRACE == TRUE
+    /* Decode with util/trace_decode.py */
+    cc3000ChibiosDumpTrace(print);
+#endif
+
+    closesocket(sock);
+}
+
+
+void setupSpiHw(void)
+{
+#ifdef STM32L1XX_MD
+
+    /* SPI Config */
+    chSpiConfig.end_cb = NULL;
+    chSpiConfig.ssport = CHIBIOS_CC3000_NSS_PORT;
+    chSpiConfig.sspad = CHIBIOS_CC3000_NSS_PAD;
+    chSpiConfig.cr1 = SPI_CR1_CPHA |    /* 2nd clock transition first data capture edge */
+                      (SPI_CR1_BR_1 | SPI_CR1_BR_0 );   /* BR: 011 - 2 MHz  */
+
+    /* Setup SPI pins */
+    palSetPad(CHIBIOS_CC3000_NSS_PORT, CHIBIOS_CC3000_NSS_PAD);
+    palSetPadMode(CHIBIOS_CC3000_NSS_PORT, CHIBIOS_CC3000_NSS_PAD,
+                  PAL_MODE_OUTPUT_PUSHPULL |
+                  PAL_STM32_OSPEED_LOWEST);     /* 400 kHz */
+
+    palSetPadMode(CHIBIOS_CC3000_SPI_PORT, CHIBIOS_CC3000_SCK_PAD,
+                  PAL_MODE_ALTERNATE(5) |       /* SPI */
+                  PAL_STM32_OTYPE_PUSHPULL |
+                  PAL_STM32_OSPEED_MID2);       /* 10 MHz */
+
+    palSetPadMode(CHIBIOS_CC3000_SPI_PORT, CHIBIOS_CC3000_MISO_PAD,
+                  PAL_MODE_ALTERNATE(5));       /* SPI */
+
+    palSetPadMode(CHIBIOS_CC3000_SPI_PORT, CHIBIOS_CC3000_MOSI_PAD,
+                  PAL_MODE_ALTERNATE(5) |       /* SPI */
+                  PAL_STM32_OTYPE_PUSHPULL |
+                  PAL_STM32_OSPEED_MID2);       /* 10 MHz */
+
+    /* Setup IRQ pin */
+    palSetPadMode(CHIBIOS_CC3000_IRQ_PORT, CHIBIOS_CC3000_IRQ_PAD,
+                  PAL_MODE_INPUT_PULLUP);
+
+    /* Setup WLAN EN pin.
+       With the pin low, we sleep here to make sure CC3000 is off.  */
+    palClearPad(CHIBIOS_CC3000_WLAN_EN_PORT, CHIBIOS_CC3000_WLAN_EN_PAD);
+    palSetPadMode(CHIBIOS_CC3000_WLAN_EN_PORT, CHIBIOS_CC3000_WLAN_EN_PAD,
+                  PAL_MODE_OUTPUT_PUSHPULL |
+                  PAL_STM32_OSPEED_LOWEST);     /* 400 kHz */
+
+#endif /* STM32L1XX_MD */
+
+    extObjectInit(&EXT_DRIVER);
+    spiObjectInit(&SPI_DRIVER);
+}
+
+int main(void)
+{
+    halInit();
+    chSysInit();
+
+    /* Led for status */
+    palClearPad(LED_PORT, LED_PIN);
+    palSetPadMode(LED_PORT, LED_PIN, PAL_MODE_OUTPUT_PUSHPULL);
+
+    /* Led for error */
+    palClearPad(LED_ERROR_PORT, LED_ERROR_PIN);
+    palSetPadMode(LED_ERROR_PORT, LED_ERROR_PIN, PAL_MODE_OUTPUT_PUSHPULL);
+
+    /* Serial for debugging */
+    sdStart(&SERIAL_DRIVER, NULL);
+    palSetPadMode(GPIOA, 9, PAL_MODE_ALTERNATE(7));
+    palSetPadMode(GPIOA, 10, PAL_MODE_ALTERNATE(7));
+
+    /* Mtx to protect chprintf */
+    chMtxInit(&printMtx);
+
+    /* Setup hardware for interfacing with CC3000 */
+    setupSpiHw();
+
+    cc3000Benchmark();
+
+    palSetPad(LED_PORT, LED_PIN);
+    wlan_stop();
+    while (1);
+
+  return 0;
+}
+
@@ -7,6 +7,19 @@
 SPIConfig chSpiConfig;
 
 #ifdef STM32L1XX_MD
+/* SPI speeds, slowest first, to be passed to
+ * cc3000ChibiosNegotiateSpiSpeed() after wlan_start(). Only cr1 is used. */
+const SPIConfig chSpiSpeeds[] = {
+    /* BR: 011 - 2 MHz */
+    {NULL, 0, 0, SPI_CR1_CPHA | SPI_CR1_BR_1 | SPI_CR1_BR_0},
+    /* BR: 010 - 4 MHz */
+    {NULL, 0, 0, SPI_CR1_CPHA | SPI_CR1_BR_1},
+    /* BR: 001 - 8 MHz */
+    {NULL, 0, 0, SPI_CR1_CPHA | SPI_CR1_BR_0},
+    /* BR: 000 - 16 MHz */
+    {NULL, 0, 0, SPI_CR1_CPHA},
+};
+
 void setupCC3000Hw(void)
 {
     /* SPI Config */
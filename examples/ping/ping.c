@@ -74,6 +74,7 @@ static void cc3000Ping(void)
     uint8_t patchVer[2];
     uint32_t remoteHostIp;
     tNetappIpconfigRetArgs ipConfig;
+    cc3000AsynchronousData asyncData;
 
     print("Before cc3000ChibiosWlanInit", NULL);
     cc3000ChibiosWlanInit(&SPI_DRIVER, &chSpiConfig,
@@ -99,17 +100,11 @@ static void cc3000Ping(void)
         return;
     }
 
-    while (cc3000AsyncData.connected != 1)
-    {
-        chThdSleep(MS2ST(5));
-    }
+    cc3000ChibiosWaitConnected(TIME_INFINITE);
     print("Connected!", NULL);
 
     print("Waiting for DHCP...", NULL);
-    while (cc3000AsyncData.dhcp.present != 1)
-    {
-        chThdSleep(MS2ST(5));
-    }
+    cc3000ChibiosWaitDhcp(TIME_INFINITE);
     print("Received!", NULL);
 
     print("Finding IP information...", NULL);
@@ -124,25 +119,23 @@ static void cc3000Ping(void)
     /* I believe there is an active bug against the ping report where 
      * some of the numbers are incorrect. Loop here forever waiting on 
      * a valid response and hope it arrives... */
-    while (cc3000AsyncData.ping.report.packets_received != 3)
+    do
     {
         print("Pinging...", NULL);
-        memset((void *)&cc3000AsyncData.ping, 0, sizeof(cc3000AsyncData.ping));
+        cc3000ChibiosClearAsyncData(CC3000_ASYNC_DATA_PING);
         netapp_ping_send(&remoteHostIp, 3, 10, 3000);
         
-        while (cc3000AsyncData.ping.present != TRUE)
-        {
-            chThdSleep(MS2ST(100));
-        }
+        cc3000ChibiosWaitPingReport(TIME_INFINITE);
+        cc3000ChibiosGetAsyncData(&asyncData);
 
         print("--Ping Results--:", NULL);
-        print("Number of Packets Sent: %u", cc3000AsyncData.ping.report.packets_sent);
-        print("Number of Packet Received: %u", cc3000AsyncData.ping.report.packets_received);
-        print("Min Round Time: %u", cc3000AsyncData.ping.report.min_round_time);
-        print("Max Round Time: %u", cc3000AsyncData.ping.report.max_round_time);
-        print("Avg Round Time: %u", cc3000AsyncData.ping.report.avg_round_time);
+        print("Number of Packets Sent: %u", asyncData.ping.report.packets_sent);
+        print("Number of Packet Received: %u", asyncData.ping.report.packets_received);
+        print("Min Round Time: %u", asyncData.ping.report.min_round_time);
+        print("Max Round Time: %u", asyncData.ping.report.max_round_time);
+        print("Avg Round Time: %u", asyncData.ping.report.avg_round_time);
         print("--End of Ping Results--", NULL);
-    }
+    } while (asyncData.ping.report.packets_received != 3);
     palSetPad(LED_PORT, LED_PIN);
     while(1);
 }
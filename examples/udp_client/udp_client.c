@@ -107,18 +107,12 @@ static void cc3000Udp(void)
         return;
     }
 
-    while (cc3000AsyncData.connected != 1)
-    {
-        chThdSleep(MS2ST(5));
-    }
+    cc3000ChibiosWaitConnected(TIME_INFINITE);
 
     print("Connected!", NULL);
 
     print("Waiting for DHCP...", NULL);
-    while (cc3000AsyncData.dhcp.present != 1)
-    {
-        chThdSleep(MS2ST(5));
-    }
+    cc3000ChibiosWaitDhcp(TIME_INFINITE);
     print("Received!", NULL);
 
     print("Finding IP information...", NULL);
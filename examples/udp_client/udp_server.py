@@ -26,7 +26,7 @@ print("Bound!")
 while True:
     data_bytes, (src_ip, src_port) = sock.recvfrom(256)
 
-    data = data_bytes.decode()
+    data = data_bytes.decode(errors="replace")
     
     print("Message Received:")
     print("data is: ", data)
@@ -27,6 +27,7 @@
 *******************************************************************************/
 
 #include "cc3000_chibios_api.h"
+#include "async_handler.h"
 #include "hci.h"
 #include "string.h"
 
@@ -50,105 +51,562 @@ typedef struct {
 /** @brief Length of DHCP information and status byte. */
 #define DHCP_INFO_LENGTH_STATUS         (sizeof(tNetappDhcpParams) + 1)
 
-/** @brief Asynchronous information provided by the CC3000.
- *  @details This is updated whenever the asynchronous callback is fired.
- *           Its elements will require to be manually cleared in some 
- *           circumstances to ensure the information is still relevant. */
-volatile cc3000AsynchronousData cc3000AsyncData;
+/** @name Asynchronous event slots
+ *  @brief Index of each event type in the handler tables.
+ *  @details The WLAN event types are single bits above
+ *           HCI_EVNT_WLAN_UNSOL_BASE, so their slot is the number of that
+ *           bit.
+ *  @{ */
+#define ASYNC_SLOT_WLAN_BITS            12
+#define ASYNC_SLOT_SHUT_DOWN            12
+#define ASYNC_SLOT_OTHER                13
+/** @} */
+
+#if ASYNC_SLOT_OTHER + 1 != CC3000_ASYNC_SLOTS
+#error "CC3000_ASYNC_SLOTS does not match the slots of async_handler.c."
+#endif
+
+/** @brief Finds the slot of an event type.
+ *  @param eventType Event type, or #CC3000_ASYNC_OTHER.
+ *  @return The slot, #ASYNC_SLOT_OTHER for any other type. */
+static unsigned int asyncEventSlot(long eventType)
+{
+    unsigned long bits = (unsigned long)eventType - HCI_EVNT_WLAN_UNSOL_BASE;
+
+    if (bits != 0 && bits < (1UL << ASYNC_SLOT_WLAN_BITS) &&
+        (bits & (bits - 1)) == 0)
+    {
+        return __builtin_ctzl(bits);
+    }
+    else if (eventType == HCI_EVENT_CC3000_CAN_SHUT_DOWN)
+    {
+        return ASYNC_SLOT_SHUT_DOWN;
+    }
+
+    return ASYNC_SLOT_OTHER;
+}
+
+/** @brief The slot of a WLAN event type. */
+#define WLAN_SLOT(type)     (__builtin_ctz((type) - HCI_EVNT_WLAN_UNSOL_BASE))
+
+/** @brief CC3000_EVENT flags broadcast for each slot. */
+static const flagsmask_t asyncEventFlags[CC3000_ASYNC_SLOTS] =
+{
+    [WLAN_SLOT(HCI_EVNT_WLAN_UNSOL_CONNECT)] = CC3000_EVENT_CONNECT,
+    [WLAN_SLOT(HCI_EVNT_WLAN_UNSOL_DISCONNECT)] = CC3000_EVENT_DISCONNECT,
+    [WLAN_SLOT(HCI_EVNT_WLAN_UNSOL_DHCP)] = CC3000_EVENT_DHCP,
+    [WLAN_SLOT(HCI_EVNT_WLAN_ASYNC_PING_REPORT)] = CC3000_EVENT_PING_REPORT,
+    [WLAN_SLOT(HCI_EVNT_WLAN_ASYNC_SIMPLE_CONFIG_DONE)] =
+                                            CC3000_EVENT_SMART_CONFIG_DONE,
+    [WLAN_SLOT(HCI_EVNT_BSD_TCP_CLOSE_WAIT)] = CC3000_EVENT_TCP_CLOSE_WAIT,
+    [ASYNC_SLOT_SHUT_DOWN] = CC3000_EVENT_SHUTDOWN_OK,
+};
+
+#if CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS == TRUE
+/* The sequence count of cc3000AsyncData is written by the thread receiving
+ * packets and by cc3000ChibiosDriverClearAsyncData(), from any priority.
+ * Each increment is made in a lock zone, so Clear cannot preempt one half
+ * done, and Clear only writes while no other write is in progress. */
+#if defined(__GCC_ATOMIC_INT_LOCK_FREE) && (__GCC_ATOMIC_INT_LOCK_FREE == 2)
+#define SEQ_LOAD(p)         __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define SEQ_STORE(p, v)     __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define SEQ_FENCE_WRITE()   __atomic_thread_fence(__ATOMIC_RELEASE)
+#define SEQ_FENCE_READ()    __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#else
+#define SEQ_LOAD(p)         (*(p))
+#define SEQ_STORE(p, v)     do { *(p) = (v); } while (0)
+#define SEQ_FENCE_WRITE()   __asm__ volatile ("" ::: "memory")
+#define SEQ_FENCE_READ()    __asm__ volatile ("" ::: "memory")
+#endif
+
+/** @brief Marks the start of an update of an instance's async data, from
+ *         within a lock zone.
+ *  @param drv The instance. */
+static inline void asyncDataWriteBeginS(cc3000Driver * drv)
+{
+    SEQ_STORE(&drv->asyncDataSeq, drv->asyncDataSeq + 1);
+    SEQ_FENCE_WRITE();
+}
+
+/** @brief Marks the end of an update of an instance's async data, from
+ *         within a lock zone.
+ *  @param drv The instance. */
+static inline void asyncDataWriteEndS(cc3000Driver * drv)
+{
+    SEQ_STORE(&drv->asyncDataSeq, drv->asyncDataSeq + 1);
+}
+
+/** @brief Marks the start of an update of an instance's async data.
+ *  @param drv The instance. */
+static inline void asyncDataWriteBegin(cc3000Driver * drv)
+{
+    chSysLock();
+    asyncDataWriteBeginS(drv);
+    chSysUnlock();
+}
+
+/** @brief Marks the end of an update of an instance's async data.
+ *  @param drv The instance. */
+static inline void asyncDataWriteEnd(cc3000Driver * drv)
+{
+    chSysLock();
+    asyncDataWriteEndS(drv);
+    chSysUnlock();
+}
+
+/** @brief Default handler of HCI_EVNT_WLAN_ASYNC_SIMPLE_CONFIG_DONE. */
+static void defaultSmartConfigDone(long eventType, char * data,
+                                   unsigned char length)
+{
+    (void)eventType;
+    (void)data;
+    (void)length;
+    cc3000AsyncData.smartConfigFinished = TRUE;
+}
+
+/** @brief Default handler of HCI_EVNT_WLAN_UNSOL_CONNECT. */
+static void defaultConnect(long eventType, char * data, unsigned char length)
+{
+    (void)eventType;
+    (void)data;
+    (void)length;
+    cc3000AsyncData.connected = TRUE;
+}
+
+/** @brief Default handler of HCI_EVNT_WLAN_UNSOL_DISCONNECT. */
+static void defaultDisconnect(long eventType, char * data,
+                              unsigned char length)
+{
+    (void)eventType;
+    (void)data;
+    (void)length;
+    cc3000AsyncData.connected = FALSE;
+    cc3000AsyncData.dhcp.present = FALSE;
+}
+
+/** @brief Default handler of HCI_EVNT_WLAN_ASYNC_PING_REPORT. */
+static void defaultPingReport(long eventType, char * data,
+                              unsigned char length)
+{
+    (void)eventType;
+
+    if (length == sizeof(cc3000AsyncData.ping.report))
+    {
+        memcpy((void*)&cc3000AsyncData.ping.report, data,
+               sizeof(cc3000AsyncData.ping.report));
+        cc3000AsyncData.ping.present = TRUE;
+    }
+}
+
+/** @brief Default handler of HCI_EVNT_WLAN_UNSOL_DHCP. */
+static void defaultDhcp(long eventType, char * data, unsigned char length)
+{
+    (void)eventType;
+
+    if (length == DHCP_INFO_LENGTH_STATUS &&
+        (data[DHCP_INFO_STATUS_BYTE] == 0))
+    {
+        memcpy((void*)&cc3000AsyncData.dhcp.info, data,
+               sizeof(cc3000AsyncData.dhcp.info));
+
+        cc3000AsyncData.dhcp.present = TRUE;
+
+        CHIBIOS_CC3000_DBG_PRINT("aucIP: %x", *(uint32_t*)cc3000AsyncData.dhcp.info.aucIP);
+        CHIBIOS_CC3000_DBG_PRINT("aucSubnetMask: %x",*(uint32_t*)cc3000AsyncData.dhcp.info.aucSubnetMask);
+        CHIBIOS_CC3000_DBG_PRINT("aucDefaultGateway: %x", *(uint32_t*)cc3000AsyncData.dhcp.info.aucDefaultGateway);
+        CHIBIOS_CC3000_DBG_PRINT("aucDHCPServer: %x", *(uint32_t*)cc3000AsyncData.dhcp.info.aucDHCPServer);
+        CHIBIOS_CC3000_DBG_PRINT("aucDNSServer: %x", *(uint32_t*)cc3000AsyncData.dhcp.info.aucDNSServer);
+    }
+    else
+    {
+        cc3000AsyncData.dhcp.present = FALSE;
+    }
+}
+
+/** @brief Default handler of HCI_EVENT_CC3000_CAN_SHUT_DOWN. */
+static void defaultShutdownOk(long eventType, char * data,
+                              unsigned char length)
+{
+    (void)eventType;
+    (void)data;
+    (void)length;
+    cc3000AsyncData.shutdownOk = TRUE;
+}
+
+/** @brief Handlers updating #cc3000AsyncData for each slot. */
+static const cc3000AsyncHandler asyncDefaultHandlers[CC3000_ASYNC_SLOTS] =
+{
+    [WLAN_SLOT(HCI_EVNT_WLAN_UNSOL_CONNECT)] = defaultConnect,
+    [WLAN_SLOT(HCI_EVNT_WLAN_UNSOL_DISCONNECT)] = defaultDisconnect,
+    [WLAN_SLOT(HCI_EVNT_WLAN_UNSOL_DHCP)] = defaultDhcp,
+    [WLAN_SLOT(HCI_EVNT_WLAN_ASYNC_PING_REPORT)] = defaultPingReport,
+    [WLAN_SLOT(HCI_EVNT_WLAN_ASYNC_SIMPLE_CONFIG_DONE)] =
+                                                    defaultSmartConfigDone,
+    [ASYNC_SLOT_SHUT_DOWN] = defaultShutdownOk,
+};
+#endif /* CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS */
 
 /** @brief Asynchronous callback function.
  *  @details This function is registed to the host driver via wlan_start().
- *           It updates #cc3000AsyncData as required.
+ *           It looks up the slot of the event type, calls the default
+ *           handler, updating #cc3000AsyncData of the active driver
+ *           instance, then any handler registered with
+ *           cc3000ChibiosSetAsyncHandler(), and broadcasts the matching
+ *           CC3000_EVENT flags.
  *  @param eventType See TI doxygen API for sWlanCB parameter of wlan_init().
  *  @param data  See TI doxygen API doxygen API for sWlanCB parameter of wlan_init().
  *  @param length See TI doxygen API sWlanCB parameter of wlan_init().*/
 void chibiosCc3000AsyncCb(long eventType, char * data, unsigned char length)
 {
-    (void)length;
+    cc3000Driver *drv = cc3000ActiveDriver;
+    unsigned int slot = asyncEventSlot(eventType);
+    cc3000AsyncHandler handler;
 
-    if (eventType == HCI_EVNT_WLAN_KEEPALIVE)
+    CHIBIOS_CC3000_DBG_PRINT("Async Event. Type: %x.", eventType);
+
+#if CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS == TRUE
+    if ((handler = asyncDefaultHandlers[slot]) != NULL)
     {
-        CHIBIOS_CC3000_DBG_PRINT("HCI_EVNT_WLAN_KEEPALIVE", NULL);
+        asyncDataWriteBegin(drv);
+        handler(eventType, data, length);
+        asyncDataWriteEnd(drv);
     }
+#endif
 
-    else if (eventType == HCI_EVNT_WLAN_ASYNC_SIMPLE_CONFIG_DONE)
+    if ((handler = drv->asyncHandlers[slot]) != NULL)
     {
-        CHIBIOS_CC3000_DBG_PRINT("HCI_EVNT_WLAN_ASYNC_SIMPLE_CONFIG_DONE", NULL);
-        cc3000AsyncData.smartConfigFinished = TRUE;
+        handler(eventType, data, length);
     }
 
-    else if (eventType == HCI_EVNT_WLAN_UNSOL_INIT)
+    if (asyncEventFlags[slot])
     {
-        CHIBIOS_CC3000_DBG_PRINT("HCI_EVNT_WLAN_UNSOL_INIT", NULL);
+        chEvtBroadcastFlags(&drv->asyncEventSource, asyncEventFlags[slot]);
     }
 
-    else if (eventType == HCI_EVNT_WLAN_TX_COMPLETE)
+#if CHIBIOS_CC3000_EVENT_DISPATCH == TRUE
+    /* User handlers run later on the dispatcher thread. */
+    cc3000EventDispatchPush(drv, eventType, data, length);
+#endif
+}
+
+
+/** @brief Registers the handler of one type of an instance's asynchronous
+ *         events.
+ *  @details Replaces any handler already registered for the type. It is
+ *           called after the library's own handling of the event, see
+ *           #CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS.
+ *  @param[in] drv The instance.
+ *  @param[in] eventType Event type, e.g. HCI_EVNT_WLAN_UNSOL_CONNECT, or
+ *                       #CC3000_ASYNC_OTHER for all types not otherwise
+ *                       known.
+ *  @param[in] handler The handler, or NULL to remove it.
+ *  @return False if @p eventType is not known, and is not
+ *          #CC3000_ASYNC_OTHER. */
+bool cc3000ChibiosDriverSetAsyncHandler(cc3000Driver * drv, long eventType,
+                                        cc3000AsyncHandler handler)
+{
+    unsigned int slot = asyncEventSlot(eventType);
+
+    if (slot == ASYNC_SLOT_OTHER && eventType != CC3000_ASYNC_OTHER)
     {
-        CHIBIOS_CC3000_DBG_PRINT("HCI_EVNT_WLAN_TX_COMPLETE", NULL);
+        return false;
     }
 
-    else if (eventType == HCI_EVNT_WLAN_UNSOL_CONNECT)
+    drv->asyncHandlers[slot] = handler;
+
+    return true;
+}
+
+
+/** @brief Registers the handler of one type of asynchronous event of
+ *         #cc3000ActiveDriver.
+ *  @details See #cc3000ChibiosDriverSetAsyncHandler().
+ *  @param[in] eventType Event type, or #CC3000_ASYNC_OTHER.
+ *  @param[in] handler The handler, or NULL to remove it.
+ *  @return False if @p eventType is not known. */
+bool cc3000ChibiosSetAsyncHandler(long eventType, cc3000AsyncHandler handler)
+{
+    return cc3000ChibiosDriverSetAsyncHandler(cc3000ActiveDriver, eventType,
+                                              handler);
+}
+
+
+/** @brief Retrieves the source of an instance's asynchronous events.
+ *  @details Listeners registered on it are passed CC3000_EVENT flags, read
+ *           with chEvtGetAndClearFlags(), as asynchronous events are
+ *           received.
+ *  @param[in] drv The instance.
+ *  @return The event source. */
+EventSource * cc3000ChibiosDriverGetEventSource(cc3000Driver * drv)
+{
+    return &drv->asyncEventSource;
+}
+
+
+/** @brief Retrieves the source of asynchronous events of
+ *         #cc3000ActiveDriver.
+ *  @details See #cc3000ChibiosDriverGetEventSource().
+ *  @return The event source. */
+EventSource * cc3000ChibiosGetEventSource(void)
+{
+    return cc3000ChibiosDriverGetEventSource(cc3000ActiveDriver);
+}
+
+
+/** @brief Time left of a timeout.
+ *  @details Shared by the library's services through async_handler.h.
+ *  @param start When the wait started.
+ *  @param timeout The timeout, may be TIME_INFINITE.
+ *  @return Time left, or TIME_IMMEDIATE if the timeout has passed. */
+systime_t cc3000TimeRemaining(systime_t start, systime_t timeout)
+{
+    systime_t elapsed = chTimeElapsedSince(start);
+
+    if (timeout == TIME_INFINITE)
     {
-        CHIBIOS_CC3000_DBG_PRINT("HCI_EVNT_WLAN_UNSOL_CONNECT", NULL);
-        cc3000AsyncData.connected = TRUE;
+        return TIME_INFINITE;
     }
-    
-    else if (eventType == HCI_EVNT_WLAN_ASYNC_PING_REPORT)
+
+    return elapsed < timeout ? timeout - elapsed : TIME_IMMEDIATE;
+}
+
+
+/** @brief Waits for any of a set of asynchronous events.
+ *  @details Only events received after the call are seen. Uses event
+ *           #CHIBIOS_CC3000_WAIT_EVENT_ID of the calling thread.
+ *  @param[in] flags CC3000_EVENT flags to wait for.
+ *  @param[in] timeout Maximum time to wait, or TIME_INFINITE.
+ *  @return The flags of @p flags received, or 0 on a timeout. */
+flagsmask_t cc3000ChibiosWaitEvents(flagsmask_t flags, systime_t timeout)
+{
+    EventSource *source = cc3000ChibiosGetEventSource();
+    eventmask_t mask = EVENT_MASK(CHIBIOS_CC3000_WAIT_EVENT_ID);
+    systime_t start = chTimeNow();
+    systime_t remaining;
+    EventListener listener;
+    flagsmask_t received = 0;
+
+    chEvtRegisterMask(source, &listener, mask);
+
+    while (received == 0)
     {
-        CHIBIOS_CC3000_DBG_PRINT("HCI_EVNT_WLAN_ASYNC_PING_REPORT",  NULL);
-        if (length == sizeof(cc3000AsyncData.ping.report))
+        remaining = cc3000TimeRemaining(start, timeout);
+
+        if (remaining == TIME_IMMEDIATE ||
+            chEvtWaitAnyTimeout(mask, remaining) == 0)
         {
-            memcpy((void*)&cc3000AsyncData.ping.report, data,
-                   sizeof(cc3000AsyncData.ping.report));
-            cc3000AsyncData.ping.present = TRUE;
+            break;
         }
+
+        received = chEvtGetAndClearFlags(&listener) & flags;
     }
 
-    else if (eventType == HCI_EVNT_WLAN_UNSOL_DISCONNECT)
+    chEvtUnregister(source, &listener);
+    chEvtGetAndClearEvents(mask);
+
+    return received;
+}
+
+
+/** @brief Waits for a condition to become true.
+ *  @details The listener is registered on @p source before the condition
+ *           is first checked, so an event arriving in between is not
+ *           missed. The condition is checked again after every event. Uses
+ *           event #CHIBIOS_CC3000_WAIT_EVENT_ID of the calling thread.
+ *           Shared by the library's services through async_handler.h.
+ *  @param source Broadcasts whenever the condition may have changed.
+ *  @param done Checks the condition.
+ *  @param timeout Maximum time to wait, or TIME_INFINITE.
+ *  @return The result of @p done. */
+bool cc3000WaitCondition(EventSource *source, bool (*done)(void),
+                         systime_t timeout)
+{
+    eventmask_t mask = EVENT_MASK(CHIBIOS_CC3000_WAIT_EVENT_ID);
+    systime_t start = chTimeNow();
+    systime_t remaining;
+    EventListener listener;
+    bool result;
+
+    chEvtRegisterMask(source, &listener, mask);
+
+    while ((result = done()) == false)
     {
-        CHIBIOS_CC3000_DBG_PRINT("HCI_EVNT_WLAN_UNSOL_DISCONNECT", NULL);
-        cc3000AsyncData.connected = FALSE;
-        cc3000AsyncData.dhcp.present = FALSE;
+        remaining = cc3000TimeRemaining(start, timeout);
+
+        if (remaining == TIME_IMMEDIATE ||
+            chEvtWaitAnyTimeout(mask, remaining) == 0)
+        {
+            result = done();
+            break;
+        }
+
+        chEvtGetAndClearFlags(&listener);
     }
 
-    else if (eventType == HCI_EVNT_WLAN_UNSOL_DHCP)
+    chEvtUnregister(source, &listener);
+    chEvtGetAndClearEvents(mask);
+
+    return result;
+}
+
+
+#if CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS == TRUE
+
+/** @brief Checks if the CC3000 is connected.
+ *  @return cc3000AsyncData.connected. */
+static bool isConnected(void)
+{
+    return cc3000AsyncData.connected;
+}
+
+
+/** @brief Checks if DHCP information has been received.
+ *  @return cc3000AsyncData.dhcp.present. */
+static bool isDhcpPresent(void)
+{
+    return cc3000AsyncData.dhcp.present;
+}
+
+
+/** @brief Checks if a ping report has been received.
+ *  @return cc3000AsyncData.ping.present. */
+static bool isPingPresent(void)
+{
+    return cc3000AsyncData.ping.present;
+}
+
+
+/** @brief Waits until the CC3000 is connected to an access point.
+ *  @details Returns at once if already connected. Uses event
+ *           #CHIBIOS_CC3000_WAIT_EVENT_ID of the calling thread.
+ *  @param[in] timeout Maximum time to wait, or TIME_INFINITE.
+ *  @return True if connected. */
+bool cc3000ChibiosWaitConnected(systime_t timeout)
+{
+    return cc3000WaitCondition(cc3000ChibiosGetEventSource(), isConnected,
+                               timeout);
+}
+
+
+/** @brief Waits until DHCP information has been received.
+ *  @details Returns at once if cc3000AsyncData.dhcp.present is already set.
+ *           Uses event #CHIBIOS_CC3000_WAIT_EVENT_ID of the calling thread.
+ *  @param[in] timeout Maximum time to wait, or TIME_INFINITE.
+ *  @return True if DHCP information is present. */
+bool cc3000ChibiosWaitDhcp(systime_t timeout)
+{
+    return cc3000WaitCondition(cc3000ChibiosGetEventSource(), isDhcpPresent,
+                               timeout);
+}
+
+
+/** @brief Waits until a ping report has been received.
+ *  @details Returns at once if cc3000AsyncData.ping.present is already set,
+ *           so it should be cleared before sending the ping. Uses event
+ *           #CHIBIOS_CC3000_WAIT_EVENT_ID of the calling thread.
+ *  @param[in] timeout Maximum time to wait, or TIME_INFINITE.
+ *  @return True if a ping report is present. */
+bool cc3000ChibiosWaitPingReport(systime_t timeout)
+{
+    return cc3000WaitCondition(cc3000ChibiosGetEventSource(), isPingPresent,
+                               timeout);
+}
+
+
+/** @brief Takes a consistent copy of an instance's #cc3000AsyncData.
+ *  @details Never blocks the thread receiving packets. If an update is in
+ *           progress, or completes during the copy, the copy is taken again.
+ *           Sleeps a tick if the update was interrupted by the caller, so
+ *           the thread making it can finish.
+ *  @param[in] drv The instance.
+ *  @param[out] data The copy. */
+void cc3000ChibiosDriverGetAsyncData(cc3000Driver * drv,
+                                     cc3000AsynchronousData * data)
+{
+    uint32_t seq;
+
+    while (1)
     {
-        CHIBIOS_CC3000_DBG_PRINT("HCI_EVNT_WLAN_UNSOL_DHCP", NULL);
+        seq = SEQ_LOAD(&drv->asyncDataSeq);
 
-        if (length == DHCP_INFO_LENGTH_STATUS &&
-            (data[DHCP_INFO_STATUS_BYTE] == 0))
+        if ((seq & 1) == 0)
         {
-            memcpy((void*)&cc3000AsyncData.dhcp.info, data,
-                   sizeof(cc3000AsyncData.dhcp.info));
-
-            cc3000AsyncData.dhcp.present = TRUE;
+            memcpy(data, (const void*)&drv->asyncData, sizeof(*data));
+            SEQ_FENCE_READ();
 
-            CHIBIOS_CC3000_DBG_PRINT("aucIP: %x", *(uint32_t*)cc3000AsyncData.dhcp.info.aucIP);
-            CHIBIOS_CC3000_DBG_PRINT("aucSubnetMask: %x",*(uint32_t*)cc3000AsyncData.dhcp.info.aucSubnetMask);
-            CHIBIOS_CC3000_DBG_PRINT("aucDefaultGateway: %x", *(uint32_t*)cc3000AsyncData.dhcp.info.aucDefaultGateway);
-            CHIBIOS_CC3000_DBG_PRINT("aucDHCPServer: %x", *(uint32_t*)cc3000AsyncData.dhcp.info.aucDHCPServer);
-            CHIBIOS_CC3000_DBG_PRINT("aucDNSServer: %x", *(uint32_t*)cc3000AsyncData.dhcp.info.aucDNSServer);
+            if (drv->asyncDataSeq == seq)
+            {
+                return;
+            }
         }
         else
         {
-            cc3000AsyncData.dhcp.present = FALSE;
+            chThdSleep(1);
         }
     }
+}
+
+
+/** @brief Takes a consistent copy of #cc3000AsyncData.
+ *  @details See #cc3000ChibiosDriverGetAsyncData().
+ *  @param[out] data The copy. */
+void cc3000ChibiosGetAsyncData(cc3000AsynchronousData * data)
+{
+    cc3000ChibiosDriverGetAsyncData(cc3000ActiveDriver, data);
+}
 
-    else if (eventType == HCI_EVNT_BSD_TCP_CLOSE_WAIT)
+
+/** @brief Clears parts of an instance's #cc3000AsyncData.
+ *  @details Readers using #cc3000ChibiosDriverGetAsyncData() see the parts
+ *           either before or after they are cleared. Waits a tick at a time
+ *           while an update by the thread receiving packets is in progress.
+ *           May be called from a thread of any priority.
+ *  @param[in] drv The instance.
+ *  @param[in] parts CC3000_ASYNC_DATA values of the parts to clear. */
+void cc3000ChibiosDriverClearAsyncData(cc3000Driver * drv,
+                                       unsigned int parts)
+{
+    volatile cc3000AsynchronousData *asyncData = &drv->asyncData;
+
+    chSysLock();
+    while (drv->asyncDataSeq & 1)
     {
-        CHIBIOS_CC3000_DBG_PRINT("HCI_EVNT_BSD_TCP_CLOSE_WAIT", NULL);
+        chThdSleepS(1);
     }
 
-    else if (eventType == HCI_EVENT_CC3000_CAN_SHUT_DOWN)
+    asyncDataWriteBeginS(drv);
+
+    if (parts & CC3000_ASYNC_DATA_SHUTDOWN_OK)
     {
-        cc3000AsyncData.shutdownOk = TRUE;
+        asyncData->shutdownOk = FALSE;
     }
-    
-    else
+    if (parts & CC3000_ASYNC_DATA_SMART_CONFIG)
+    {
+        asyncData->smartConfigFinished = FALSE;
+    }
+    if (parts & CC3000_ASYNC_DATA_CONNECTED)
+    {
+        asyncData->connected = FALSE;
+    }
+    if (parts & CC3000_ASYNC_DATA_DHCP)
     {
-        CHIBIOS_CC3000_DBG_PRINT("Unexpected Async Event. Type: %x.", eventType);
+        memset((void*)&asyncData->dhcp, 0, sizeof(asyncData->dhcp));
     }
+    if (parts & CC3000_ASYNC_DATA_PING)
+    {
+        memset((void*)&asyncData->ping, 0, sizeof(asyncData->ping));
+    }
+
+    asyncDataWriteEndS(drv);
+    chSysUnlock();
 }
 
 
+/** @brief Clears parts of #cc3000AsyncData.
+ *  @details See #cc3000ChibiosDriverClearAsyncData().
+ *  @param[in] parts CC3000_ASYNC_DATA values of the parts to clear. */
+void cc3000ChibiosClearAsyncData(unsigned int parts)
+{
+    cc3000ChibiosDriverClearAsyncData(cc3000ActiveDriver, parts);
+}
+#endif /* CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS */
@@ -33,5 +33,14 @@
 
 void chibiosCc3000AsyncCb(long eventType, char * data, unsigned char length);
 
+systime_t cc3000TimeRemaining(systime_t start, systime_t timeout);
+bool cc3000WaitCondition(EventSource * source, bool (*done)(void),
+                         systime_t timeout);
+
+void cc3000EventDispatchPush(cc3000Driver * drv, long type,
+                             const char * data, unsigned char length);
+void cc3000EventDispatchStart(cc3000Driver * drv);
+void cc3000EventDispatchStop(cc3000Driver * drv);
+
 #endif /* __ASYNC_HANDLER__*/
 
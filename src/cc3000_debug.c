@@ -0,0 +1,327 @@
+/** @file
+*   @brief Deferred debug prints, see #CHIBIOS_CC3000_DBG_PRINT_DEFERRED. */
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#include "ch.h"
+#include "cc3000_chibios_config.h"
+#include "cc3000_chibios_api.h"
+#include <stdarg.h>
+#include <string.h>
+
+#if CHIBIOS_CC3000_DBG_PRINT_ENABLED == TRUE && \
+    CHIBIOS_CC3000_DBG_PRINT_DEFERRED == TRUE
+
+#if (CHIBIOS_CC3000_DBG_LOG_SIZE & (CHIBIOS_CC3000_DBG_LOG_SIZE - 1)) != 0
+#error "CHIBIOS_CC3000_DBG_LOG_SIZE must be a power of 2."
+#endif
+
+/** @brief Set if a record can be claimed without a lock zone. */
+#if defined(__GCC_ATOMIC_INT_LOCK_FREE) && (__GCC_ATOMIC_INT_LOCK_FREE == 2)
+#define DBG_LOG_ATOMIC              TRUE
+#else
+#define DBG_LOG_ATOMIC              FALSE
+#endif
+
+/** @brief Maximum number of arguments stored with a print. */
+#define DBG_LOG_MAX_ARGS            4
+/** @brief Maximum number of bytes stored by a single hex record. */
+#define DBG_LOG_HEX_B               (DBG_LOG_MAX_ARGS * sizeof(uint32_t))
+
+/** @brief A deferred debug print. */
+typedef struct
+{
+    /** @brief Number of the record plus one, written last to publish it.
+     *  @details 0 while the record is unused or being written. */
+    volatile uint32_t seq;
+    const char *fmt;            ///< Format string. NULL for a hex record.
+    const char *file;           ///< Source file of the print.
+    uint16_t line;              ///< Source line of the print.
+    uint8_t count;              ///< Number of arguments or bytes held.
+    union
+    {
+        uint32_t args[DBG_LOG_MAX_ARGS];    ///< Arguments of @p fmt.
+        uint8_t bytes[DBG_LOG_HEX_B];       ///< Bytes of a hex record.
+    } data;
+} dbgLogRecord;
+
+extern void (*cc3000Print)(const char * fmt, ...);
+
+/** @brief Ring of deferred prints. */
+static dbgLogRecord dbgLog[CHIBIOS_CC3000_DBG_LOG_SIZE];
+/** @brief Number of records ever claimed. */
+static volatile uint32_t dbgLogHead;
+/** @brief Number of the next record to be printed. */
+static uint32_t dbgLogTail;
+/** @brief Thread printing the records. NULL until started. */
+static Thread *dbgLogThd;
+/** @brief Working area of #dbgLogThd. */
+static WORKING_AREA(dbgLogThdWorkingArea, CHIBIOS_CC3000_DBG_LOG_THD_AREA);
+
+/** @brief Claims the next record of the ring.
+ *  @param number Where to store the number of the record, for
+ *                #dbgLogPublish().
+ *  @param fromIsr True if called from an interrupt handler, which needs
+ *                 the ISR lock zone when atomics are not available.
+ *  @return The claimed record. */
+static dbgLogRecord * dbgLogClaim(uint32_t *number, bool fromIsr)
+{
+#if DBG_LOG_ATOMIC == TRUE
+    (void)fromIsr;
+    *number = __atomic_fetch_add(&dbgLogHead, 1, __ATOMIC_RELAXED);
+#else
+    if (fromIsr)
+    {
+        chSysLockFromIsr();
+        *number = dbgLogHead++;
+        chSysUnlockFromIsr();
+    }
+    else
+    {
+        chSysLock();
+        *number = dbgLogHead++;
+        chSysUnlock();
+    }
+#endif
+
+    dbgLog[*number & (CHIBIOS_CC3000_DBG_LOG_SIZE - 1)].seq = 0;
+
+    return &dbgLog[*number & (CHIBIOS_CC3000_DBG_LOG_SIZE - 1)];
+}
+
+/** @brief Makes a filled in record visible to the printing thread.
+ *  @param record The record.
+ *  @param number Number of the record, from #dbgLogClaim(). */
+static void dbgLogPublish(dbgLogRecord *record, uint32_t number)
+{
+#if DBG_LOG_ATOMIC == TRUE
+    __atomic_store_n(&record->seq, number + 1, __ATOMIC_RELEASE);
+#else
+    record->seq = number + 1;
+#endif
+}
+
+/** @brief Stores a debug print in the next record.
+ *  @param file Source file of the print.
+ *  @param line Source line of the print.
+ *  @param fmt Format string, which must remain valid, i.e. a literal.
+ *  @param count Number of arguments in @p ap.
+ *  @param ap Arguments of @p fmt, each no larger than 32 bits.
+ *  @param fromIsr True if called from an interrupt handler. */
+static void dbgLogStore(const char * file, int line, const char * fmt,
+                        unsigned int count, va_list ap, bool fromIsr)
+{
+    dbgLogRecord *record;
+    uint32_t number;
+    unsigned int i;
+
+    record = dbgLogClaim(&number, fromIsr);
+    record->fmt = fmt;
+    record->file = file;
+    record->line = line;
+    record->count = count < DBG_LOG_MAX_ARGS ? count : DBG_LOG_MAX_ARGS;
+
+    for (i = 0; i < record->count; i++)
+    {
+        record->data.args[i] = va_arg(ap, uint32_t);
+    }
+
+    dbgLogPublish(record, number);
+}
+
+/** @brief Stores a debug print to be formatted later.
+ *  @details Used by #CHIBIOS_CC3000_DBG_PRINT.
+ *  @param file Source file of the print.
+ *  @param line Source line of the print.
+ *  @param fmt Format string, which must remain valid, i.e. a literal.
+ *  @param count Number of arguments following.
+ *  @param ... Arguments of @p fmt, each no larger than 32 bits. */
+void cc3000DbgLog(const char * file, int line, const char * fmt,
+                  unsigned int count, ...)
+{
+    va_list ap;
+
+    va_start(ap, count);
+    dbgLogStore(file, line, fmt, count, ap, false);
+    va_end(ap);
+}
+
+/** @brief Stores a debug print made from an interrupt handler.
+ *  @details Used by #CHIBIOS_CC3000_DBG_PRINT_ISR. See #cc3000DbgLog().
+ *  @param file Source file of the print.
+ *  @param line Source line of the print.
+ *  @param fmt Format string, which must remain valid, i.e. a literal.
+ *  @param count Number of arguments following.
+ *  @param ... Arguments of @p fmt, each no larger than 32 bits. */
+void cc3000DbgLogFromIsr(const char * file, int line, const char * fmt,
+                         unsigned int count, ...)
+{
+    va_list ap;
+
+    va_start(ap, count);
+    dbgLogStore(file, line, fmt, count, ap, true);
+    va_end(ap);
+}
+
+/** @brief Stores bytes to be printed later in hex.
+ *  @details Used by #CHIBIOS_CC3000_DBG_PRINT_HEX. Long buffers take several
+ *           records.
+ *  @param file Source file of the print.
+ *  @param line Source line of the print.
+ *  @param data Bytes to print.
+ *  @param len Number of bytes at @p data. */
+void cc3000DbgLogHex(const char * file, int line, const void * data,
+                     unsigned int len)
+{
+    const uint8_t *bytes = data;
+    dbgLogRecord *record;
+    uint32_t number;
+    unsigned int count;
+
+    while (len)
+    {
+        count = len < DBG_LOG_HEX_B ? len : DBG_LOG_HEX_B;
+
+        record = dbgLogClaim(&number, false);
+        record->fmt = NULL;
+        record->file = file;
+        record->line = line;
+        record->count = count;
+        memcpy(record->data.bytes, bytes, count);
+        dbgLogPublish(record, number);
+
+        bytes += count;
+        len -= count;
+    }
+}
+
+/** @brief Prints a record through the print callback.
+ *  @param record Copy of the record. */
+static void dbgLogPrint(const dbgLogRecord *record)
+{
+    unsigned int i;
+
+    cc3000Print("(%s:%d) ", record->file, record->line);
+
+    if (record->fmt != NULL)
+    {
+        cc3000Print(record->fmt,
+                    record->data.args[0], record->data.args[1],
+                    record->data.args[2], record->data.args[3]);
+    }
+    else
+    {
+        for (i = 0; i < record->count; i++)
+        {
+            cc3000Print("0x%02x ", record->data.bytes[i]);
+        }
+    }
+
+    cc3000Print("\n\r");
+}
+
+/** @brief Prints all published records in order.
+ *  @details Used by #CHIBIOS_CC3000_DBG_FLUSH before the driver halts, so a
+ *           fatal error is not left in the ring, and by the printing thread.
+ *           Records overwritten before being printed are counted and
+ *           reported in their place. */
+void cc3000DbgLogFlush(void)
+{
+    dbgLogRecord record;
+    uint32_t seq;
+    uint32_t lost;
+
+    while (1)
+    {
+        dbgLogRecord *slot =
+            &dbgLog[dbgLogTail & (CHIBIOS_CC3000_DBG_LOG_SIZE - 1)];
+
+        seq = slot->seq;
+        if ((int32_t)(seq - (dbgLogTail + 1)) > 0)
+        {
+            /* Lapped by the writers, skip to the oldest record. */
+            lost = dbgLogHead - CHIBIOS_CC3000_DBG_LOG_SIZE - dbgLogTail;
+            dbgLogTail += lost;
+            cc3000Print("(%u debug records lost)\n\r", lost);
+            continue;
+        }
+        else if (seq != dbgLogTail + 1)
+        {
+            /* Not yet published. */
+            break;
+        }
+
+        record = *slot;
+
+        /* Check it was not overwritten while being copied. */
+        if (slot->seq != seq)
+        {
+            continue;
+        }
+
+        dbgLogTail++;
+        dbgLogPrint(&record);
+    }
+}
+
+/** @brief Prints published records every
+ *         #CHIBIOS_CC3000_DBG_LOG_DRAIN_MS.
+ *  @param arg Unused.
+ *  @return Never returns. */
+static msg_t dbgLogThread(void *arg)
+{
+    (void)arg;
+
+#if CH_USE_REGISTRY == TRUE
+    chRegSetThreadName(__FUNCTION__);
+#endif
+
+    while (1)
+    {
+        chThdSleep(MS2ST(CHIBIOS_CC3000_DBG_LOG_DRAIN_MS));
+        cc3000DbgLogFlush();
+    }
+
+    return 0;
+}
+
+/** @brief Starts the thread printing deferred debug records.
+ *  @details Only the first call has any effect. */
+void cc3000DbgLogStart(void)
+{
+    chSysLock();
+    if (dbgLogThd == NULL)
+    {
+        dbgLogThd = chThdCreateI(dbgLogThdWorkingArea,
+                                 sizeof(dbgLogThdWorkingArea),
+                                 CHIBIOS_CC3000_DBG_LOG_THD_PRIO,
+                                 dbgLogThread, NULL);
+        chSchWakeupS(dbgLogThd, RDY_OK);
+    }
+    chSysUnlock();
+}
+
+#endif /* CHIBIOS_CC3000_DBG_PRINT_DEFERRED */
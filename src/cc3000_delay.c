@@ -0,0 +1,127 @@
+/** @file
+*   @brief Microsecond delays for CC3000 protocol timings. */
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#include "ch.h"
+#include "hal.h"
+#include "cc3000_chibios_config.h"
+#include "cc3000_spi.h"
+
+#if CHIBIOS_CC3000_DELAY_BACKEND == CHIBIOS_CC3000_DELAY_POLLED
+#if !defined(HAL_IMPLEMENTS_COUNTERS) || HAL_IMPLEMENTS_COUNTERS != TRUE
+#error "CHIBIOS_CC3000_DELAY_POLLED needs a HAL implementing counters."
+#endif
+
+#elif CHIBIOS_CC3000_DELAY_BACKEND == CHIBIOS_CC3000_DELAY_GPT
+#if !defined(HAL_USE_GPT) || HAL_USE_GPT != TRUE
+#error "CHIBIOS_CC3000_DELAY_GPT needs HAL_USE_GPT to be TRUE."
+#endif
+
+/** @brief Smallest interval the GPT driver will accept for a one shot. */
+#define DELAY_GPT_MIN_INTERVAL      (2)
+
+static void delayGptCb(GPTDriver *gptp);
+
+/** @brief Config of #CHIBIOS_CC3000_DELAY_GPT_DRIVER. */
+static const GPTConfig delayGptConfig =
+{
+    CHIBIOS_CC3000_DELAY_GPT_FREQ,
+    delayGptCb
+};
+
+/** @brief Signalled when the one shot expires. */
+static BinarySemaphore delayGptSem;
+/** @brief Serialises use of the timer by several driver instances. */
+static Mutex delayGptMtx;
+/** @brief If the timer has been started. */
+static bool delayGptStarted = false;
+
+/** @brief GPT callback, wakes the delayed thread.
+ *  @param gptp Unused. */
+static void delayGptCb(GPTDriver *gptp)
+{
+    (void)gptp;
+
+    chSysLockFromIsr();
+    chBSemSignalI(&delayGptSem);
+    chSysUnlockFromIsr();
+}
+
+#elif CHIBIOS_CC3000_DELAY_BACKEND != CHIBIOS_CC3000_DELAY_SLEEP
+#error "Unknown CHIBIOS_CC3000_DELAY_BACKEND."
+#endif
+
+/** @brief Prepares the delay backend.
+ *  @details Called on initialisation of each driver instance; only the first
+ *           call has any effect. */
+void cc3000DelayInit(void)
+{
+#if CHIBIOS_CC3000_DELAY_BACKEND == CHIBIOS_CC3000_DELAY_GPT
+    chSysLock();
+    if (delayGptStarted == false)
+    {
+        chBSemInit(&delayGptSem, TRUE);
+        chMtxInit(&delayGptMtx);
+        delayGptStarted = true;
+        chSysUnlock();
+        gptStart(&CHIBIOS_CC3000_DELAY_GPT_DRIVER, &delayGptConfig);
+        return;
+    }
+    chSysUnlock();
+#endif
+}
+
+/** @brief Delays the calling thread by at least @p us microseconds.
+ *  @details The resolution depends on #CHIBIOS_CC3000_DELAY_BACKEND. With
+ *           #CHIBIOS_CC3000_DELAY_SLEEP the delay is rounded up to whole
+ *           system ticks.
+ *  @param us Microseconds to wait. */
+void cc3000DelayUs(uint32_t us)
+{
+#if CHIBIOS_CC3000_DELAY_BACKEND == CHIBIOS_CC3000_DELAY_POLLED
+    halPolledDelay(US2RTT(us));
+
+#elif CHIBIOS_CC3000_DELAY_BACKEND == CHIBIOS_CC3000_DELAY_GPT
+    gptcnt_t interval = (gptcnt_t)(((uint64_t)us *
+                                    CHIBIOS_CC3000_DELAY_GPT_FREQ +
+                                    999999) / 1000000);
+
+    if (interval < DELAY_GPT_MIN_INTERVAL)
+    {
+        interval = DELAY_GPT_MIN_INTERVAL;
+    }
+
+    chMtxLock(&delayGptMtx);
+    gptStartOneShot(&CHIBIOS_CC3000_DELAY_GPT_DRIVER, interval);
+    chBSemWait(&delayGptSem);
+    chMtxUnlock();
+
+#else
+    chThdSleep(US2ST(us));
+#endif
+}
+
@@ -39,10 +39,14 @@
 *****************************************************************************/
 
 #include "cc3000_chibios_config.h"
+#include "cc3000_chibios_api.h"
 #include "async_handler.h"
 #include "cc3000_spi.h"
+#include "cc3000_spi_state.h"
+#include "cc3000_trace.h"
 #include "hci.h"
 #include "wlan.h"
+#include "nvmem.h"
 
 /* OP Codes for CC3000_SPI_INDEX_OP */
 /** @brief Operation opcode for write. */
@@ -62,6 +66,11 @@
 /** @brief Index of second busy byte in the transmit buffer. */
 #define CC3000_SPI_INDEX_BUSY_2     4
 
+/** @brief Index of most significant byte of length in a received header. */
+#define CC3000_SPI_RX_INDEX_LEN_MSB 3
+/** @brief Index of least significant byte of length in a received header. */
+#define CC3000_SPI_RX_INDEX_LEN_LSB 4
+
 /** @brief Size of HEADERS_SIZE_EVNT. */
 #define CC3000_HEADERS_SIZE_EVNT    (SPI_HEADER_SIZE + 5)
 
@@ -69,7 +78,7 @@
 #define CC3000_SPI_MAGIC_NUMBER     (0xDE)
 /** @brief Location of #CC3000_SPI_MAGIC_NUMBER in transmit buffer. */
 #define CC3000_SPI_TX_MAGIC_INDEX   (CC3000_TX_BUFFER_SIZE - 1)
-/** @brief Location of #CC3000_SPI_MAGIC_NUMBER in receive buffer. */
+/** @brief Location of #CC3000_SPI_MAGIC_NUMBER in each receive buffer slot. */
 #define CC3000_SPI_RX_MAGIC_INDEX   (CC3000_RX_BUFFER_SIZE - 1)
 
 /** @brief Minimum number of bytes that can be read. */
@@ -78,65 +87,50 @@
 /** @brief Value of byte introduced to create a delay. */
 #define CC3000_SPI_BUSY             0
 
-/** @brief The various states of the CC3000 SPI driver. */
-typedef enum
-{
-    SPI_STATE_POWERUP,         ///< CC3000 powered up (Enable pin high).
-    SPI_STATE_INITIALIZED,     ///< CC3000 has responded to powerup (IRQ low).
-    SPI_STATE_IDLE,            ///< Idle.
-    SPI_STATE_WRITE_REQUESTED, ///< Write has been requested by selecting CC3000.
-    SPI_STATE_WRITE_PERMITTED, ///< Write has been permitted by CC3000 acknowledging.
-    SPI_STATE_READ             ///< Performing a read operation.
-} spiState;
+/** @brief TRUE if a shared SPI bus may be held across transactions. */
+#define CC3000_SPI_HOLD_BUS         ((CHIBIOS_CC3000_SPI_EXCLUSIVE == FALSE) && \
+                                     (CHIBIOS_CC3000_SPI_HOLD_MAX > 0))
 
-/** @brief Information required by CC3000 SPI driver. */
-typedef struct
-{
-    gcSpiHandleRx rxHandlerCb;      ///< Handler function for received data.
-    unsigned short txPacketLength;  ///< Number of bytes to transmit.
-    unsigned short rxPacketLength;  ///< Number of bytes received. (DEBUG)
-    spiState spiState;              ///< Current state of the driver.
-    unsigned char *pTxPacket;       ///< Points to data to be transmitted.
-    unsigned char *pRxPacket;       ///< Points to where to store received data.
-} tSpiInformation;
+#if CHIBIOS_CC3000_SPI_FIRST_READ_B < CC3000_SPI_MIN_READ_B
+#error "CHIBIOS_CC3000_SPI_FIRST_READ_B must be at least CC3000_SPI_MIN_READ_B."
+#endif
+
+#if CHIBIOS_CC3000_SPI_FIRST_READ_B > (CC3000_RX_BUFFER_SIZE - 1)
+#error "CHIBIOS_CC3000_SPI_FIRST_READ_B must leave room for the magic number."
+#endif
 
 /** @brief Transmit buffer.
+ *  @details Shared by every instance, as the host driver only supports one.
  *  @todo TI issue. The host driver (ver 1.11.1) *knows* its going to be called
  *  this, but still goes and stored it in tSLInformation.pucTxCommandBuffer...
  *  why? */
 unsigned char wlan_tx_buffer[CC3000_TX_BUFFER_SIZE];
 
-/** @brief Receive buffer. */
-static unsigned char spi_buffer[CC3000_RX_BUFFER_SIZE];
+/** @brief Written after a gathered packet which needs a padding byte. */
+static const unsigned char spiPaddingByte = 0;
 
 /** @brief These bytes should be sent to the CC3000 on every SPI read. */
 static const unsigned char spiReadCommand[] =
                         {CC3000_SPI_OP_READ, CC3000_SPI_BUSY, CC3000_SPI_BUSY};
 
-/** @brief Pointer to the ChibiOS SPI driver being used for CC3000 
- *         communications. */
-static SPIDriver * chSpiDriver;
-/** @brief Holds the SPI driver config. */
-static SPIConfig chSpiConfig;
-/** @brief Pointer to the ChibiOS EXT driver being used for CC3000 
- *         IRQ line monitoring. */
-static EXTDriver * chExtDriver;
-/** @brief Pointer to the EXT driver config. */
-static EXTConfig * chExtConfig;
-/** @brief CC3000 SPI driver data. */
-static volatile tSpiInformation spiInformation;
-/** @brief ChibiOS/RT semaphore to signal #irqSignalHandlerThread(). */
-static Semaphore irqSem;
-/** @brief ChibiOS/RT thread working aread for #irqSignalHandlerThread(). */
-static WORKING_AREA(irqSignalHandlerThreadWorkingArea,
-                    CHIBIOS_CC3000_IRQ_THD_AREA);
-
-/** @brief Flag to allow the IRQ thread to defer handling an
- *         interrupt.
- *  @details Needed to allow #SpiResumeSpi() and #SpiPauseSpi() to work as
- *           intended.
- **/
-static volatile bool spiPaused = true;
+cc3000Driver CC3000D1;
+
+cc3000Driver * cc3000ActiveDriver = &CC3000D1;
+
+/** @brief Pins of #CC3000D1, from cc3000_chibios_config.h. */
+static const cc3000DriverConfig cc3000DefaultConfig = {
+    CHIBIOS_CC3000_IRQ_PORT,
+    CHIBIOS_CC3000_IRQ_PAD,
+    CHIBIOS_CC3000_IRQ_EXT_MODE,
+    CHIBIOS_CC3000_WLAN_EN_PORT,
+    CHIBIOS_CC3000_WLAN_EN_PAD,
+    CHIBIOS_CC3000_NSS_PORT,
+    CHIBIOS_CC3000_NSS_PAD
+};
+
+/** @brief Instances which have been initialised, so callbacks from ChibiOS
+ *         drivers can be routed to the right one. */
+static cc3000Driver * cc3000Drivers[CHIBIOS_CC3000_MAX_DRIVERS];
 
 #if CHIBIOS_CC3000_DBG_PRINT_ENABLED == TRUE
 /** @brief Holds the pointer to the user function called to print debug
@@ -144,453 +138,1395 @@ static volatile bool spiPaused = true;
 cc3000PrintCb cc3000Print;
 #endif
 
-/** @ brief Pointer to the thread used to process CC3000 interrupts. */
-static Thread * pSignalHandlerThd = NULL;
-
-/** @brief Signals CC3000 for intent to communicate. */
-static void selectCC3000(void)
-{
-#if CHIBIOS_CC3000_SPI_EXCLUSIVE == FALSE 
-    spiAcquireBus(chSpiDriver);
-    spiStart(chSpiDriver, &chSpiConfig);
-#endif
-
-    spiSelect(chSpiDriver);
-}
-
-
-/** @brief Signals CC3000 for to end communications. */
-static void unselectCC3000(void)
-{
-    spiUnselect(chSpiDriver);
-
-#if CHIBIOS_CC3000_SPI_EXCLUSIVE == FALSE 
-    spiStop(chSpiDriver);
-    spiReleaseBus(chSpiDriver);
+#if CHIBIOS_CC3000_SPI_ASYNC == TRUE
+static void cc3000SpiEndCb(SPIDriver *spip);
 #endif
-}
 
-/** @brief Safely sets the state of the SPI driver. 
- *  @details This was added for the purpose of easier debug.
- *  @param state The new state.
- *  @return True if successful.*/
-static bool setSpiState(spiState state)
+/** @brief Finds the instance using a SPI driver.
+ *  @details Callable from an ISR.
+ *  @param spip The SPI driver.
+ *  @return The instance, or NULL if none. */
+static cc3000Driver * findDriverBySpi(SPIDriver *spip)
 {
-    /* Debug */
-#if 0
-    bool rtn = false;
+    unsigned int i;
 
-    chSysLock();
-    /* Reading only happends in irq. */
-    if (state == SPI_STATE_READ)
+    for (i = 0; i < CHIBIOS_CC3000_MAX_DRIVERS; i++)
     {
-        if (spiInformation.spiState == SPI_STATE_IDLE)
+        if (cc3000Drivers[i] != NULL && cc3000Drivers[i]->spiDriver == spip)
         {
-            spiInformation.spiState = SPI_STATE_READ;
-            rtn = true;
+            return cc3000Drivers[i];
         }
-        else
-        {
-            return false;
-        }
-
-        chSysUnlock();
-        return rtn;
-    }
-    
-    else if (state == SPI_STATE_INITIALIZED || state == SPI_STATE_POWERUP)
-    {
-        spiInformation.spiState = state;
-        rtn = true;
-        chSysUnlock();
-        return rtn;
     }
 
-    else if (state == SPI_STATE_WRITE_PERMITTED)
-    {
-        if (spiInformation.spiState != SPI_STATE_WRITE_REQUESTED)
-        {
-            port_halt(); /* This should never, ever happen. Probably */
-        }
-        else
-        {
-            spiInformation.spiState = SPI_STATE_WRITE_PERMITTED;
-            rtn = true;
-        }
-        chSysUnlock();
-        return rtn;
+    return NULL;
+}
 
-    }
 
-    while(1)
+/** @brief Finds the instance whose interrupt pin is monitored by an EXT
+ *         channel.
+ *  @details Callable from an ISR.
+ *  @param extp The EXT driver.
+ *  @param channel The EXT channel.
+ *  @return The instance, or NULL if none. */
+static cc3000Driver * findDriverByExt(EXTDriver *extp, expchannel_t channel)
+{
+    unsigned int i;
+
+    for (i = 0; i < CHIBIOS_CC3000_MAX_DRIVERS; i++)
     {
-        if (state == SPI_STATE_IDLE)
-        {
-            if (spiInformation.spiState == SPI_STATE_WRITE_PERMITTED ||
-                spiInformation.spiState == SPI_STATE_READ ||
-                spiInformation.spiState == SPI_STATE_INITIALIZED) /* TODO consider a first write state */
-            {
-                spiInformation.spiState = SPI_STATE_IDLE;
-                rtn = true;
-                chSysUnlock();
-                break;
-            }
-        }
-        else if (state == SPI_STATE_WRITE_REQUESTED)
+        if (cc3000Drivers[i] != NULL &&
+            cc3000Drivers[i]->extDriver == extp &&
+            cc3000Drivers[i]->config->irqPad == channel)
         {
-            if (spiInformation.spiState == SPI_STATE_IDLE)
-            {
-                spiInformation.spiState = SPI_STATE_WRITE_REQUESTED;
-                rtn = true;
-                chSysUnlock();
-                break;
-            }
+            return cc3000Drivers[i];
         }
-        chSysUnlock();
-        chThdSleep(3);
-        chSysLock();
     }
 
-    return rtn;
-#else 
-    chSysLock();
-    spiInformation.spiState = state;
-    chSysUnlock();
-    return true;
-#endif
+    return NULL;
 }
 
-/** @brief Writes data over SPI to the CC3000.
- *  @param data Data to be sent.
- *  @param size Number of bytes to be sent. */
-static void SpiWriteDataSynchronous(unsigned char *data, unsigned short size)
+/** @brief Copies a user supplied SPI config into cc3000Driver::spiConfig.
+ *  @details Fields which must be controlled by this driver are preserved.
+ *  @param drv Driver instance.
+ *  @param config Config holding the hardware settings to use. */
+static void copySpiConfig(cc3000Driver *drv, const SPIConfig * config)
 {
-    spiSend(chSpiDriver, size, data);
+    memcpy(&drv->spiConfig, config, sizeof(drv->spiConfig));
+
+#if CHIBIOS_CC3000_SPI_ASYNC == TRUE
+    drv->spiConfig.end_cb = cc3000SpiEndCb;
+#else
+    drv->spiConfig.end_cb = NULL;
+#endif
+    drv->spiConfig.ssport = drv->config->nssPort;
+    drv->spiConfig.sspad = drv->config->nssPad;
 }
 
 
-/** @brief Preforms the first write to the CC3000.
- *  @details The CC3000 requires a 50 us wait after the first four bytes of the
- *          first command from a powerup.
- *  @param pUserBuffer Data to write.
- *  @param usLength Size of data to write. */
-static void SpiFirstWrite(unsigned char *pUserBuffer, unsigned short usLength)
+/** @brief Changes the SPI config in use to one from the speed table.
+ *  @details The change takes effect at the start of the next transfer.
+ *  @param drv Driver instance.
+ *  @param index Index into cc3000Driver::spiSpeedTable. */
+static void setSpiSpeedI(cc3000Driver *drv, unsigned int index)
 {
-    selectCC3000();
-
-    chThdSleep(US2ST(50));
-
-    SpiWriteDataSynchronous(pUserBuffer, 4);
+    drv->spiSpeed.index = index;
+    drv->spiSpeedChanged = true;
+}
 
-    chThdSleep(US2ST(50));
 
-    SpiWriteDataSynchronous(pUserBuffer + 4, usLength - 4);
+/** @brief Falls back to the next slowest SPI config.
+ *  @details Called when communications at the current speed are suspect.
+ *           Ignored if no table of speeds has been given.
+ *  @param drv Driver instance.
+ *  @param reason Why the current speed is suspect. */
+static void spiSpeedFallbackI(cc3000Driver *drv, cc3000SpiFallback reason)
+{
+    if (drv->spiSpeedTable == NULL)
+    {
+        return;
+    }
 
-    setSpiState(SPI_STATE_IDLE);
+    drv->spiSpeed.fallbacks[reason]++;
+    drv->spiSpeed.lastFallback = reason;
 
-    unselectCC3000();
+    if (drv->spiSpeed.index > 0)
+    {
+        setSpiSpeedI(drv, drv->spiSpeed.index - 1);
+    }
 }
 
 
-/** @brief Reads SPI data from the CC3000 over SPI.
- *  @param data Pointer to the buffer to store the data.
- *  @param size Number of bytes to read. */
-static void SpiReadDataSynchronous(unsigned char *data, unsigned short size)
+/** @brief Checks if the driver already owns the shared SPI bus.
+ *  @param drv Driver instance.
+ *  @return True if #selectCC3000() need not acquire the bus. */
+static bool spiBusOwned(cc3000Driver *drv)
 {
-    spiExchange(chSpiDriver,
-                sizeof(spiReadCommand),
-                spiReadCommand,
-                data);
-    spiReceive(chSpiDriver,
-               size - sizeof(spiReadCommand),
-               &data[sizeof(spiReadCommand)]);
-
-    spiInformation.rxPacketLength += size;
+#if CC3000_SPI_HOLD_BUS == TRUE
+    return drv->spiBusHeld;
+#else
+    return false;
+#endif
 }
 
 
-/** @brief Responsible for calling into TI's host driver with received data. */
-static void SpiTriggerRxProcessing(void)
+/** @brief Signals CC3000 for intent to communicate.
+ *  @param drv Driver instance. */
+static void selectCC3000(cc3000Driver *drv)
 {
-    tSLInformation.WlanInterruptDisable();
- 
-    /** @todo TI Issue: This is where it is in their example.
-     * Can we not just hold this low, until we are done? i.e. move it until 
-     * just before we return from this function? This should mean the CC3000
-     * won't produce another interrupt until we are done processing this one. */
-    unselectCC3000(); 
+    bool changed;
 
-    if (spi_buffer[CC3000_SPI_RX_MAGIC_INDEX] != CC3000_SPI_MAGIC_NUMBER)
+#if CHIBIOS_CC3000_SPI_EXCLUSIVE == FALSE 
+    /* The held bus cannot be released while this transaction's state is
+     * not SPI_STATE_IDLE, so what is found here holds until unselected. */
+    drv->spiBusAcquired = spiBusOwned(drv) == false;
+    if (drv->spiBusAcquired == true)
     {
-        CHIBIOS_CC3000_DBG_PRINT("Buffer overflow detected.", NULL);
-        while(1);
+        spiAcquireBus(drv->spiDriver);
     }
+#endif
 
-    setSpiState(SPI_STATE_IDLE);
-    spiInformation.rxPacketLength = 0;
- 
+    chSysLock();
+    changed = drv->spiSpeedChanged;
+    drv->spiSpeedChanged = false;
+    chSysUnlock();
 
-    /* In 1.11.1: SpiReceiveHandler cc3000_spi.c */
-    spiInformation.rxHandlerCb(spiInformation.pRxPacket + SPI_HEADER_SIZE);
- 
+    if (changed == true)
+    {
+        copySpiConfig(drv, &drv->spiSpeedTable[drv->spiSpeed.index]);
+    }
 
+#if CHIBIOS_CC3000_SPI_EXCLUSIVE == FALSE 
+#if CHIBIOS_CC3000_SPI_CACHE_CONFIG == TRUE
+    /* Nothing to do if the last user of the bus left it configured for us.*/
+    if (changed == true ||
+        drv->spiDriver->state != SPI_READY ||
+        drv->spiDriver->config != &drv->spiConfig)
+    {
+        spiStart(drv->spiDriver, &drv->spiConfig);
+    }
+#else
+    spiStart(drv->spiDriver, &drv->spiConfig);
+#endif
+#else
+    if (changed == true)
+    {
+        /* Restarting a started driver applies the new config. */
+        spiStart(drv->spiDriver, &drv->spiConfig);
+    }
+#endif
 
+    spiSelect(drv->spiDriver);
+    CC3000_TRACE(drv, CC3000_TRACE_SELECT, 0, 0);
 }
 
-/** @brief Reads the SPI header from the CC3000. */
-static void SpiReadHeader(void)
-{
-    SpiReadDataSynchronous(spiInformation.pRxPacket, CC3000_SPI_MIN_READ_B);
-}
 
-/** @brief Reads remaining data after the SPI header.
- *  @details Called after data returned fomr #SpiReadHeader() has been
- *  processed. */
-static void SpiReadAfterHeader(void)
+/** @brief Signals CC3000 for to end communications.
+ *  @details Releases the shared SPI bus only if #selectCC3000() acquired
+ *           it for this transaction. Must be called before the state
+ *           returns to SPI_STATE_IDLE, so a bus held by the IRQ thread is
+ *           not released while the CC3000 is still selected.
+ *  @param drv Driver instance. */
+static void unselectCC3000(cc3000Driver *drv)
 {
-    long data_to_recv = 0;
-    unsigned char *evnt_buff, type;
-
-    /* Determine what type of packet we have */
-    evnt_buff =  spiInformation.pRxPacket;
-    STREAM_TO_UINT8((char *)(evnt_buff + SPI_HEADER_SIZE),
-                    HCI_PACKET_TYPE_OFFSET, type);
+    spiUnselect(drv->spiDriver);
+    CC3000_TRACE(drv, CC3000_TRACE_UNSELECT, 0, 0);
 
-    switch(type)
+#if CHIBIOS_CC3000_SPI_EXCLUSIVE == FALSE 
+    if (drv->spiBusAcquired == false)
     {
-        case HCI_TYPE_DATA:
-        {
-            /* We need to read the rest of data.. */
-            STREAM_TO_UINT16((char *)(evnt_buff + SPI_HEADER_SIZE),
-                             HCI_DATA_LENGTH_OFFSET, data_to_recv);
-
-            if (!((CC3000_HEADERS_SIZE_EVNT + data_to_recv) & 1))
-            {
-                data_to_recv++;
-            }
-
-            if (data_to_recv)
-            {
-                SpiReadDataSynchronous(evnt_buff + CC3000_SPI_MIN_READ_B,
-                                       data_to_recv);
-            }
-            break;
-        }
-        case HCI_TYPE_EVNT:
-        {
-            /* Calculate the rest length of the data*/
-            STREAM_TO_UINT8((char *)(evnt_buff + SPI_HEADER_SIZE),
-                            HCI_EVENT_LENGTH_OFFSET, data_to_recv);
-            data_to_recv -= 1;
-
-            /* Add padding byte if needed */
-            if ((CC3000_HEADERS_SIZE_EVNT + data_to_recv) & 1)
-            {
-                data_to_recv++;
-            }
-
-            if (data_to_recv)
-            {
-                SpiReadDataSynchronous(evnt_buff + CC3000_SPI_MIN_READ_B,
-                                       data_to_recv);
-            }
-
-            break;
-        }
+#if CC3000_SPI_HOLD_BUS == TRUE
+        chSysLock();
+        drv->spiBusHeldCount++;
+        chSysUnlock();
+#endif
+        return;
     }
-}
 
+    drv->spiBusAcquired = false;
+#if CHIBIOS_CC3000_SPI_CACHE_CONFIG == FALSE
+    spiStop(drv->spiDriver);
+#endif
+    spiReleaseBus(drv->spiDriver);
+#endif
+}
 
-/** @brief Triggers the handler for an interrupt.
- *  @details Responsible for waking the interrupt handler thread,
- *           #irqSignalHandlerThread().
- *  @param extp ChibiOS/RT passes back this driver information. Ignored.
- *  @param channel ChibiOS/RT passes back this channel information. Ignored. */
-static void cc3000ExtCb(EXTDriver *extp, expchannel_t channel)
+#if CC3000_SPI_HOLD_BUS == TRUE
+/** @brief Acquires the shared SPI bus for #irqSignalHandlerThread() to hold
+ *         across several transactions.
+ *  @details Does nothing if already held.
+ *  @param drv Driver instance. */
+static void holdSpiBus(cc3000Driver *drv)
 {
-    (void)extp;
-    (void)channel;
-
-    chSysLockFromIsr();
-    chSemSignalI(&irqSem);
-    chSysUnlockFromIsr();
+    if (drv->spiBusHeld == false)
+    {
+        spiAcquireBus(drv->spiDriver);
+        chSysLock();
+        drv->spiBusHeldCount = 0;
+        drv->spiBusHeld = true;
+        chSysUnlock();
+    }
 }
 
 
-/** @brief Handlers an interrupt request from the CC3000.
- *  @param arg Unused.
- *  @return Always 0.*/
-static msg_t irqSignalHandlerThread(void *arg)
+/** @brief Releases the shared SPI bus held by #holdSpiBus().
+ *  @details Only done between transactions.
+ *  @param drv Driver instance.
+ *  @param force Release regardless of the current transaction. Only for
+ *               use when #irqSignalHandlerThread() is exiting.
+ *  @return True if the bus is no longer held. */
+static bool releaseHeldSpiBus(cc3000Driver *drv, bool force)
 {
-    (void)arg;
+    bool release;
+    bool held;
 
-#if CH_USE_REGISTRY == TRUE
-    chRegSetThreadName(__FUNCTION__);
-#endif
+    /* Checked and cleared together, so a transaction starting on the held
+     * bus either sees it released or keeps it held. */
+    chSysLock();
+    release = drv->spiBusHeld == true &&
+              (force == true || drv->spiInformation.spiState == SPI_STATE_IDLE);
+    if (release == true)
+    {
+        drv->spiBusHeld = false;
+    }
+    held = drv->spiBusHeld;
+    chSysUnlock();
 
-    while (1)
+    if (release == true)
     {
-        /* Wait here until the EXT interrupt signals that the IRQ line went
-         * low. */
-        CHIBIOS_CC3000_DBG_PRINT("IRQ waiting on semaphore.", NULL);
- 
-        chSemWait(&irqSem);
+#if CHIBIOS_CC3000_SPI_CACHE_CONFIG == FALSE
+        spiStop(drv->spiDriver);
+#endif
+        spiReleaseBus(drv->spiDriver);
+    }
 
-        CHIBIOS_CC3000_DBG_PRINT("IRQ waiting on pause.", NULL);
+    return held == false;
+}
+#endif
 
-        while (spiPaused == true)
-        {
-            chThdSleep(5);
-        }
 
-        if (chThdShouldTerminate())
+/** @brief Waits for #cc3000ExtCb() to signal an interrupt.
+ *  @details If the shared SPI bus is held, it is kept for up to
+ *           #CHIBIOS_CC3000_SPI_HOLD_MS waiting for the next interrupt, and
+ *           for at most #CHIBIOS_CC3000_SPI_HOLD_MAX transactions.
+ *  @param drv Driver instance. */
+static void waitForIrq(cc3000Driver *drv)
+{
+#if CC3000_SPI_HOLD_BUS == TRUE
+    while (drv->spiBusHeld == true)
+    {
+        if (drv->spiBusHeldCount >= CHIBIOS_CC3000_SPI_HOLD_MAX &&
+            releaseHeldSpiBus(drv, false) == true)
         {
             break;
         }
 
-        CHIBIOS_CC3000_DBG_PRINT("IRQ Running.", NULL);
-
-        while (spiInformation.spiState != SPI_STATE_POWERUP &&
-               spiInformation.spiState != SPI_STATE_IDLE &&
-               spiInformation.spiState != SPI_STATE_WRITE_REQUESTED)
+        if (chSemWaitTimeout(&drv->irqSem,
+                             MS2ST(CHIBIOS_CC3000_SPI_HOLD_MS)) != RDY_TIMEOUT)
         {
-            chThdSleep(5); /* XXX can this happen?? - yes.
-                              Witnessed the while loop being hit once while the
-                              state was initialised */
+            return;
         }
 
-        if (spiInformation.spiState == SPI_STATE_POWERUP)
-        {
-            /* This means IRQ line was low call a callback of HCI Layer to inform on event */
-            setSpiState(SPI_STATE_INITIALIZED);
-        }
+        /* Fails if a write is using the bus, in which case keep waiting. */
+        releaseHeldSpiBus(drv, false);
+    }
+#endif
 
-        else if (spiInformation.spiState == SPI_STATE_IDLE)
-        {
-            setSpiState(SPI_STATE_READ);
+    chSemWait(&drv->irqSem);
+}
 
-            /* IRQ line goes down - start reception */
-            selectCC3000();
+/** @brief Records a state change not permitted by #spiStateTransitions.
+ *  @param drv Driver instance.
+ *  @param from The state being left.
+ *  @param to The state entered. */
+static void spiStateIllegalI(cc3000Driver *drv, spiState from, spiState to)
+{
+    drv->spiStatistics.illegalTransitions++;
+    drv->spiStatistics.lastIllegalFrom = from;
+    drv->spiStatistics.lastIllegalTo = to;
+}
 
-            SpiReadHeader();
+/** @brief Sleeps until the SPI driver state changes, from within a lock
+ *         zone.
+ *  @details cc3000Driver::spiStateWaiters is kept in the same lock zone the
+ *           caller tested the state in, so #setSpiState() can read it
+ *           without one.
+ *  @param drv Driver instance.
+ *  @param timeout Maximum time to wait, or TIME_INFINITE. */
+static void waitSpiStateChangeS(cc3000Driver *drv, systime_t timeout)
+{
+    drv->spiStateWaiters++;
+    chSemWaitTimeoutS(&drv->spiStateSem, timeout);
+    drv->spiStateWaiters--;
+}
 
-            SpiReadAfterHeader();
+/** @brief Wakes every thread waiting on a change of the SPI driver state,
+ *         from within a lock zone.
+ *  @details A reschedule is left to the caller.
+ *  @param drv Driver instance. */
+static void wakeSpiStateWaitersI(cc3000Driver *drv)
+{
+    if (drv->spiStateWaiters > 0)
+    {
+        chSemResetI(&drv->spiStateSem, 0);
+    }
+}
 
-#if 1
-            /** @todo TI Issue It seems there is a potential for a race 
-             * condition here. We can enter processing before we can set what
-             * we are expecting to receive in the host driver 
-             * http://e2e.ti.com/support/low_power_rf/f/851/t/312391.aspx */
-            chThdSleep(MS2ST(100));
-#endif
+/** @brief Sets the state of the SPI driver from within a lock zone.
+ *  @details A change not permitted by #spiStateTransitions is recorded and
+ *           not made. Any thread waiting on a state change is readied, but a
+ *           reschedule is left to the caller.
+ *  @param drv Driver instance.
+ *  @param state The new state.
+ *  @return True if the change was permitted. */
+static bool setSpiStateI(cc3000Driver *drv, spiState state)
+{
+    spiState from = drv->spiInformation.spiState;
 
-            SpiTriggerRxProcessing();
+    do
+    {
+        if (!spiStateTransitionValid(from, state))
+        {
+            spiStateIllegalI(drv, from, state);
+            return false;
         }
+    } while (!spiStateCompareSwapS(&drv->spiInformation.spiState, &from,
+                                   state));
 
-        else if (spiInformation.spiState == SPI_STATE_WRITE_REQUESTED)
-        {
-            setSpiState(SPI_STATE_WRITE_PERMITTED);
+    CC3000_TRACE_I(drv, CC3000_TRACE_STATE, from, state);
 
-        }
-    }
+    /* Wake anyone waiting on a state change. */
+    wakeSpiStateWaitersI(drv);
 
-    return 0;
+    return true;
 }
 
-
-/** @brief Prepares for communications with CC3000.
- *  @details Responsible for readying SPI and interrupt.
- *  @param pfRxHandler Function the host driver wishes to be called when SPI
- *                     data is received. */
-void SpiOpen(gcSpiHandleRx pfRxHandler)
+/** @brief Returns a receive slot from within a lock zone.
+ *  @details Also wakes the state waiters, as #irqSignalHandlerThread() waits
+ *           for a free slot there so it still sees write requests while
+ *           none is free. A reschedule is left to the caller.
+ *  @param drv Driver instance. */
+static void rxSlotFreeI(cc3000Driver *drv)
 {
-    memset(spi_buffer, 0, CC3000_RX_BUFFER_SIZE);
-    memset(wlan_tx_buffer, 0, CC3000_TX_BUFFER_SIZE);
-    memset((void*)&cc3000AsyncData, 0, sizeof(cc3000AsyncData));
-
-    spi_buffer[CC3000_SPI_RX_MAGIC_INDEX] = CC3000_SPI_MAGIC_NUMBER;
-    wlan_tx_buffer[CC3000_SPI_TX_MAGIC_INDEX] = CC3000_SPI_MAGIC_NUMBER;
+    chSemSignalI(&drv->rxFreeSem);
+    wakeSpiStateWaitersI(drv);
+}
 
-    setSpiState(SPI_STATE_POWERUP);
-    spiInformation.rxHandlerCb = pfRxHandler;
-    spiInformation.txPacketLength = 0;
-    spiInformation.pTxPacket = NULL;
-    spiInformation.pRxPacket = (unsigned char *)spi_buffer;
-    spiInformation.rxPacketLength = 0;
+/** @brief Completes a state change made without a lock zone.
+ *  @details Waiters test the state and count themselves in
+ *           cc3000Driver::spiStateWaiters within a single lock zone, so a
+ *           waiter missed by the unlocked read of the count has not yet
+ *           tested the state and will see the new one. A lock zone is only
+ *           entered if there is a waiter to wake.
+ *  @param drv Driver instance.
+ *  @param from The state left.
+ *  @param to The state entered. */
+static void spiStateChanged(cc3000Driver *drv, spiState from, spiState to)
+{
+    CC3000_TRACE(drv, CC3000_TRACE_STATE, from, to);
 
-#if CHIBIOS_CC3000_EXT_EXCLUSIVE == TRUE
-    extStart(chExtDriver, chExtConfig);
-#endif
+    if (drv->spiStateWaiters > 0)
+    {
+        chSysLock();
+        wakeSpiStateWaitersI(drv);
+        chSchRescheduleS();
+        chSysUnlock();
+    }
+}
 
-    extChannelEnable(chExtDriver, CHIBIOS_CC3000_IRQ_PAD);
+/** @brief Moves the SPI driver from state @p from to @p to, if it is in
+ *         @p from.
+ *  @details Made without a lock zone, see #spiStateChanged().
+ *  @param drv Driver instance.
+ *  @param from The state the driver must be in.
+ *  @param to The new state.
+ *  @return True if the state was changed. */
+static bool trySpiState(cc3000Driver *drv, spiState from, spiState to)
+{
+    chDbgAssert(spiStateTransitionValid(from, to),
+                "trySpiState(), #1", "illegal transition");
 
-#if CHIBIOS_CC3000_SPI_EXCLUSIVE == TRUE
-    spiStart(chSpiDriver, &chSpiConfig);
-#endif
+    if (!spiStateCompareSwap(&drv->spiInformation.spiState, &from, to))
+    {
+        return false;
+    }
 
-    tSLInformation.WlanInterruptEnable();
-    
-    chThdSleep(MS2ST(100));
+    spiStateChanged(drv, from, to);
 
+    return true;
 }
 
-
-/** @brief Cleans up when communications to CC3000 stopped.
- *  @details Responsible for stopping SPI and interrupt. */
-void SpiClose(void)
+/** @brief Sets the state of the SPI driver.
+ *  @details The current state is checked against #spiStateTransitions and
+ *           only replaced if it is unchanged since, without a lock zone. A
+ *           change not permitted is recorded and not made.
+ *  @param drv Driver instance.
+ *  @param state The new state.
+ *  @return True if the change was permitted. */
+static bool setSpiState(cc3000Driver *drv, spiState state)
 {
-    tSLInformation.WlanInterruptDisable();
-
-    extChannelDisable(chExtDriver, CHIBIOS_CC3000_IRQ_PAD);
+    spiState from = drv->spiInformation.spiState;
 
-#if CHIBIOS_CC3000_EXT_EXCLUSIVE == TRUE
-    extStop(chExtDriver);
-#endif
+    do
+    {
+        if (!spiStateTransitionValid(from, state))
+        {
+            chSysLock();
+            spiStateIllegalI(drv, from, state);
+            chSysUnlock();
+            return false;
+        }
+    } while (!spiStateCompareSwap(&drv->spiInformation.spiState, &from,
+                                  state));
+
+    spiStateChanged(drv, from, state);
+
+    return true;
+}
+
+/** @brief Blocks the calling thread until the SPI driver is in @p state.
+ *  @details The thread sleeps on cc3000Driver::spiStateSem and is woken by
+ *           #setSpiState() rather than spinning on the state. Only used by
+ *           writes, so any time blocked is added to
+ *           cc3000SpiStatistics::txWaitTime.
+ *  @param drv Driver instance.
+ *  @param state The state to wait for. */
+static void waitForSpiState(cc3000Driver *drv, spiState state)
+{
+    uint32_t start;
+
+    chSysLock();
+    if (drv->spiInformation.spiState != state)
+    {
+        start = CC3000_TIMESTAMP();
+        while (drv->spiInformation.spiState != state)
+        {
+            waitSpiStateChangeS(drv, TIME_INFINITE);
+        }
+        drv->spiStatistics.txWaitTime += CC3000_TIMESTAMP() - start;
+    }
+    chSysUnlock();
+}
+
+#if CHIBIOS_CC3000_FAST_BOOT == TRUE
+/** @brief Blocks the calling thread until the SPI driver is in @p state or
+ *         @p timeout has passed.
+ *  @param drv Driver instance.
+ *  @param state The state to wait for.
+ *  @param timeout Maximum time to wait.
+ *  @return True if @p state was reached. */
+static bool waitForSpiStateTimeout(cc3000Driver *drv, spiState state,
+                                   systime_t timeout)
+{
+    systime_t start = chTimeNow();
+    systime_t elapsed;
+    bool reached;
+
+    chSysLock();
+    while (drv->spiInformation.spiState != state)
+    {
+        elapsed = chTimeNow() - start;
+        if (elapsed >= timeout)
+        {
+            break;
+        }
+        waitSpiStateChangeS(drv, timeout - elapsed);
+    }
+    reached = drv->spiInformation.spiState == state;
+    chSysUnlock();
+
+    return reached;
+}
+
+/** @brief Sleeps until the CC3000 has been powered off for at least
+ *         #CHIBIOS_CC3000_POWER_OFF_HOLD_MS.
+ *  @param drv Driver instance. */
+static void waitPowerOffHold(cc3000Driver *drv)
+{
+    systime_t hold = MS2ST(CHIBIOS_CC3000_POWER_OFF_HOLD_MS);
+    systime_t elapsed = chTimeElapsedSince(drv->powerOffTime);
+
+    if (elapsed < hold)
+    {
+        chThdSleep(hold - elapsed);
+    }
+}
+#endif
+
+/** @brief Waits until the SPI driver is in state @p from then moves it to
+ *         @p to, without another thread changing state in between.
+ *  @details The usual case, the driver already in @p from, needs no lock
+ *           zone. As #waitForSpiState(), time blocked is added to
+ *           cc3000SpiStatistics::txWaitTime.
+ *  @param drv Driver instance.
+ *  @param from The state to wait for.
+ *  @param to The new state. */
+static void claimSpiState(cc3000Driver *drv, spiState from, spiState to)
+{
+    uint32_t start;
+    spiState expected = from;
+
+    if (trySpiState(drv, from, to))
+    {
+        return;
+    }
+
+    chSysLock();
+    start = CC3000_TIMESTAMP();
+    while (!spiStateCompareSwapS(&drv->spiInformation.spiState, &expected,
+                                 to))
+    {
+        waitSpiStateChangeS(drv, TIME_INFINITE);
+        expected = from;
+    }
+    drv->spiStatistics.txWaitTime += CC3000_TIMESTAMP() - start;
+    CC3000_TRACE_I(drv, CC3000_TRACE_STATE, from, to);
+    wakeSpiStateWaitersI(drv);
+    chSchRescheduleS();
+    chSysUnlock();
+}
+
+#if CHIBIOS_CC3000_SPI_ASYNC == TRUE
+/** @brief Starts the next chunk of cc3000Driver::spiAsyncTransfer.
+ *  @details Chunks are at most #CHIBIOS_CC3000_SPI_ASYNC_MAX_XFER bytes.
+ *           Must be called from a lock zone or the SPI end callback.
+ *  @param drv Driver instance. */
+static void spiAsyncStartNextI(cc3000Driver *drv)
+{
+    size_t size = drv->spiAsyncTransfer.remaining;
+
+    if (size > CHIBIOS_CC3000_SPI_ASYNC_MAX_XFER)
+    {
+        size = CHIBIOS_CC3000_SPI_ASYNC_MAX_XFER;
+    }
+
+    drv->spiAsyncTransfer.remaining -= size;
+
+    if (drv->spiAsyncTransfer.pTx != NULL)
+    {
+        spiStartSendI(drv->spiDriver, size, drv->spiAsyncTransfer.pTx);
+        drv->spiAsyncTransfer.pTx += size;
+    }
+    else
+    {
+        spiStartReceiveI(drv->spiDriver, size, drv->spiAsyncTransfer.pRx);
+        drv->spiAsyncTransfer.pRx += size;
+    }
+}
+
+
+/** @brief SPI end callback, called from the SPI ISR when a transfer has
+ *         finished.
+ *  @details Starts the next chunk of cc3000Driver::spiAsyncTransfer, or wakes
+ *           the waiting thread when there is nothing left to transfer.
+ *  @param spip ChibiOS/RT passes back the SPI driver. Used to find the
+ *              instance. */
+static void cc3000SpiEndCb(SPIDriver *spip)
+{
+    cc3000Driver *drv = findDriverBySpi(spip);
+
+    if (drv == NULL)
+    {
+        return;
+    }
+
+    chSysLockFromIsr();
+    if (drv->spiAsyncTransfer.remaining)
+    {
+        spiAsyncStartNextI(drv);
+    }
+    else
+    {
+        chBSemSignalI(&drv->spiAsyncDoneSem);
+    }
+    chSysUnlockFromIsr();
+}
+#endif
+
+
+/** @brief Writes data over SPI to the CC3000.
+ *  @details Returns once all data has been sent. With
+ *           #CHIBIOS_CC3000_SPI_ASYNC TRUE the calling thread sleeps while
+ *           the transfer is progressed from the SPI end callback.
+ *  @param drv Driver instance.
+ *  @param data Data to be sent.
+ *  @param size Number of bytes to be sent. */
+static void SpiWriteDataSynchronous(cc3000Driver *drv,
+                                    const unsigned char *data,
+                                    unsigned short size)
+{
+    CC3000_TRACE(drv, CC3000_TRACE_SPI_WRITE_START, 0, size);
+
+#if CHIBIOS_CC3000_SPI_ASYNC == TRUE
+    chSysLock();
+    drv->spiAsyncTransfer.pTx = data;
+    drv->spiAsyncTransfer.pRx = NULL;
+    drv->spiAsyncTransfer.remaining = size;
+    spiAsyncStartNextI(drv);
+    chBSemWaitS(&drv->spiAsyncDoneSem);
+    chSysUnlock();
+#else
+    spiSend(drv->spiDriver, size, data);
+#endif
+
+    CC3000_TRACE(drv, CC3000_TRACE_SPI_WRITE_END, 0, size);
+}
+
+
+/** @brief Writes the segments of a packet which follow its header.
+ *  @param drv Driver instance.
+ *  @param segments Segments to be written, in order.
+ *  @param count Number of elements in @p segments.
+ *  @param pad If a padding byte should be written after the segments. */
+static void SpiWriteSegmentsSynchronous(cc3000Driver *drv,
+                                        const tSpiTxSegment *segments,
+                                        unsigned int count,
+                                        bool pad)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (segments[i].length)
+        {
+            SpiWriteDataSynchronous(drv, segments[i].pData, segments[i].length);
+        }
+    }
+
+    if (pad == true)
+    {
+        SpiWriteDataSynchronous(drv, &spiPaddingByte, 1);
+    }
+}
+
+
+/** @brief Preforms the first write to the CC3000.
+ *  @details The CC3000 requires a 50 us wait after the first four bytes of the
+ *          first command from a powerup. See #CHIBIOS_CC3000_DELAY_BACKEND.
+ *  @param drv Driver instance.
+ *  @param pHeader Header of the packet to write, at least 4 bytes.
+ *  @param headerLength Size of @p pHeader.
+ *  @param segments Further segments of the packet, see #SpiWriteGather().
+ *  @param count Number of elements in @p segments.
+ *  @param pad If a padding byte should be written after the segments. */
+static void SpiFirstWrite(cc3000Driver *drv,
+                          unsigned char *pHeader, unsigned short headerLength,
+                          const tSpiTxSegment *segments, unsigned int count,
+                          bool pad)
+{
+    selectCC3000(drv);
+
+    cc3000DelayUs(50);
+
+    SpiWriteDataSynchronous(drv, pHeader, 4);
+
+    cc3000DelayUs(50);
+
+    SpiWriteDataSynchronous(drv, pHeader + 4, headerLength - 4);
+
+    SpiWriteSegmentsSynchronous(drv, segments, count, pad);
+
+    drv->bootTimeline.firstWrite = CC3000_TIMESTAMP();
+
+    unselectCC3000(drv);
+
+    setSpiState(drv, SPI_STATE_IDLE);
+}
+
+
+/** @brief Reads SPI data from the CC3000 over SPI.
+ *  @details Returns once all data has been received. With
+ *           #CHIBIOS_CC3000_SPI_ASYNC TRUE the calling thread sleeps while
+ *           the transfer is progressed from the SPI end callback.
+ *  @param drv Driver instance.
+ *  @param data Pointer to the buffer to store the data.
+ *  @param size Number of bytes to read. */
+static void SpiReadDataSynchronous(cc3000Driver *drv,
+                                   unsigned char *data, unsigned short size)
+{
+    /* The read command is clocked out while the first bytes are received. */
+    unsigned short commandSize = sizeof(spiReadCommand);
+
+    if (size < commandSize)
+    {
+        commandSize = size;
+    }
+
+    CC3000_TRACE(drv, CC3000_TRACE_SPI_READ_START, 0, size);
+
+#if CHIBIOS_CC3000_SPI_ASYNC == TRUE
+    chSysLock();
+    drv->spiAsyncTransfer.pTx = NULL;
+    drv->spiAsyncTransfer.pRx = &data[commandSize];
+    drv->spiAsyncTransfer.remaining = size - commandSize;
+    spiStartExchangeI(drv->spiDriver,
+                      commandSize,
+                      spiReadCommand,
+                      data);
+    chBSemWaitS(&drv->spiAsyncDoneSem);
+    chSysUnlock();
+#else
+    spiExchange(drv->spiDriver,
+                commandSize,
+                spiReadCommand,
+                data);
+    if (size > commandSize)
+    {
+        spiReceive(drv->spiDriver,
+                   size - commandSize,
+                   &data[commandSize]);
+    }
+#endif
+
+    CC3000_TRACE(drv, CC3000_TRACE_SPI_READ_END, 0, size);
+
+    drv->spiInformation.rxPacketLength += size;
+}
+
+
+/** @brief Checks if the host driver is ready to be given a received packet.
+ *  @details The host driver treats any event it is not waiting on as
+ *           unsolicited, and discards it. A response to a command can be
+ *           received before the thread which sent the command has set
+ *           tSLInformation.usRxEventOpcode, in which case the response would be
+ *           lost. See http://e2e.ti.com/support/low_power_rf/f/851/t/312391.aspx
+ *
+ *           Data packets and unsolicited events are held by the host driver
+ *           until they are consumed, so are always ready.
+ *  @param packet The received packet, starting with the SPI header.
+ *  @return True if the packet can be passed to the host driver. */
+static bool hostDriverReady(unsigned char *packet)
+{
+    unsigned char *hci_buff = packet + SPI_HEADER_SIZE;
+    unsigned char type;
+    unsigned short opcode;
+
+    STREAM_TO_UINT8((char *)hci_buff, HCI_PACKET_TYPE_OFFSET, type);
+
+    if (type != HCI_TYPE_EVNT)
+    {
+        return true;
+    }
+
+    STREAM_TO_UINT16((char *)hci_buff, HCI_EVENT_OPCODE_OFFSET, opcode);
+
+    if ((opcode & HCI_EVNT_UNSOL_BASE) ||
+        (opcode & HCI_EVNT_WLAN_UNSOL_BASE) ||
+        opcode == HCI_EVENT_CC3000_CAN_SHUT_DOWN ||
+        opcode == HCI_EVNT_PATCHES_REQ ||
+        opcode == HCI_EVNT_SEND ||
+        opcode == HCI_EVNT_SENDTO ||
+        opcode == HCI_EVNT_WRITE)
+    {
+        return true;
+    }
+
+    return tSLInformation.usRxEventOpcode == opcode;
+}
+
+
+/** @brief Waits until the host driver is ready for the received packet.
+ *  @details Replaces a fixed sleep after every read. Typically the host driver
+ *           is already waiting and this returns immediately. Otherwise its
+ *           state is polled every tick, as the host driver gives no signal
+ *           when it starts waiting. If it does not become ready within
+ *           #CHIBIOS_CC3000_RX_HANDSHAKE_TIMEOUT_MS the packet is passed on
+ *           regardless, and the host driver will most likely discard it.
+ *           Such timeouts are counted in
+ *           cc3000SpiStatistics::rxHandshakeTimeouts.
+ *  @param drv Driver instance.
+ *  @param packet The received packet, starting with the SPI header. */
+static void waitForHostDriver(cc3000Driver *drv, unsigned char *packet)
+{
+    systime_t start = chTimeNow();
+
+    while (hostDriverReady(packet) == false)
+    {
+        if (chTimeElapsedSince(start) >=
+            MS2ST(CHIBIOS_CC3000_RX_HANDSHAKE_TIMEOUT_MS))
+        {
+            CHIBIOS_CC3000_DBG_PRINT("Host driver handshake timed out.", NULL);
+            drv->spiStatistics.rxHandshakeTimeouts++;
+            break;
+        }
+        chThdSleep(1);
+    }
+}
+
+
+/** @brief Ends a read and queues the received packet for the host driver.
+ *  @details Called by #irqSignalHandlerThread() once a whole packet is in
+ *           the current cc3000Driver::rxBuffer slot.
+ *  @param drv Driver instance. */
+static void SpiCompleteRead(cc3000Driver *drv)
+{
+    /** @todo TI Issue: This is where it is in their example.
+     * Can we not just hold this low, until we are done? i.e. move it until 
+     * just before we return from this function? This should mean the CC3000
+     * won't produce another interrupt until we are done processing this one. */
+    unselectCC3000(drv); 
+
+    if (drv->spiInformation.pRxPacket[CC3000_SPI_RX_MAGIC_INDEX] !=
+        CC3000_SPI_MAGIC_NUMBER)
+    {
+        CHIBIOS_CC3000_DBG_PRINT("Buffer overflow detected.", NULL);
+        CHIBIOS_CC3000_DBG_FLUSH();
+        while(1);
+    }
+
+    setSpiState(drv, SPI_STATE_IDLE);
+    drv->spiStatistics.rxBytes += drv->spiInformation.rxPacketLength;
+    drv->spiStatistics.rxPackets++;
+    if (drv->spiInformation.rxPacketLength > drv->spiStatistics.rxMaxPacket)
+    {
+        drv->spiStatistics.rxMaxPacket = drv->spiInformation.rxPacketLength;
+    }
+    drv->spiInformation.rxPacketLength = 0;
+
+    chMBPost(&drv->rxReadyMb, (msg_t)drv->rxSlotWrite, TIME_INFINITE);
+    drv->rxSlotWrite = (drv->rxSlotWrite + 1) % CHIBIOS_CC3000_RX_SLOTS;
+}
+
+
+/** @brief Ends a read whose packet was rejected.
+ *  @details The packet is dropped, its slot returned and the SPI clock
+ *           lowered. The rest of the packet, as declared by the SPI header,
+ *           is clocked out into the slot first so the CC3000 does not hold
+ *           it back. A response lost this way leaves the host driver
+ *           waiting in SimpleLinkWaitEvent() otherwise.
+ *  @param drv Driver instance.
+ *  @param reason Why the packet was rejected. */
+static void SpiDiscardRead(cc3000Driver *drv, cc3000SpiFallback reason)
+{
+    unsigned char *packet = drv->spiInformation.pRxPacket;
+    long remaining;
+
+    /* Bounded by the slot, as the header itself may be what is corrupt. */
+    remaining = SPI_HEADER_SIZE +
+                ((packet[CC3000_SPI_RX_INDEX_LEN_MSB] << 8) |
+                 packet[CC3000_SPI_RX_INDEX_LEN_LSB]);
+    if (remaining > CC3000_SPI_RX_MAGIC_INDEX)
+    {
+        remaining = CC3000_SPI_RX_MAGIC_INDEX;
+    }
+    remaining -= CHIBIOS_CC3000_SPI_FIRST_READ_B;
+
+    if (remaining > 0)
+    {
+        SpiReadDataSynchronous(drv, packet + CHIBIOS_CC3000_SPI_FIRST_READ_B,
+                               remaining);
+    }
+
+    unselectCC3000(drv);
+
+    CHIBIOS_CC3000_DBG_PRINT("Received packet rejected: %d", reason);
+
+    /* The slot is returned without waking the state waiters, as the move
+     * to SPI_STATE_IDLE wakes them. */
+    chSysLock();
+    spiSpeedFallbackI(drv, reason);
+    chSemSignalI(&drv->rxFreeSem);
+    chSysUnlock();
+
+    drv->spiInformation.rxPacketLength = 0;
+
+    setSpiState(drv, SPI_STATE_IDLE);
+}
+
+
+/** @brief Responsible for calling into TI's host driver with received data.
+ *  @param drv Driver instance.
+ *  @param packet The received packet, starting with the SPI header. */
+static void SpiTriggerRxProcessing(cc3000Driver *drv, unsigned char *packet)
+{
+    waitForHostDriver(drv, packet);
+
+    CC3000_TRACE(drv, CC3000_TRACE_RX_DISPATCH_START, 0, 0);
+
+    /* In 1.11.1: SpiReceiveHandler cc3000_spi.c */
+    drv->spiInformation.rxHandlerCb(packet + SPI_HEADER_SIZE);
+
+    CC3000_TRACE(drv, CC3000_TRACE_RX_DISPATCH_END, 0, 0);
+}
+
+/** @brief Reads the SPI header from the CC3000.
+ *  @details Reads #CHIBIOS_CC3000_SPI_FIRST_READ_B bytes, which may be
+ *           enough to hold the whole packet.
+ *  @param drv Driver instance. */
+static void SpiReadHeader(cc3000Driver *drv)
+{
+    SpiReadDataSynchronous(drv, drv->spiInformation.pRxPacket,
+                           CHIBIOS_CC3000_SPI_FIRST_READ_B);
+}
+
+/** @brief Reads the part of a packet not retrieved by #SpiReadHeader().
+ *  @param drv Driver instance.
+ *  @param evnt_buff Start of the receive buffer.
+ *  @param remaining Number of bytes still to be read. May be zero or
+ *                   negative if the first read held the whole packet. */
+static void SpiReadRemaining(cc3000Driver *drv,
+                             unsigned char *evnt_buff, long remaining)
+{
+    if (remaining > 0)
+    {
+        SpiReadDataSynchronous(drv, evnt_buff + CHIBIOS_CC3000_SPI_FIRST_READ_B,
+                               remaining);
+        drv->spiStatistics.rxSecondRead++;
+    }
+    else
+    {
+        drv->spiStatistics.rxSingleRead++;
+    }
+}
+
+/** @brief Reads remaining data after the SPI header.
+ *  @details Called after data returned fomr #SpiReadHeader() has been
+ *  processed. A second read is only performed if the packet did not fit in
+ *  the first. The header is checked first, as a corrupt header would
+ *  otherwise be trusted for the length of the second read.
+ *  @param drv Driver instance.
+ *  @return #CC3000_SPI_FALLBACK_NONE if the packet was read, otherwise why
+ *          the header was rejected. */
+static cc3000SpiFallback SpiReadAfterHeader(cc3000Driver *drv)
+{
+    long data_to_recv = 0;
+    unsigned char *evnt_buff, type;
+    /* Bytes after the header which have already been read. */
+    const long data_read = CHIBIOS_CC3000_SPI_FIRST_READ_B -
+                           CC3000_SPI_MIN_READ_B;
+
+    /* Determine what type of packet we have */
+    evnt_buff =  drv->spiInformation.pRxPacket;
+    STREAM_TO_UINT8((char *)(evnt_buff + SPI_HEADER_SIZE),
+                    HCI_PACKET_TYPE_OFFSET, type);
+
+    switch(type)
+    {
+        case HCI_TYPE_DATA:
+        {
+            /* We need to read the rest of data.. */
+            STREAM_TO_UINT16((char *)(evnt_buff + SPI_HEADER_SIZE),
+                             HCI_DATA_LENGTH_OFFSET, data_to_recv);
+
+            if (!((CC3000_HEADERS_SIZE_EVNT + data_to_recv) & 1))
+            {
+                data_to_recv++;
+            }
+
+            break;
+        }
+        case HCI_TYPE_EVNT:
+        {
+            /* Calculate the rest length of the data*/
+            STREAM_TO_UINT8((char *)(evnt_buff + SPI_HEADER_SIZE),
+                            HCI_EVENT_LENGTH_OFFSET, data_to_recv);
+            data_to_recv -= 1;
+
+            /* Add padding byte if needed */
+            if ((CC3000_HEADERS_SIZE_EVNT + data_to_recv) & 1)
+            {
+                data_to_recv++;
+            }
+
+            break;
+        }
+        default:
+        {
+            return CC3000_SPI_FALLBACK_BAD_TYPE;
+        }
+    }
+
+    if (CHIBIOS_CC3000_SPI_FIRST_READ_B + data_to_recv - data_read >
+        CC3000_SPI_RX_MAGIC_INDEX)
+    {
+        return CC3000_SPI_FALLBACK_BAD_LENGTH;
+    }
+
+    if (type == HCI_TYPE_DATA)
+    {
+        drv->spiStatistics.rxDataPackets++;
+    }
+    else
+    {
+        drv->spiStatistics.rxEventPackets++;
+    }
+
+    SpiReadRemaining(drv, evnt_buff, data_to_recv - data_read);
+
+    return CC3000_SPI_FALLBACK_NONE;
+}
+
+
+/** @brief Triggers the handler for an interrupt.
+ *  @details Responsible for waking the interrupt handler thread,
+ *           #irqSignalHandlerThread().
+ *  @param extp ChibiOS/RT passes back this driver information. Used to find
+ *              the instance.
+ *  @param channel ChibiOS/RT passes back this channel information. Used to
+ *                 find the instance. */
+static void cc3000ExtCb(EXTDriver *extp, expchannel_t channel)
+{
+    cc3000Driver *drv = findDriverByExt(extp, channel);
+
+    if (drv == NULL)
+    {
+        return;
+    }
+
+    chSysLockFromIsr();
+    CC3000_TRACE_I(drv, CC3000_TRACE_EXT_IRQ, 0, 0);
+    chSemSignalI(&drv->irqSem);
+    chSysUnlockFromIsr();
+}
+
+
+/** @brief Handlers an interrupt request from the CC3000.
+ *  @details Received packets are read into the next free
+ *           cc3000Driver::rxBuffer slot and queued for #rxDeliveryThread(),
+ *           so the next packet can be read while the host driver processes
+ *           the last.
+ *  @param arg The driver instance.
+ *  @return Always 0.*/
+static msg_t irqSignalHandlerThread(void *arg)
+{
+    cc3000Driver *drv = arg;
+    spiState state;
+    bool haveSlot;
+    cc3000SpiFallback rejected;
+
+#if CH_USE_REGISTRY == TRUE
+    chRegSetThreadName(__FUNCTION__);
+#endif
+
+    while (1)
+    {
+        /* Wait here until the EXT interrupt signals that the IRQ line went
+         * low. */
+        CHIBIOS_CC3000_DBG_PRINT("IRQ waiting on semaphore.", NULL);
+ 
+        waitForIrq(drv);
+
+        if (chThdShouldTerminate())
+        {
+            break;
+        }
+
+        CC3000_TRACE(drv, CC3000_TRACE_IRQ_WAKE, 0, 0);
+
+        CHIBIOS_CC3000_DBG_PRINT("IRQ Running.", NULL);
+
+        /* A read needs a free slot, which is taken before moving to
+         * SPI_STATE_READ so the state is never held while waiting on the host
+         * driver. Usually a slot is free and the driver idle, and the move
+         * needs no lock zone. Otherwise any other state change can happen
+         * while waiting, and the state is checked again after every wake. */
+        haveSlot = chSemWaitTimeout(&drv->rxFreeSem, TIME_IMMEDIATE) == RDY_OK;
+        state = SPI_STATE_IDLE;
+
+        if (haveSlot == false ||
+            trySpiState(drv, SPI_STATE_IDLE, SPI_STATE_READ) == false)
+        {
+            chSysLock();
+            while (1)
+            {
+                state = drv->spiInformation.spiState;
+
+                if (chThdShouldTerminate())
+                {
+                    break;
+                }
+
+                if (state == SPI_STATE_POWERUP ||
+                    state == SPI_STATE_WRITE_REQUESTED ||
+                    (state == SPI_STATE_IDLE && haveSlot == true))
+                {
+                    break;
+                }
+                else if (state == SPI_STATE_IDLE)
+                {
+                    /* Never block on the slot semaphore: a slot may only be
+                     * freed by a thread that first needs its write request
+                     * granted. Freed slots wake the state waiters instead. */
+                    if (chSemWaitTimeoutS(&drv->rxFreeSem, TIME_IMMEDIATE) ==
+                        RDY_OK)
+                    {
+                        haveSlot = true;
+                    }
+                    else
+                    {
+                        waitSpiStateChangeS(drv, TIME_INFINITE);
+                    }
+                }
+                else
+                {
+                    /* XXX can this happen?? - yes. Witnessed the state being
+                     * initialised once here. */
+                    waitSpiStateChangeS(drv, TIME_INFINITE);
+                }
+            }
+
+            if (chThdShouldTerminate())
+            {
+                chSysUnlock();
+                break;
+            }
+
+            if (haveSlot == true && state != SPI_STATE_IDLE)
+            {
+                chSemSignalI(&drv->rxFreeSem);
+            }
+
+            if (state == SPI_STATE_POWERUP)
+            {
+                /* This means IRQ line was low call a callback of HCI Layer to inform on event */
+                drv->bootTimeline.irqAsserted = CC3000_TIMESTAMP();
+                setSpiStateI(drv, SPI_STATE_INITIALIZED);
+            }
+            else if (state == SPI_STATE_IDLE)
+            {
+                setSpiStateI(drv, SPI_STATE_READ);
+            }
+            else
+            {
+                setSpiStateI(drv, SPI_STATE_WRITE_PERMITTED);
+            }
+            chSchRescheduleS();
+            chSysUnlock();
+        }
+
+        if (state == SPI_STATE_IDLE)
+        {
+            drv->spiInformation.pRxPacket = drv->rxBuffer[drv->rxSlotWrite];
+
+#if CC3000_SPI_HOLD_BUS == TRUE
+            holdSpiBus(drv);
+#endif
+
+            /* IRQ line goes down - start reception */
+            selectCC3000(drv);
+
+            SpiReadHeader(drv);
+
+            rejected = SpiReadAfterHeader(drv);
+
+            if (rejected == CC3000_SPI_FALLBACK_NONE)
+            {
+                SpiCompleteRead(drv);
+            }
+            else
+            {
+                SpiDiscardRead(drv, rejected);
+            }
+        }
+    }
+
+#if CC3000_SPI_HOLD_BUS == TRUE
+    releaseHeldSpiBus(drv, true);
+#endif
+
+    return 0;
+}
+
+
+/** @brief Passes received packets to the host driver.
+ *  @details Packets are taken from cc3000Driver::rxReadyMb in the order they
+ *           were read. A packet is only passed on once the host driver has
+ *           resumed SPI and finished with the previous packet, whose slot is
+ *           then freed by #SpiResumeSpi().
+ *  @param arg The driver instance.
+ *  @return Always 0.*/
+static msg_t rxDeliveryThread(void *arg)
+{
+    cc3000Driver *drv = arg;
+    msg_t slot;
+    uint32_t start;
+
+#if CH_USE_REGISTRY == TRUE
+    chRegSetThreadName(__FUNCTION__);
+#endif
+
+    while (1)
+    {
+        chMBFetch(&drv->rxReadyMb, &slot, TIME_INFINITE);
+
+        CHIBIOS_CC3000_DBG_PRINT("RX waiting on pause.", NULL);
+
+        chSysLock();
+        if ((drv->spiPaused == true || drv->rxSlotDelivered == true) &&
+            !chThdShouldTerminate())
+        {
+            start = CC3000_TIMESTAMP();
+            while ((drv->spiPaused == true || drv->rxSlotDelivered == true) &&
+                   !chThdShouldTerminate())
+            {
+                chBSemWaitS(&drv->hostReadySem);
+            }
+            drv->spiStatistics.rxPausedTime += CC3000_TIMESTAMP() - start;
+        }
+        /* The host driver will resume SPI once it has finished with this
+         * packet. */
+        drv->spiPaused = true;
+        drv->rxSlotDelivered = true;
+        chSysUnlock();
+
+        if (chThdShouldTerminate())
+        {
+            break;
+        }
+
+        SpiTriggerRxProcessing(drv, drv->rxBuffer[slot]);
+    }
+
+    return 0;
+}
+
+
+/** @brief Prepares for communications with CC3000.
+ *  @details Responsible for readying SPI and interrupt of
+ *           #cc3000ActiveDriver.
+ *  @param pfRxHandler Function the host driver wishes to be called when SPI
+ *                     data is received. */
+void SpiOpen(gcSpiHandleRx pfRxHandler)
+{
+    cc3000Driver *drv = cc3000ActiveDriver;
+    unsigned int slot;
+
+    memset(drv->rxBuffer, 0, sizeof(drv->rxBuffer));
+    memset(wlan_tx_buffer, 0, CC3000_TX_BUFFER_SIZE);
+#if CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS == TRUE
+    memset((void*)&drv->asyncData, 0, sizeof(drv->asyncData));
+#endif
+
+    for (slot = 0; slot < CHIBIOS_CC3000_RX_SLOTS; slot++)
+    {
+        drv->rxBuffer[slot][CC3000_SPI_RX_MAGIC_INDEX] =
+                                                    CC3000_SPI_MAGIC_NUMBER;
+    }
+    wlan_tx_buffer[CC3000_SPI_TX_MAGIC_INDEX] = CC3000_SPI_MAGIC_NUMBER;
+
+    /* Discard anything left from a previous session. */
+    chMBReset(&drv->rxReadyMb);
+    chSemReset(&drv->rxFreeSem, CHIBIOS_CC3000_RX_SLOTS);
+    drv->rxSlotWrite = 0;
+    drv->rxSlotDelivered = false;
+
+    setSpiState(drv, SPI_STATE_POWERUP);
+    drv->spiInformation.rxHandlerCb = pfRxHandler;
+    drv->spiInformation.txPacketLength = 0;
+    drv->spiInformation.pTxPacket = NULL;
+    drv->spiInformation.pRxPacket = drv->rxBuffer[0];
+    drv->spiInformation.rxPacketLength = 0;
+
+#if CHIBIOS_CC3000_EXT_EXCLUSIVE == TRUE
+    extStart(drv->extDriver, drv->extConfig);
+#endif
+
+    extChannelEnable(drv->extDriver, drv->config->irqPad);
 
 #if CHIBIOS_CC3000_SPI_EXCLUSIVE == TRUE
-    spiStop(chSpiDriver);
+    spiStart(drv->spiDriver, &drv->spiConfig);
 #endif
 
+    drv->bootTimeline.powerOn = 0;
+    drv->bootTimeline.irqAsserted = 0;
+    drv->bootTimeline.firstWrite = 0;
+    drv->bootTimeline.started = 0;
+
+    tSLInformation.WlanInterruptEnable();
+
+#if CHIBIOS_CC3000_FAST_BOOT == TRUE
+    /* wlan_start() powers on the CC3000 next. */
+    waitPowerOffHold(drv);
+#else
+    chThdSleep(MS2ST(100));
+#endif
 }
 
 
-/** @brief Writes data to the CC3000 over SPI.
- *  @param pUserBuffer Pointer to the data to be written.
- *  @param usLength Data size. */
-void SpiWrite(unsigned char *pUserBuffer, unsigned short usLength)
+/** @brief Cleans up when communications to CC3000 stopped.
+ *  @details Responsible for stopping SPI and interrupt of
+ *           #cc3000ActiveDriver. */
+void SpiClose(void)
 {
+    cc3000Driver *drv = cc3000ActiveDriver;
+
+    tSLInformation.WlanInterruptDisable();
+
+    extChannelDisable(drv->extDriver, drv->config->irqPad);
+
+#if CHIBIOS_CC3000_EXT_EXCLUSIVE == TRUE
+    extStop(drv->extDriver);
+#endif
+
+#if CHIBIOS_CC3000_SPI_EXCLUSIVE == TRUE
+    spiStop(drv->spiDriver);
+#endif
+
+}
+
+
+/** @brief Writes a packet, held in several buffers, to the CC3000 in one SPI
+ *         transaction.
+ *  @details Allows data to be written from where it lies instead of first
+ *           being copied into #wlan_tx_buffer. Written to
+ *           #cc3000ActiveDriver.
+ *  @param pHeader Start of the packet. The first #SPI_HEADER_SIZE bytes are
+ *                 overwritten with the SPI header.
+ *  @param headerLength Size of @p pHeader, including the SPI header.
+ *  @param segments Further parts of the packet, written in order after
+ *                  @p pHeader. May be NULL if @p count is 0.
+ *  @param count Number of elements in @p segments. */
+void SpiWriteGather(unsigned char *pHeader, unsigned short headerLength,
+                    const tSpiTxSegment *segments, unsigned int count)
+{
+    cc3000Driver *drv = cc3000ActiveDriver;
+    unsigned short usLength = headerLength - SPI_HEADER_SIZE;
+    unsigned int padBytes = 0;
+    bool pad = false;
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+    {
+        usLength += segments[i].length;
+    }
+
     /* If usLength is even, we need to add padding byte */
     if (!(usLength & 0x01))
     {
         usLength++;
+        padBytes = 1;
+
+        /* A lone buffer always has room to be extended by a byte. */
+        if (count == 0)
+        {
+            headerLength++;
+        }
+        else
+        {
+            pad = true;
+        }
     }
 
     /* @todo TI issue: Why can't altering pUserBuffer and usLength be done 
      *       in the host driver? */
 
     /* Fill in SPI header */
-    pUserBuffer[CC3000_SPI_INDEX_OP] = CC3000_SPI_OP_WRITE;
-    pUserBuffer[CC3000_SPI_INDEX_LEN_MSB] = ((usLength) & 0xFF00) >> 8;
-    pUserBuffer[CC3000_SPI_INDEX_LEN_LSB] = ((usLength) & 0x00FF);
-    pUserBuffer[CC3000_SPI_INDEX_BUSY_1] = CC3000_SPI_BUSY;
-    pUserBuffer[CC3000_SPI_INDEX_BUSY_2] = CC3000_SPI_BUSY;
+    pHeader[CC3000_SPI_INDEX_OP] = CC3000_SPI_OP_WRITE;
+    pHeader[CC3000_SPI_INDEX_LEN_MSB] = ((usLength) & 0xFF00) >> 8;
+    pHeader[CC3000_SPI_INDEX_LEN_LSB] = ((usLength) & 0x00FF);
+    pHeader[CC3000_SPI_INDEX_BUSY_1] = CC3000_SPI_BUSY;
+    pHeader[CC3000_SPI_INDEX_BUSY_2] = CC3000_SPI_BUSY;
 
     usLength += SPI_HEADER_SIZE;
 
+    /* Any thread calling the host driver can get here, unlike the receive
+     * counters which only the IRQ thread writes. */
+    chSysLock();
+    drv->spiStatistics.txPadBytes += padBytes;
+    drv->spiStatistics.txBytes += usLength;
+    drv->spiStatistics.txPackets++;
+    if (usLength > drv->spiStatistics.txMaxPacket)
+    {
+        drv->spiStatistics.txMaxPacket = usLength;
+    }
+    chSysUnlock();
+
+    CC3000_TRACE(drv, CC3000_TRACE_WRITE_REQUEST, 0, usLength);
+
     if (wlan_tx_buffer[CC3000_SPI_TX_MAGIC_INDEX] != CC3000_SPI_MAGIC_NUMBER)
     {
         CHIBIOS_CC3000_DBG_PRINT("Buffer overflow detected.", NULL);
+        CHIBIOS_CC3000_DBG_FLUSH();
         while(1);
     }
 
-    if (spiInformation.spiState == SPI_STATE_POWERUP)
+    if (drv->spiInformation.spiState == SPI_STATE_POWERUP)
     {
-        while (spiInformation.spiState != SPI_STATE_INITIALIZED);
+        waitForSpiState(drv, SPI_STATE_INITIALIZED);
     }
 
-    if (spiInformation.spiState == SPI_STATE_INITIALIZED)
+    if (drv->spiInformation.spiState == SPI_STATE_INITIALIZED)
     {
-        SpiFirstWrite(pUserBuffer, usLength);
+        SpiFirstWrite(drv, pHeader, headerLength, segments, count, pad);
     }
     else
     {
@@ -599,54 +1535,88 @@ void SpiWrite(unsigned char *pUserBuffer, unsigned short usLength)
          * once again to not IDLE due to IRQ */
         tSLInformation.WlanInterruptDisable();
 
-        while (spiInformation.spiState != SPI_STATE_IDLE);  /* TODO sleep */
-
-        setSpiState(SPI_STATE_WRITE_REQUESTED);
-        spiInformation.pTxPacket = pUserBuffer;
-        spiInformation.txPacketLength = usLength;
+        claimSpiState(drv, SPI_STATE_IDLE, SPI_STATE_WRITE_REQUESTED);
+        drv->spiInformation.pTxPacket = pHeader;
+        drv->spiInformation.txPacketLength = usLength;
 
         /* Assert the CS line and wait till SSI IRQ line is active and then
          * initialize write operation*/
-        selectCC3000();
+        selectCC3000(drv);
 
         /*Re-enable IRQ */
         tSLInformation.WlanInterruptEnable();
-        chThdYield();
 
-        while (spiInformation.spiState != SPI_STATE_WRITE_PERMITTED); /* TODO sleep */
+        waitForSpiState(drv, SPI_STATE_WRITE_PERMITTED);
+
+        SpiWriteDataSynchronous(drv, pHeader, headerLength);
 
-        SpiWriteDataSynchronous(spiInformation.pTxPacket,
-                                spiInformation.txPacketLength);
+        SpiWriteSegmentsSynchronous(drv, segments, count, pad);
 
-        setSpiState(SPI_STATE_IDLE);
+        unselectCC3000(drv);
 
-        unselectCC3000(); 
+        setSpiState(drv, SPI_STATE_IDLE);
     }
 
     /* Due to the fact that we are currently implementing a blocking situation
        here we will wait till end of transaction.*/
-    while (SPI_STATE_IDLE != spiInformation.spiState);
+    waitForSpiState(drv, SPI_STATE_IDLE);
+
+    CC3000_TRACE(drv, CC3000_TRACE_WRITE_DONE, 0, usLength);
+}
+
+
+/** @brief Writes data to the CC3000 over SPI.
+ *  @param pUserBuffer Pointer to the data to be written.
+ *  @param usLength Data size. */
+void SpiWrite(unsigned char *pUserBuffer, unsigned short usLength)
+{
+    SpiWriteGather(pUserBuffer, usLength + SPI_HEADER_SIZE, NULL, 0);
 }
 
 
 /** @brief Registered callback to wlan_init() to read from IRQ pin.*/
 static long cbReadWlanInterruptPin(void)
 {
-    return palReadPad(CHIBIOS_CC3000_IRQ_PORT, CHIBIOS_CC3000_IRQ_PAD);
+    const cc3000DriverConfig *config = cc3000ActiveDriver->config;
+
+    return palReadPad(config->irqPort, config->irqPad);
 }
 
 
 /** @brief Registered callback to wlan_init() to write to WLAN EN pin.
+ *  @details With #CHIBIOS_CC3000_FAST_BOOT, powering on blocks until the
+ *           CC3000 pulls IRQ low, so the host driver finds it low at once
+ *           rather than polling for it. This is skipped if IRQ was already
+ *           low, as the host driver then waits for it to rise first.
  *  @param val Value to set Wlan pin. */
 static void cbWriteWlanPin(unsigned char val)
 {
+    cc3000Driver *drv = cc3000ActiveDriver;
+    const cc3000DriverConfig *config = drv->config;
+
     if (val)
     {
-        palSetPad(CHIBIOS_CC3000_WLAN_EN_PORT, CHIBIOS_CC3000_WLAN_EN_PAD);
+#if CHIBIOS_CC3000_FAST_BOOT == TRUE
+        bool irqHigh = palReadPad(config->irqPort, config->irqPad) != 0;
+#endif
+
+        palSetPad(config->wlanEnPort, config->wlanEnPad);
+        drv->bootTimeline.powerOn = CC3000_TIMESTAMP();
+
+#if CHIBIOS_CC3000_FAST_BOOT == TRUE
+        if (irqHigh &&
+            !waitForSpiStateTimeout(drv, SPI_STATE_INITIALIZED,
+                                    MS2ST(CHIBIOS_CC3000_BOOT_TIMEOUT_MS)))
+        {
+            CHIBIOS_CC3000_DBG_PRINT("Timed out waiting on power up.", NULL);
+        }
+#endif
     }
     else
     {
-        palClearPad(CHIBIOS_CC3000_WLAN_EN_PORT, CHIBIOS_CC3000_WLAN_EN_PAD);
+        palClearPad(config->wlanEnPort, config->wlanEnPad);
+        drv->bootTimeline.powerOff = CC3000_TIMESTAMP();
+        drv->powerOffTime = chTimeNow();
     }
 }
 
@@ -659,14 +1629,16 @@ static void cbWriteWlanPin(unsigned char val)
  *        is a perfectly usable function pointer registered. */
 static void SpiPauseSpi(void)
 {
+    cc3000Driver *drv = cc3000ActiveDriver;
+
 #if 0
-    if (spiPaused != false)
+    if (drv->spiPaused != false)
     {
         port_halt();
     }
 #endif
     chSysLock();
-    spiPaused = true;
+    drv->spiPaused = true;
     chSysUnlock();
 }
 
@@ -676,41 +1648,86 @@ static void SpiPauseSpi(void)
  *           interrupts received between a call to #SpiPauseSpi() and this. */
 void SpiResumeSpi(void)
 {
+    cc3000Driver *drv = cc3000ActiveDriver;
+
 #if 0
-    if (spiPaused != true)
+    if (drv->spiPaused != true)
     {
         port_halt();
     }
 #endif
     chSysLock();
-    spiPaused = false;
+    drv->spiPaused = false;
+
+    /* The host driver has consumed the last packet, its slot can be reused. */
+    if (drv->rxSlotDelivered == true &&
+        tSLInformation.usEventOrDataReceived == 0)
+    {
+        drv->rxSlotDelivered = false;
+        rxSlotFreeI(drv);
+    }
+
+    /* Buffers are freed by HCI_EVNT_DATA_UNSOL_FREE_BUFF, handled by the
+     * host driver before it resumes. */
+    if (tSLInformation.usNumberOfFreeBuffers > drv->txCreditsLast)
+    {
+        chEvtBroadcastFlagsI(&drv->txCreditSource, CC3000_EVENT_TX_CREDIT);
+    }
+    drv->txCreditsLast = tSLInformation.usNumberOfFreeBuffers;
+
+    chBSemSignalI(&drv->hostReadySem);
+    chSchRescheduleS();
     chSysUnlock();
 }
 
 
-/** @brief  To be used instead of wlan_init().
- *  @details Responsible for storing drivers and their configurations, then 
- *  calling wlan_init(). Hardware should be correctly configured before calling
- *  this function:
- *      * GPIO #CHIBIOS_CC3000_IRQ_PAD - input.
+/** @brief Binds TI's host driver to an instance.
+ *  @param drv The instance. */
+static void bindHostDriver(cc3000Driver *drv)
+{
+    cc3000ActiveDriver = drv;
+
+    wlan_init(chibiosCc3000AsyncCb, drv->fwPatches, drv->driverPatches, 
+              drv->bootLoaderPatches, cbReadWlanInterruptPin, 
+              SpiResumeSpi, SpiPauseSpi, cbWriteWlanPin);
+}
+
+
+/** @brief  To be used instead of wlan_init() to use a CC3000 through a
+ *          specific driver instance.
+ *  @details Responsible for storing drivers and their configurations and
+ *  starting the instance's threads. The first instance initialised is bound
+ *  to TI's host driver with wlan_init(). Hardware should be correctly configured
+ *  before calling this function:
+ *      * GPIO cc3000DriverConfig::irqPad - input.
  *      * GPIO #CHIBIOS_CC3000_MISO_PAD - input.
- *      * GPIO #CHIBIOS_CC3000_NSS_PAD - output.
+ *      * GPIO cc3000DriverConfig::nssPad - output.
  *      * GPIO #CHIBIOS_CC3000_SCK_PAD - output.
  *      * GPIO #CHIBIOS_CC3000_MOSI_PAD - output.
- *      * GPIO #CHIBIOS_CC3000_WLAN_EN_PAD - output.
+ *      * GPIO cc3000DriverConfig::wlanEnPad - output.
  *      * SPI driver - initialised (@p initialisedSpiDriver).
  *      * SPI config - desired hardware configuration set (@p configuredSpi).
  *      * EXT driver - initialised (@p initialisedExtDriver).
  *      * EXT config - no specifc configuration required (@p configuredExt).
  *
- *  See @ref hardware_setup_stm32l152.c for an example of the hardware setup
- *  on a STM32 platform.
+ *  Each instance needs its own SPI driver, unless
+ *  #CHIBIOS_CC3000_SPI_EXCLUSIVE is FALSE, and its own interrupt pin number,
+ *  as that is also its EXT channel.
+ *
+ *  TI's host driver only supports one CC3000. Each instance has its own
+ *  threads, buffers and statistics, but the host driver API only reaches
+ *  #cc3000ActiveDriver. Instances can be switched between with
+ *  #cc3000ChibiosDriverActivate(), but not used concurrently. Initialising
+ *  another instance does not rebind the host driver.
  *
  *  @warning All pointers marked [in,out] are expected to remain in memory i.e.
  *           they should be global or similar.
- *  @warning Ensure configuration in cc3000_chibios_config.h is correct before
- *           calling this function.
+ *  @warning At most #CHIBIOS_CC3000_MAX_DRIVERS instances can be initialised
+ *           at once. An instance must be shut down with
+ *           #cc3000ChibiosDriverShutdown() before it is initialised again.
  *
+ *  @param[in,out] drv The instance to initialise.
+ *  @param[in] config Pins of this CC3000. Must remain in memory.
  *  @param[in,out] initialisedSpiDriver A pointer to an already initialised 
  *                 ChibiOS SPI Driver.
  *  @param[in] configuredSpi A ChibiOS SPIConfig structure that at a minimum has 
@@ -726,84 +1743,556 @@ void SpiResumeSpi(void)
  *  @param[in] printCallback User defined debug print function.  It is only used
  *             if #CHIBIOS_CC3000_DBG_PRINT_ENABLED is TRUE. In such a case it
  *             cannot be NULL.
+ *  @return False if @p drv is already running or no more instances can be
+ *          registered, in which case nothing is started.
  *  */
-void cc3000ChibiosWlanInit(SPIDriver * initialisedSpiDriver,
-                           SPIConfig * configuredSpi,
-                           EXTDriver * initialisedExtDriver,
-                           EXTConfig * configuredExt,
-                           tFWPatches sFWPatches,
-                           tDriverPatches sDriverPatches,
-                           tBootLoaderPatches sBootLoaderPatches,
-                           cc3000PrintCb printCallback)
+bool cc3000ChibiosDriverInit(cc3000Driver * drv,
+                             const cc3000DriverConfig * config,
+                             SPIDriver * initialisedSpiDriver,
+                             SPIConfig * configuredSpi,
+                             EXTDriver * initialisedExtDriver,
+                             EXTConfig * configuredExt,
+                             tFWPatches sFWPatches,
+                             tDriverPatches sDriverPatches,
+                             tBootLoaderPatches sBootLoaderPatches,
+                             cc3000PrintCb printCallback)
 {
+    unsigned int i;
+
+    /* Clearing a running instance would wipe its threads' working areas. */
+    if (drv->pSignalHandlerThd != NULL)
+    {
+        return false;
+    }
+
+    memset(drv, 0, sizeof(*drv));
+
+    drv->config = config;
+    drv->fwPatches = sFWPatches;
+    drv->driverPatches = sDriverPatches;
+    drv->bootLoaderPatches = sBootLoaderPatches;
+    drv->spiPaused = true;
+
     /* Hold the SPI Driver to be used */
-    chSpiDriver = initialisedSpiDriver;
+    drv->spiDriver = initialisedSpiDriver;
 
     /* Copy the preconfigured spi config structure - ensures we get any
      * hardware dependant registers. */
-    memcpy(&chSpiConfig, configuredSpi, sizeof(chSpiConfig));
+    copySpiConfig(drv, configuredSpi);
 
     /* Store the EXT Driver */
-    chExtDriver = initialisedExtDriver;
+    drv->extDriver = initialisedExtDriver;
+
+#if CHIBIOS_CC3000_SPI_ASYNC == TRUE
+    chBSemInit(&drv->spiAsyncDoneSem, TRUE);
+#endif
+
+    chSemInit(&drv->irqSem, 0);
+    chSemInit(&drv->spiStateSem, 0);
+    chSemInit(&drv->rxFreeSem, CHIBIOS_CC3000_RX_SLOTS);
+    chBSemInit(&drv->hostReadySem, TRUE);
+    chMBInit(&drv->rxReadyMb, drv->rxReadyMbBuffer, CHIBIOS_CC3000_RX_SLOTS);
+    chEvtInit(&drv->asyncEventSource);
+    chMtxInit(&drv->hostMtx);
+    chEvtInit(&drv->txCreditSource);
+
+    cc3000DelayInit();
+
+    /* Make the instance known to the callbacks before they can fire. */
+    chSysLock();
+    for (i = 0; i < CHIBIOS_CC3000_MAX_DRIVERS; i++)
+    {
+        if (cc3000Drivers[i] == NULL || cc3000Drivers[i] == drv)
+        {
+            cc3000Drivers[i] = drv;
+            break;
+        }
+    }
+    chSysUnlock();
+
+    if (i == CHIBIOS_CC3000_MAX_DRIVERS)
+    {
+        return false;
+    }
 
-    /* Use configured SPI information. */
-    chSpiConfig.end_cb = NULL;
-    chSpiConfig.ssport = CHIBIOS_CC3000_NSS_PORT;
-    chSpiConfig.sspad = CHIBIOS_CC3000_NSS_PAD;
-    
     /* Setup EXT - only want to stop it once. */
-    chExtConfig = configuredExt;
-    extStop(chExtDriver);
-    chExtConfig->channels[CHIBIOS_CC3000_IRQ_PAD].mode =
-                                                 EXT_CH_MODE_FALLING_EDGE |
-                                                 CHIBIOS_CC3000_IRQ_EXT_MODE;
-    chExtConfig->channels[CHIBIOS_CC3000_IRQ_PAD].cb = cc3000ExtCb;
-    extStart(chExtDriver, chExtConfig);
+    drv->extConfig = configuredExt;
+    extStop(drv->extDriver);
+    drv->extConfig->channels[config->irqPad].mode = EXT_CH_MODE_FALLING_EDGE |
+                                                    config->irqExtMode;
+    drv->extConfig->channels[config->irqPad].cb = cc3000ExtCb;
+    extStart(drv->extDriver, drv->extConfig);
 
 #if CHIBIOS_CC3000_DBG_PRINT_ENABLED == TRUE
     cc3000Print = printCallback;
+#if CHIBIOS_CC3000_DBG_PRINT_DEFERRED == TRUE
+    cc3000DbgLogStart();
+#endif
 #else 
     (void)printCallback;
 #endif
-    
-    chSemInit(&irqSem, 0);
 
-    pSignalHandlerThd = chThdCreateStatic(irqSignalHandlerThreadWorkingArea,
-                                          sizeof(irqSignalHandlerThreadWorkingArea),
-                                          CHIBIOS_CC3000_IRQ_THD_PRIO,
-                                          irqSignalHandlerThread, NULL);
+    drv->pSignalHandlerThd = chThdCreateStatic(
+                                drv->irqSignalHandlerThreadWorkingArea,
+                                sizeof(drv->irqSignalHandlerThreadWorkingArea),
+                                CHIBIOS_CC3000_IRQ_THD_PRIO,
+                                irqSignalHandlerThread, drv);
+
+    drv->pRxDeliveryThd = chThdCreateStatic(
+                                drv->rxDeliveryThreadWorkingArea,
+                                sizeof(drv->rxDeliveryThreadWorkingArea),
+                                CHIBIOS_CC3000_RX_THD_PRIO,
+                                rxDeliveryThread, drv);
+
+#if CHIBIOS_CC3000_EVENT_DISPATCH == TRUE
+    cc3000EventDispatchStart(drv);
+#endif
 
     /* Ensure the enable pin is low and CC3000 is off */
-    palClearPad(CHIBIOS_CC3000_WLAN_EN_PORT, CHIBIOS_CC3000_WLAN_EN_PAD);
+    palClearPad(config->wlanEnPort, config->wlanEnPad);
+    drv->bootTimeline.powerOff = CC3000_TIMESTAMP();
+    drv->powerOffTime = chTimeNow();
+#if CHIBIOS_CC3000_FAST_BOOT == FALSE
     chThdSleep(MS2ST(100));
+#endif
 
-    wlan_init(chibiosCc3000AsyncCb, sFWPatches, sDriverPatches, 
-              sBootLoaderPatches, cbReadWlanInterruptPin, 
-              SpiResumeSpi, SpiPauseSpi, cbWriteWlanPin);
+    /* Only bind if no other instance is already using the host driver. */
+    if (drv == cc3000ActiveDriver ||
+        cc3000ActiveDriver->pSignalHandlerThd == NULL)
+    {
+        bindHostDriver(drv);
+    }
+
+    return true;
 }
 
 
-/** @brief Responsible for full shut down of the driver.
- *  @details This deactivates the CC3000 driver by terminating threads and
+/** @brief  To be used instead of wlan_init().
+ *  @details Initialises #CC3000D1 with the pins set in
+ *  cc3000_chibios_config.h. See #cc3000ChibiosDriverInit() for the hardware
+ *  which should be configured before calling this function:
+ *      * GPIO #CHIBIOS_CC3000_IRQ_PAD - input.
+ *      * GPIO #CHIBIOS_CC3000_MISO_PAD - input.
+ *      * GPIO #CHIBIOS_CC3000_NSS_PAD - output.
+ *      * GPIO #CHIBIOS_CC3000_SCK_PAD - output.
+ *      * GPIO #CHIBIOS_CC3000_MOSI_PAD - output.
+ *      * GPIO #CHIBIOS_CC3000_WLAN_EN_PAD - output.
+ *
+ *  See @ref hardware_setup_stm32l152.c for an example of the hardware setup
+ *  on a STM32 platform.
+ *
+ *  @warning Ensure configuration in cc3000_chibios_config.h is correct before
+ *           calling this function.
+ *
+ *  @param[in,out] initialisedSpiDriver See #cc3000ChibiosDriverInit().
+ *  @param[in] configuredSpi See #cc3000ChibiosDriverInit().
+ *  @param[in,out] initialisedExtDriver See #cc3000ChibiosDriverInit().
+ *  @param[in,out] configuredExt See #cc3000ChibiosDriverInit().
+ *  @param[in] sFWPatches See TI's documentation for wlan_init().
+ *  @param[in] sDriverPatches See TI's documentation for wlan_init().
+ *  @param[in] sBootLoaderPatches See TI's documentation for wlan_init().
+ *  @param[in] printCallback See #cc3000ChibiosDriverInit().
+ *  */
+void cc3000ChibiosWlanInit(SPIDriver * initialisedSpiDriver,
+                           SPIConfig * configuredSpi,
+                           EXTDriver * initialisedExtDriver,
+                           EXTConfig * configuredExt,
+                           tFWPatches sFWPatches,
+                           tDriverPatches sDriverPatches,
+                           tBootLoaderPatches sBootLoaderPatches,
+                           cc3000PrintCb printCallback)
+{
+    bool initialised;
+
+    initialised = cc3000ChibiosDriverInit(&CC3000D1, &cc3000DefaultConfig,
+                                          initialisedSpiDriver, configuredSpi,
+                                          initialisedExtDriver, configuredExt,
+                                          sFWPatches, sDriverPatches,
+                                          sBootLoaderPatches, printCallback);
+
+    chDbgAssert(initialised == true,
+                "cc3000ChibiosWlanInit(), #1", "already initialised");
+    (void)initialised;
+}
+
+
+/** @brief Binds TI's host driver to another initialised instance.
+ *  @details The host driver API then acts on @p drv, until this is called
+ *           again. Each instance has its own pins, threads, buffers and
+ *           statistics, but TI's host driver state is shared, so instances
+ *           are switchable rather than concurrent.
+ *  @warning The CC3000 of the currently active instance must have been
+ *           stopped with wlan_stop() first. wlan_start() must be called
+ *           after to start the CC3000 of @p drv.
+ *  @param[in] drv The instance to make active. */
+void cc3000ChibiosDriverActivate(cc3000Driver * drv)
+{
+    bindHostDriver(drv);
+}
+
+
+/** @brief Takes exclusive use of TI's host driver.
+ *  @details The host driver is not thread safe. Any thread calling it while
+ *           another may, including library services such as the ping
+ *           monitor, must hold this lock around the calls. Not recursive.
+ *  @param[in] drv The instance whose lock to take. */
+void cc3000ChibiosDriverLock(cc3000Driver * drv)
+{
+    chMtxLock(&drv->hostMtx);
+}
+
+
+/** @brief Releases the lock taken by #cc3000ChibiosDriverLock().
+ *  @details Must be called by the thread holding it, and ChibiOS releases
+ *           the last mutex it took, so other mutexes taken while holding
+ *           the lock must be released first.
+ *  @param[in] drv The instance whose lock to release. */
+void cc3000ChibiosDriverUnlock(cc3000Driver * drv)
+{
+    (void)drv;
+    chMtxUnlock();
+}
+
+
+/** @brief Takes exclusive use of TI's host driver for #cc3000ActiveDriver.
+ *  @details See #cc3000ChibiosDriverLock(). */
+void cc3000ChibiosLock(void)
+{
+    cc3000ChibiosDriverLock(cc3000ActiveDriver);
+}
+
+
+/** @brief Releases the lock taken by #cc3000ChibiosLock(). */
+void cc3000ChibiosUnlock(void)
+{
+    cc3000ChibiosDriverUnlock(cc3000ActiveDriver);
+}
+
+
+/** @brief Responsible for full shut down of a driver instance.
+ *  @details This deactivates the instance by terminating threads and
  *  any other resources that need to be used. 
  *  It is unlikely to be often used, since for stopping the CC3000 the host 
- *  driver function wlan_stop() should be used. */
-void cc3000ChibiosShutdown(void)
+ *  driver function wlan_stop() should be used.
+ *  @param[in,out] drv The instance to shut down. */
+void cc3000ChibiosDriverShutdown(cc3000Driver * drv)
 {
-    extStop(chExtDriver);
+    unsigned int i;
+
+    extStop(drv->extDriver);
  
-    chExtConfig->channels[CHIBIOS_CC3000_IRQ_PAD].mode = EXT_CH_MODE_DISABLED;
-    chExtConfig->channels[CHIBIOS_CC3000_IRQ_PAD].cb = NULL;
+    drv->extConfig->channels[drv->config->irqPad].mode = EXT_CH_MODE_DISABLED;
+    drv->extConfig->channels[drv->config->irqPad].cb = NULL;
 
 #if CHIBIOS_CC3000_EXT_EXCLUSIVE != TRUE
-    extStart(chExtDriver, chExtConfig);
+    extStart(drv->extDriver, drv->extConfig);
+#endif
+
+    chThdTerminate(drv->pSignalHandlerThd);
+    chSemReset(&drv->irqSem, 1);
+    chSemReset(&drv->rxFreeSem, CHIBIOS_CC3000_RX_SLOTS);
+    chSemReset(&drv->spiStateSem, 0);
+    chThdWait(drv->pSignalHandlerThd);
+
+    drv->pSignalHandlerThd = NULL;
+
+    chThdTerminate(drv->pRxDeliveryThd);
+    chMBPost(&drv->rxReadyMb, 0, TIME_IMMEDIATE);
+    chBSemSignal(&drv->hostReadySem);
+    chThdWait(drv->pRxDeliveryThd);
+
+    drv->pRxDeliveryThd = NULL;
+
+#if CHIBIOS_CC3000_EVENT_DISPATCH == TRUE
+    cc3000EventDispatchStop(drv);
+#endif
+
+    chSysLock();
+    for (i = 0; i < CHIBIOS_CC3000_MAX_DRIVERS; i++)
+    {
+        if (cc3000Drivers[i] == drv)
+        {
+            cc3000Drivers[i] = NULL;
+        }
+    }
+    chSysUnlock();
+}
+
+
+/** @brief Responsible for full shut down of the driver.
+ *  @details Shuts down #cc3000ActiveDriver. See
+ *           #cc3000ChibiosDriverShutdown(). */
+void cc3000ChibiosShutdown(void)
+{
+    cc3000ChibiosDriverShutdown(cc3000ActiveDriver);
+}
+
+
+/** @brief To be used instead of wlan_start().
+ *  @details Also records when the CC3000 has started in the boot timeline
+ *           of #cc3000ActiveDriver.
+ *  @param[in] patchesAvailableAtHost See TI's documentation for
+ *             wlan_start(). */
+void cc3000ChibiosWlanStart(unsigned short patchesAvailableAtHost)
+{
+    wlan_start(patchesAvailableAtHost);
+    cc3000ActiveDriver->bootTimeline.started = CC3000_TIMESTAMP();
+}
+
+
+/** @brief Retrieves the times at which each phase of the last start of an
+ *         instance's CC3000 was reached.
+ *  @param[in] drv The instance.
+ *  @param[out] timeline Where to copy the timeline. */
+void cc3000ChibiosDriverGetBootTimeline(cc3000Driver * drv,
+                                        cc3000BootTimeline * timeline)
+{
+    chSysLock();
+    memcpy(timeline, &drv->bootTimeline, sizeof(*timeline));
+    chSysUnlock();
+}
+
+
+/** @brief Retrieves the boot timeline of #cc3000ActiveDriver.
+ *  @details See #cc3000ChibiosDriverGetBootTimeline().
+ *  @param[out] timeline Where to copy the timeline. */
+void cc3000ChibiosGetBootTimeline(cc3000BootTimeline * timeline)
+{
+    cc3000ChibiosDriverGetBootTimeline(cc3000ActiveDriver, timeline);
+}
+
+
+/** @brief Retrieves the trace of an instance, oldest record first.
+ *  @details Only available if #CHIBIOS_CC3000_TRACE is TRUE. A record being
+ *           written as the trace is copied may be incomplete.
+ *  @param[in] drv The instance.
+ *  @param[out] records Where to copy the records.
+ *  @param[in] max Maximum number of records to copy.
+ *  @return Number of records copied. */
+unsigned int cc3000ChibiosDriverGetTrace(cc3000Driver * drv,
+                                         cc3000TraceRecord * records,
+                                         unsigned int max)
+{
+#if CHIBIOS_CC3000_TRACE == TRUE
+    uint32_t head;
+    uint32_t count;
+    uint32_t i;
+
+    chSysLock();
+    head = drv->traceHead;
+    count = head < CHIBIOS_CC3000_TRACE_SIZE ? head : CHIBIOS_CC3000_TRACE_SIZE;
+    count = count < max ? count : max;
+
+    for (i = 0; i < count; i++)
+    {
+        records[i] = drv->trace[(head - count + i) &
+                                (CHIBIOS_CC3000_TRACE_SIZE - 1)];
+    }
+    chSysUnlock();
+
+    return count;
+#else
+    (void)drv;
+    (void)records;
+    (void)max;
+    return 0;
+#endif
+}
+
+
+/** @brief Retrieves the trace of #cc3000ActiveDriver.
+ *  @details See #cc3000ChibiosDriverGetTrace().
+ *  @param[out] records Where to copy the records.
+ *  @param[in] max Maximum number of records to copy.
+ *  @return Number of records copied. */
+unsigned int cc3000ChibiosGetTrace(cc3000TraceRecord * records,
+                                   unsigned int max)
+{
+    return cc3000ChibiosDriverGetTrace(cc3000ActiveDriver, records, max);
+}
+
+
+/** @brief Prints the trace of an instance in the format read by
+ *         util/trace_decode.py.
+ *  @details Only available if #CHIBIOS_CC3000_TRACE is TRUE. The trace is
+ *           copied first, so can be dumped while still being recorded.
+ *  @param[in] drv The instance.
+ *  @param[in] print Where to print the trace. */
+void cc3000ChibiosDriverDumpTrace(cc3000Driver * drv, cc3000PrintCb print)
+{
+#if CHIBIOS_CC3000_TRACE == TRUE
+    /* Too large for the stack of most threads. */
+    static cc3000TraceRecord records[CHIBIOS_CC3000_TRACE_SIZE];
+    static MUTEX_DECL(dumpMtx);
+    unsigned int count;
+    unsigned int i;
+
+    chMtxLock(&dumpMtx);
+
+    count = cc3000ChibiosDriverGetTrace(drv, records,
+                                        CHIBIOS_CC3000_TRACE_SIZE);
+
+    print("CC3000 TRACE BEGIN %u %u\r\n", CC3000_TIMESTAMP_FREQUENCY(), count);
+
+    for (i = 0; i < count; i++)
+    {
+        print("%08x %02x %02x %04x\r\n", records[i].time, records[i].event,
+              records[i].arg, records[i].value);
+    }
+
+    print("CC3000 TRACE END\r\n", NULL);
+
+    chMtxUnlock();
+#else
+    (void)drv;
+    (void)print;
 #endif
+}
+
+
+/** @brief Prints the trace of #cc3000ActiveDriver.
+ *  @details See #cc3000ChibiosDriverDumpTrace().
+ *  @param[in] print Where to print the trace. */
+void cc3000ChibiosDumpTrace(cc3000PrintCb print)
+{
+    cc3000ChibiosDriverDumpTrace(cc3000ActiveDriver, print);
+}
+
+
+/** @brief Retrieves a copy of the statistics gathered by an instance.
+ *  @param[in] drv The instance.
+ *  @param[out] stats Where to copy the statistics. */
+void cc3000ChibiosDriverGetStatistics(cc3000Driver * drv,
+                                      cc3000SpiStatistics * stats)
+{
+    chSysLock();
+    memcpy(stats, &drv->spiStatistics, sizeof(*stats));
+    chSysUnlock();
+
+    stats->timeFrequency = CC3000_TIMESTAMP_FREQUENCY();
+}
+
+
+/** @brief Retrieves a copy of the statistics gathered by the driver.
+ *  @details Those of #cc3000ActiveDriver.
+ *  @param[out] stats Where to copy the statistics. */
+void cc3000ChibiosGetSpiStatistics(cc3000SpiStatistics * stats)
+{
+    cc3000ChibiosDriverGetStatistics(cc3000ActiveDriver, stats);
+}
+
+
+/** @brief Total number of times the SPI speed has fallen back.
+ *  @param drv Driver instance.
+ *  @return Sum of cc3000Driver::spiSpeed fallbacks for every reason. */
+static uint32_t spiFallbackTotal(cc3000Driver *drv)
+{
+    uint32_t total = 0;
+    unsigned int i;
+
+    chSysLock();
+    for (i = 0; i < CC3000_SPI_FALLBACK_COUNT; i++)
+    {
+        total += drv->spiSpeed.fallbacks[i];
+    }
+    chSysUnlock();
+
+    return total;
+}
+
+
+/** @brief Finds the fastest SPI config which communicates reliably.
+ *  @details Starting from the first, slowest, entry of @p speeds each config
+ *           is tried in turn. At each one, #CHIBIOS_CC3000_SPI_NEGOTIATE_ROUNDS
+ *           nvmem_read_sp_version() round trips must return the same result
+ *           as at the slowest speed. On the first failure the previous
+ *           config is settled on.
+ *
+ *           Afterwards, any received packet with an invalid header causes a
+ *           fall back to the next slowest config. The reason for every fall
+ *           back is available from #cc3000ChibiosGetSpiSpeed().
+ *
+ *           Acts on #cc3000ActiveDriver. Must be called after
+ *           wlan_start().
+ *  @warning The host driver does not time out commands. A response so
+ *           corrupt it is not recognised leaves the caller waiting, so
+ *           @p speeds should only contain speeds the hardware is designed
+ *           to support.
+ *  @param[in] speeds SPI configs, ordered slowest to fastest. Only the
+ *             hardware settings are used. Must remain in memory.
+ *  @param[in] count Number of elements in @p speeds.
+ *  @return Index into @p speeds of the config settled on. */
+unsigned int cc3000ChibiosNegotiateSpiSpeed(const SPIConfig * speeds,
+                                            unsigned int count)
+{
+    cc3000Driver *drv = cc3000ActiveDriver;
+    unsigned char expected[2];
+    unsigned char received[2];
+    unsigned char expectedRtn;
+    uint32_t fallbacks;
+    unsigned int index;
+    unsigned int round;
+
+    if (speeds == NULL || count == 0)
+    {
+        return 0;
+    }
+
+    chSysLock();
+    drv->spiSpeedTable = speeds;
+    drv->spiSpeed.count = count;
+    setSpiSpeedI(drv, 0);
+    chSysUnlock();
+
+    expectedRtn = nvmem_read_sp_version(expected);
+
+    for (index = 1; index < count; index++)
+    {
+        chSysLock();
+        setSpiSpeedI(drv, index);
+        chSysUnlock();
+
+        for (round = 0; round < CHIBIOS_CC3000_SPI_NEGOTIATE_ROUNDS; round++)
+        {
+            fallbacks = spiFallbackTotal(drv);
+
+            if (nvmem_read_sp_version(received) != expectedRtn ||
+                memcmp(received, expected, sizeof(expected)) != 0)
+            {
+                chSysLock();
+                spiSpeedFallbackI(drv, CC3000_SPI_FALLBACK_ROUND_TRIP);
+                chSysUnlock();
+                break;
+            }
 
-    chThdTerminate(pSignalHandlerThd);
-    spiPaused = false;
-    chSemReset(&irqSem, 1);
-    chThdWait(pSignalHandlerThd);
+            /* A packet was rejected and the speed already lowered. */
+            if (fallbacks != spiFallbackTotal(drv))
+            {
+                break;
+            }
+        }
+
+        if (round != CHIBIOS_CC3000_SPI_NEGOTIATE_ROUNDS)
+        {
+            break;
+        }
+    }
+
+    CHIBIOS_CC3000_DBG_PRINT("SPI speed settled on %d", drv->spiSpeed.index);
 
-    pSignalHandlerThd = NULL;
+    return drv->spiSpeed.index;
 }
 
+
+/** @brief Retrieves the SPI config in use and the reasons for falling back
+ *         from faster configs.
+ *  @details Those of #cc3000ActiveDriver.
+ *  @param[out] speed Where to copy the information. */
+void cc3000ChibiosGetSpiSpeed(cc3000SpiSpeed * speed)
+{
+    cc3000Driver *drv = cc3000ActiveDriver;
+
+    chSysLock();
+    memcpy(speed, &drv->spiSpeed, sizeof(*speed));
+    chSysUnlock();
+}
@@ -48,12 +48,24 @@
  *  (in host driver 1.11.1) to SpiReceiveHandler() in wlan.c. */
 typedef void (*gcSpiHandleRx)(void *p);
 
+/** @brief A part of a packet to be written by #SpiWriteGather(). */
+typedef struct
+{
+    const unsigned char *pData;     ///< Data to be written.
+    unsigned short length;          ///< Number of bytes at @p pData.
+} tSpiTxSegment;
+
 void SpiOpen(gcSpiHandleRx pfRxHandler);
 void SpiClose(void);
 void SpiWrite(unsigned char *pUserBuffer, unsigned short usLength);
+void SpiWriteGather(unsigned char *pHeader, unsigned short headerLength,
+                    const tSpiTxSegment *segments, unsigned int count);
 
 void SpiResumeSpi(void);
 
+void cc3000DelayInit(void);
+void cc3000DelayUs(uint32_t us);
+
 extern unsigned char wlan_tx_buffer[CC3000_TX_BUFFER_SIZE];
 
 #endif /*__CHIBIOS_CC3000_SPI_H__*/
@@ -0,0 +1,133 @@
+/** @file
+*   @brief Transitions of the CC3000 SPI driver state machine. */
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#ifndef __CHIBIOS_CC3000_SPI_STATE_H__
+#define __CHIBIOS_CC3000_SPI_STATE_H__
+
+#include "cc3000_chibios_api.h"
+
+/** @brief Bit representing @p state in #spiStateTransitions. */
+#define SPI_STATE_BIT(state)        (1U << (state))
+
+/** @brief Set if the compiler can change the state without a lock zone. */
+#if defined(__GCC_ATOMIC_INT_LOCK_FREE) && (__GCC_ATOMIC_INT_LOCK_FREE == 2)
+#define SPI_STATE_ATOMIC            TRUE
+#else
+#define SPI_STATE_ATOMIC            FALSE
+#endif
+
+/** @brief States which may be moved to from each state.
+ *  @details Indexed by the current state. SPI_STATE_POWERUP may be entered
+ *           from anywhere, as #SpiOpen() resets the driver with it. */
+static const uint8_t spiStateTransitions[] =
+{
+    /* SPI_STATE_POWERUP */
+    SPI_STATE_BIT(SPI_STATE_POWERUP) |
+    SPI_STATE_BIT(SPI_STATE_INITIALIZED),
+    /* SPI_STATE_INITIALIZED - the first write completes */
+    SPI_STATE_BIT(SPI_STATE_POWERUP) |
+    SPI_STATE_BIT(SPI_STATE_IDLE),
+    /* SPI_STATE_IDLE */
+    SPI_STATE_BIT(SPI_STATE_POWERUP) |
+    SPI_STATE_BIT(SPI_STATE_IDLE) |
+    SPI_STATE_BIT(SPI_STATE_WRITE_REQUESTED) |
+    SPI_STATE_BIT(SPI_STATE_READ),
+    /* SPI_STATE_WRITE_REQUESTED */
+    SPI_STATE_BIT(SPI_STATE_POWERUP) |
+    SPI_STATE_BIT(SPI_STATE_WRITE_PERMITTED),
+    /* SPI_STATE_WRITE_PERMITTED */
+    SPI_STATE_BIT(SPI_STATE_POWERUP) |
+    SPI_STATE_BIT(SPI_STATE_IDLE),
+    /* SPI_STATE_READ */
+    SPI_STATE_BIT(SPI_STATE_POWERUP) |
+    SPI_STATE_BIT(SPI_STATE_IDLE)
+};
+
+/** @brief Checks if moving between two states is permitted.
+ *  @param from The current state.
+ *  @param to The new state.
+ *  @return True if the transition is permitted. */
+static inline bool spiStateTransitionValid(spiState from, spiState to)
+{
+    return (spiStateTransitions[from] & SPI_STATE_BIT(to)) != 0;
+}
+
+/** @brief Moves @p state to @p to if it is still @p expected, from within a
+ *         lock zone.
+ *  @details An atomic compare and swap where supported, so it is safe against
+ *           #spiStateCompareSwap() callers outside the lock zone.
+ *  @param state The state to change.
+ *  @param[in,out] expected The state @p state must be in. Updated to the
+ *                 actual state if it was not.
+ *  @param to The new state.
+ *  @return True if the state was changed. */
+static inline bool spiStateCompareSwapS(volatile spiState *state,
+                                        spiState *expected, spiState to)
+{
+#if SPI_STATE_ATOMIC == TRUE
+    return __atomic_compare_exchange_n(state, expected, to, false,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#else
+    if (*state != *expected)
+    {
+        *expected = *state;
+        return false;
+    }
+
+    *state = to;
+    return true;
+#endif
+}
+
+/** @brief Moves @p state to @p to if it is still @p expected.
+ *  @details An atomic compare and swap where supported, otherwise a lock
+ *           zone. The transition is not checked; callers validate @p expected
+ *           against @p to with #spiStateTransitionValid() before calling.
+ *  @param state The state to change.
+ *  @param[in,out] expected The state @p state must be in. Updated to the
+ *                 actual state if it was not.
+ *  @param to The new state.
+ *  @return True if the state was changed. */
+static inline bool spiStateCompareSwap(volatile spiState *state,
+                                       spiState *expected, spiState to)
+{
+#if SPI_STATE_ATOMIC == TRUE
+    return spiStateCompareSwapS(state, expected, to);
+#else
+    bool swapped;
+
+    chSysLock();
+    swapped = spiStateCompareSwapS(state, expected, to);
+    chSysUnlock();
+
+    return swapped;
+#endif
+}
+
+#endif /*__CHIBIOS_CC3000_SPI_STATE_H__*/
+
@@ -0,0 +1,126 @@
+/** @file
+*   @brief Recording of the CC3000 driver trace. */
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#ifndef __CHIBIOS_CC3000_TRACE_H__
+#define __CHIBIOS_CC3000_TRACE_H__
+
+#include "cc3000_chibios_api.h"
+
+/** @def CC3000_TIMESTAMP
+ *  @brief Time recorded in the trace, cc3000BootTimeline and statistics. */
+/** @def CC3000_TIMESTAMP_FREQUENCY
+ *  @brief Frequency, in Hz, of #CC3000_TIMESTAMP. */
+#if defined(HAL_IMPLEMENTS_COUNTERS) && HAL_IMPLEMENTS_COUNTERS == TRUE
+#define CC3000_TIMESTAMP()          ((uint32_t)halGetCounterValue())
+#define CC3000_TIMESTAMP_FREQUENCY()    ((uint32_t)halGetCounterFrequency())
+#else
+#define CC3000_TIMESTAMP()          ((uint32_t)chTimeNow())
+#define CC3000_TIMESTAMP_FREQUENCY()    ((uint32_t)CH_FREQUENCY)
+#endif
+
+#if CHIBIOS_CC3000_TRACE == TRUE
+
+#if (CHIBIOS_CC3000_TRACE_SIZE & (CHIBIOS_CC3000_TRACE_SIZE - 1)) != 0
+#error "CHIBIOS_CC3000_TRACE_SIZE must be a power of 2."
+#endif
+
+/** @brief Set if a record can be claimed without a lock zone. */
+#if defined(__GCC_ATOMIC_INT_LOCK_FREE) && (__GCC_ATOMIC_INT_LOCK_FREE == 2)
+#define TRACE_ATOMIC                TRUE
+#else
+#define TRACE_ATOMIC                FALSE
+#endif
+
+/** @brief Fills in a trace record.
+ *  @param drv Driver instance.
+ *  @param index Number of the record, as taken from
+ *               cc3000Driver::traceHead.
+ *  @param event A #cc3000TraceEvent.
+ *  @param arg Event specific.
+ *  @param value Event specific. */
+static inline void cc3000TraceWrite(cc3000Driver *drv, uint32_t index,
+                                    uint8_t event, uint8_t arg,
+                                    uint16_t value)
+{
+    cc3000TraceRecord *record;
+
+    record = &drv->trace[index & (CHIBIOS_CC3000_TRACE_SIZE - 1)];
+    record->time = CC3000_TIMESTAMP();
+    record->event = event;
+    record->arg = arg;
+    record->value = value;
+}
+
+/** @brief Records an event from within a lock zone or an ISR.
+ *  @param drv Driver instance.
+ *  @param event A #cc3000TraceEvent.
+ *  @param arg Event specific.
+ *  @param value Event specific. */
+static inline void cc3000TraceI(cc3000Driver *drv, uint8_t event, uint8_t arg,
+                                uint16_t value)
+{
+#if TRACE_ATOMIC == TRUE
+    cc3000TraceWrite(drv, __atomic_fetch_add(&drv->traceHead, 1,
+                                             __ATOMIC_RELAXED),
+                     event, arg, value);
+#else
+    cc3000TraceWrite(drv, drv->traceHead++, event, arg, value);
+#endif
+}
+
+/** @brief Records an event from a thread.
+ *  @param drv Driver instance.
+ *  @param event A #cc3000TraceEvent.
+ *  @param arg Event specific.
+ *  @param value Event specific. */
+static inline void cc3000Trace(cc3000Driver *drv, uint8_t event, uint8_t arg,
+                               uint16_t value)
+{
+#if TRACE_ATOMIC == TRUE
+    cc3000TraceI(drv, event, arg, value);
+#else
+    chSysLock();
+    cc3000TraceI(drv, event, arg, value);
+    chSysUnlock();
+#endif
+}
+
+/** @brief Records an event from a thread. */
+#define CC3000_TRACE(drv, event, arg, value)                                \
+    cc3000Trace(drv, event, arg, value)
+/** @brief Records an event from within a lock zone or an ISR. */
+#define CC3000_TRACE_I(drv, event, arg, value)                              \
+    cc3000TraceI(drv, event, arg, value)
+
+#else
+#define CC3000_TRACE(drv, event, arg, value)
+#define CC3000_TRACE_I(drv, event, arg, value)
+#endif
+
+#endif /*__CHIBIOS_CC3000_TRACE_H__*/
+
@@ -0,0 +1,207 @@
+/** @file
+*   @brief A worker thread making host driver calls for other threads. */
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#include "cc3000_chibios_api.h"
+#include "cc3000_common.h"
+
+#if CHIBIOS_CC3000_COMMAND_QUEUE == TRUE
+
+/** @brief Buffer of #commandMb. */
+static msg_t commandMbBuffer[CHIBIOS_CC3000_COMMAND_QUEUE_SIZE];
+/** @brief Commands waiting for the worker thread. */
+static MAILBOX_DECL(commandMb, commandMbBuffer,
+                    CHIBIOS_CC3000_COMMAND_QUEUE_SIZE);
+/** @brief The worker thread, NULL when stopped. */
+static Thread *commandThd;
+/** @brief Working area of #commandThd. */
+static WORKING_AREA(commandWorkingArea, CHIBIOS_CC3000_COMMAND_THD_AREA);
+
+/** @brief Makes each submitted command's call, in order.
+ *  @details A NULL command stops the thread.
+ *  @param arg Unused.
+ *  @return Always 0. */
+static msg_t commandThread(void *arg)
+{
+    cc3000Command *command;
+    msg_t msg;
+
+    (void)arg;
+
+#if CH_USE_REGISTRY == TRUE
+    chRegSetThreadName(__FUNCTION__);
+#endif
+
+    while (chMBFetch(&commandMb, &msg, TIME_INFINITE) == RDY_OK &&
+           (command = (cc3000Command *)(uintptr_t)msg) != NULL)
+    {
+        /* Other library services may also use the host driver. */
+        cc3000ChibiosLock();
+        command->result = command->fn(command->arg);
+        cc3000ChibiosUnlock();
+
+        /* The waiter may reuse or free the command as soon as it sees
+         * done, so nothing may touch it after this lock zone. */
+        chSysLock();
+        command->done = true;
+        chBSemSignalI(&command->doneSem);
+        chSchRescheduleS();
+        chSysUnlock();
+    }
+
+    return 0;
+}
+
+/** @brief Starts the command worker thread.
+ *  @details Once started, threads should submit their host driver calls
+ *           as commands, rather than make them directly, so they are made
+ *           one at a time by the worker thread. The worker holds
+ *           cc3000ChibiosLock() for each call, so commands are serialised
+ *           with the rest of the library rather than pipelined; the queue
+ *           only saves the submitting thread from waiting for the lock. */
+void cc3000ChibiosCommandStart(void)
+{
+    if (commandThd == NULL)
+    {
+        commandThd = chThdCreateStatic(commandWorkingArea,
+                                       sizeof(commandWorkingArea),
+                                       CHIBIOS_CC3000_COMMAND_THD_PRIO,
+                                       commandThread, NULL);
+    }
+}
+
+/** @brief Stops the command worker thread.
+ *  @details Commands already submitted are completed first. */
+void cc3000ChibiosCommandStop(void)
+{
+    Thread *thd = commandThd;
+
+    if (thd != NULL)
+    {
+        /* Stop accepting commands in the same lock zone as queueing the
+         * NULL, so no command is queued behind it and never made. */
+        chSysLock();
+        commandThd = NULL;
+        chMBPostS(&commandMb, (msg_t)(uintptr_t)NULL, TIME_INFINITE);
+        chSysUnlock();
+        chThdWait(thd);
+    }
+}
+
+/** @brief Prepares a command to be submitted.
+ *  @param[out] command The command.
+ *  @param[in] fn Call to make on the worker thread. It may use the host
+ *             driver freely, but must not take cc3000ChibiosLock(), which
+ *             the worker thread already holds, or wait on another command.
+ *  @param[in] arg Argument passed to @p fn, e.g. a structure holding the
+ *             arguments of the host driver call and space for its output. */
+void cc3000ChibiosCommandInit(cc3000Command * command, cc3000CommandFn fn,
+                              void * arg)
+{
+    command->fn = fn;
+    command->arg = arg;
+    command->result = 0;
+    command->done = false;
+    chBSemInit(&command->doneSem, TRUE);
+}
+
+/** @brief Queues a command for the worker thread.
+ *  @details Returns once queued, so a thread may submit several commands,
+ *           then wait for their results. Commands are made in the order
+ *           submitted.
+ *  @param[in,out] command A command prepared by cc3000ChibiosCommandInit().
+ *  @param[in] timeout Maximum time to wait for space in the queue.
+ *  @return False if the worker thread has not been started, or the queue
+ *          stayed full, and the command was not submitted. */
+bool cc3000ChibiosCommandSubmit(cc3000Command * command, systime_t timeout)
+{
+    msg_t res = RDY_RESET;
+
+    chSysLock();
+    if (commandThd != NULL)
+    {
+        res = chMBPostS(&commandMb, (msg_t)(uintptr_t)command, timeout);
+    }
+    chSysUnlock();
+
+    return res == RDY_OK;
+}
+
+/** @brief Checks if a submitted command is complete.
+ *  @param[in] command The command.
+ *  @return True if its result is available. */
+bool cc3000ChibiosCommandDone(const cc3000Command * command)
+{
+    return command->done;
+}
+
+/** @brief Waits for a submitted command to complete.
+ *  @param[in,out] command The command.
+ *  @param[in] timeout Maximum time to wait, or TIME_INFINITE.
+ *  @param[out] result Where to store the command's result. May be NULL.
+ *  @return False on a timeout, in which case the command must still not be
+ *          reused until complete. */
+bool cc3000ChibiosCommandWait(cc3000Command * command, systime_t timeout,
+                              long * result)
+{
+    if (!command->done &&
+        chBSemWaitTimeout(&command->doneSem, timeout) != RDY_OK)
+    {
+        return false;
+    }
+
+    if (result != NULL)
+    {
+        *result = command->result;
+    }
+
+    return true;
+}
+
+/** @brief Makes a call on the worker thread, waiting for its result.
+ *  @details See #cc3000ChibiosCommandInit() for the requirements of
+ *           @p fn.
+ *  @param[in] fn Call to make.
+ *  @param[in] arg Argument passed to @p fn.
+ *  @return The result of @p fn, or EFAIL if the worker thread has not been
+ *          started. */
+long cc3000ChibiosCommandCall(cc3000CommandFn fn, void * arg)
+{
+    cc3000Command command;
+    long result;
+
+    cc3000ChibiosCommandInit(&command, fn, arg);
+    if (!cc3000ChibiosCommandSubmit(&command, TIME_INFINITE))
+    {
+        return EFAIL;
+    }
+    cc3000ChibiosCommandWait(&command, TIME_INFINITE, &result);
+
+    return result;
+}
+
+#endif /* CHIBIOS_CC3000_COMMAND_QUEUE */
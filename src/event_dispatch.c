@@ -0,0 +1,226 @@
+/** @file
+*   @brief Passing of asynchronous events to user handlers. */
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#include "cc3000_chibios_api.h"
+#include "async_handler.h"
+#include "cc3000_trace.h"
+#include "string.h"
+
+#if CHIBIOS_CC3000_EVENT_DISPATCH == TRUE
+
+#if (CHIBIOS_CC3000_EVENT_QUEUE_SIZE & (CHIBIOS_CC3000_EVENT_QUEUE_SIZE - 1)) != 0
+#error "CHIBIOS_CC3000_EVENT_QUEUE_SIZE must be a power of 2."
+#endif
+
+/* The queue has a single producer and a single consumer, so only needs the
+ * indices to be read and written in order with the entries. */
+#if defined(__GCC_ATOMIC_INT_LOCK_FREE) && (__GCC_ATOMIC_INT_LOCK_FREE == 2)
+#define EVENT_INDEX_LOAD(p)         __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define EVENT_INDEX_STORE(p, v)     __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define EVENT_INDEX_LOAD(p)         (*(p))
+#define EVENT_INDEX_STORE(p, v)     do { *(p) = (v); } while (0)
+#endif
+
+/** @brief Adds an event to an instance's dispatch queue.
+ *  @details Only called from the thread receiving packets, the single
+ *           producer of the queue. Never blocks; if the queue is full the
+ *           event is dropped and counted.
+ *  @param drv Driver instance.
+ *  @param type Event type.
+ *  @param data Payload of the event.
+ *  @param length Number of bytes at @p data. */
+void cc3000EventDispatchPush(cc3000Driver * drv, long type,
+                             const char * data, unsigned char length)
+{
+    uint32_t head = drv->eventHead;
+    cc3000Event *event;
+
+    if (head - EVENT_INDEX_LOAD(&drv->eventTail) ==
+        CHIBIOS_CC3000_EVENT_QUEUE_SIZE)
+    {
+        drv->spiStatistics.asyncEventsDropped++;
+        return;
+    }
+
+    event = &drv->eventQueue[head & (CHIBIOS_CC3000_EVENT_QUEUE_SIZE - 1)];
+    event->type = type;
+    event->time = CC3000_TIMESTAMP();
+    event->length = length;
+    memcpy(event->payload, data,
+           length < sizeof(event->payload) ? length : sizeof(event->payload));
+
+    EVENT_INDEX_STORE(&drv->eventHead, head + 1);
+
+    chBSemSignal(&drv->eventSem);
+}
+
+/** @brief Passes queued events to the registered handlers, in order.
+ *  @param arg The driver instance.
+ *  @return Always 0. */
+static msg_t eventDispatchThread(void *arg)
+{
+    cc3000Driver *drv = arg;
+    cc3000EventHandler handler;
+    uint32_t tail;
+    unsigned int i;
+
+#if CH_USE_REGISTRY == TRUE
+    chRegSetThreadName(__FUNCTION__);
+#endif
+
+    while (!chThdShouldTerminate())
+    {
+        chBSemWait(&drv->eventSem);
+
+        tail = drv->eventTail;
+
+        while (tail != EVENT_INDEX_LOAD(&drv->eventHead))
+        {
+            const cc3000Event *event =
+                &drv->eventQueue[tail & (CHIBIOS_CC3000_EVENT_QUEUE_SIZE - 1)];
+
+            for (i = 0; i < CHIBIOS_CC3000_EVENT_HANDLERS; i++)
+            {
+                if ((handler = drv->eventHandlers[i]) != NULL)
+                {
+                    handler(event);
+                }
+            }
+
+            /* Only now may the producer reuse the entry. */
+            EVENT_INDEX_STORE(&drv->eventTail, ++tail);
+        }
+    }
+
+    return 0;
+}
+
+/** @brief Starts an instance's event dispatcher thread.
+ *  @param drv Driver instance. */
+void cc3000EventDispatchStart(cc3000Driver * drv)
+{
+    drv->eventHead = 0;
+    drv->eventTail = 0;
+    chBSemInit(&drv->eventSem, TRUE);
+
+    drv->pEventThd = chThdCreateStatic(drv->eventThreadWorkingArea,
+                                       sizeof(drv->eventThreadWorkingArea),
+                                       CHIBIOS_CC3000_EVENT_THD_PRIO,
+                                       eventDispatchThread, drv);
+}
+
+/** @brief Stops an instance's event dispatcher thread.
+ *  @details Events still queued are not dispatched.
+ *  @param drv Driver instance. */
+void cc3000EventDispatchStop(cc3000Driver * drv)
+{
+    chThdTerminate(drv->pEventThd);
+    chBSemSignal(&drv->eventSem);
+    chThdWait(drv->pEventThd);
+    drv->pEventThd = NULL;
+}
+
+#endif /* CHIBIOS_CC3000_EVENT_DISPATCH */
+
+/** @brief Adds a handler of an instance's asynchronous events.
+ *  @details Only available if #CHIBIOS_CC3000_EVENT_DISPATCH is TRUE. The
+ *           handler is called from the dispatcher thread for every event
+ *           received after it was added.
+ *  @param[in] drv The instance.
+ *  @param[in] handler The handler.
+ *  @return False if #CHIBIOS_CC3000_EVENT_HANDLERS are already added. */
+bool cc3000ChibiosDriverAddEventHandler(cc3000Driver * drv,
+                                        cc3000EventHandler handler)
+{
+#if CHIBIOS_CC3000_EVENT_DISPATCH == TRUE
+    bool added = false;
+    unsigned int i;
+
+    chSysLock();
+    for (i = 0; i < CHIBIOS_CC3000_EVENT_HANDLERS; i++)
+    {
+        if (drv->eventHandlers[i] == NULL)
+        {
+            drv->eventHandlers[i] = handler;
+            added = true;
+            break;
+        }
+    }
+    chSysUnlock();
+
+    return added;
+#else
+    (void)drv;
+    (void)handler;
+    return false;
+#endif
+}
+
+/** @brief Removes a handler added by #cc3000ChibiosDriverAddEventHandler().
+ *  @details The handler may still be running on the dispatcher thread when
+ *           this returns.
+ *  @param[in] drv The instance.
+ *  @param[in] handler The handler. */
+void cc3000ChibiosDriverRemoveEventHandler(cc3000Driver * drv,
+                                           cc3000EventHandler handler)
+{
+#if CHIBIOS_CC3000_EVENT_DISPATCH == TRUE
+    unsigned int i;
+
+    chSysLock();
+    for (i = 0; i < CHIBIOS_CC3000_EVENT_HANDLERS; i++)
+    {
+        if (drv->eventHandlers[i] == handler)
+        {
+            drv->eventHandlers[i] = NULL;
+        }
+    }
+    chSysUnlock();
+#else
+    (void)drv;
+    (void)handler;
+#endif
+}
+
+/** @brief Adds a handler of the asynchronous events of #cc3000ActiveDriver.
+ *  @details See #cc3000ChibiosDriverAddEventHandler().
+ *  @param[in] handler The handler.
+ *  @return False if the handler could not be added. */
+bool cc3000ChibiosAddEventHandler(cc3000EventHandler handler)
+{
+    return cc3000ChibiosDriverAddEventHandler(cc3000ActiveDriver, handler);
+}
+
+/** @brief Removes a handler added by #cc3000ChibiosAddEventHandler().
+ *  @param[in] handler The handler. */
+void cc3000ChibiosRemoveEventHandler(cc3000EventHandler handler)
+{
+    cc3000ChibiosDriverRemoveEventHandler(cc3000ActiveDriver, handler);
+}
+
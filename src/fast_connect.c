@@ -0,0 +1,367 @@
+/** @file
+*   @brief Connecting with a cached DHCP lease and access point. */
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#include "cc3000_chibios_api.h"
+#include "async_handler.h"
+#include "wlan.h"
+#include "netapp.h"
+#include "nvmem.h"
+#include "stddef.h"
+#include "string.h"
+
+#if CHIBIOS_CC3000_FAST_CONNECT == TRUE
+
+#if CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS != TRUE
+#error "Fast connect requires CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS."
+#endif
+
+/** @brief Identifies a stored cache, and its layout. */
+#define CACHE_MAGIC             0x43434601UL
+/** @brief Longest SSID. */
+#define CACHE_SSID_MAX          32
+/** @brief Size of a BSSID. */
+#define CACHE_BSSID_SIZE        6
+
+/** @brief The fast connect cache, as stored. */
+typedef struct {
+    uint32_t magic;                     ///< #CACHE_MAGIC.
+    uint8_t ssidLen;                    ///< Length of #ssid.
+    uint8_t hasBssid;                   ///< If #bssid is set.
+    /** @brief If the CC3000 has been given #lease as its static IP
+     *         configuration. */
+    uint8_t staticSet;
+    uint8_t uses;                       ///< Fast connections with #lease.
+    uint8_t ssid[CACHE_SSID_MAX];       ///< SSID of the access point.
+    uint8_t bssid[CACHE_BSSID_SIZE];    ///< BSSID of the access point.
+    uint8_t reserved[2];                ///< Padding, zero.
+    tNetappDhcpParams lease;            ///< The last DHCP lease.
+    uint32_t check;                     ///< Hash of the above.
+} connectCache;
+
+/** @brief Storage provided by the application, NULL for NVMEM. */
+static const cc3000ConnectStorage *connectStorage;
+/** @brief Results of the connections made. */
+static cc3000ConnectStatistics connectStatistics;
+
+/** @brief Hashes the cache, excluding connectCache::check.
+ *  @details FNV-1a.
+ *  @param cache The cache.
+ *  @return The hash. */
+static uint32_t cacheHash(const connectCache * cache)
+{
+    const uint8_t *bytes = (const uint8_t *)cache;
+    uint32_t hash = 2166136261UL;
+    unsigned int i;
+
+    for (i = 0; i < offsetof(connectCache, check); i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619UL;
+    }
+
+    return hash;
+}
+
+/** @brief Reads the cache from storage.
+ *  @param cache Filled in with the cache.
+ *  @return False if no valid cache is stored. */
+static bool cacheLoad(connectCache * cache)
+{
+    bool loaded;
+
+    if (connectStorage != NULL)
+    {
+        loaded = connectStorage->load(cache, sizeof(*cache));
+    }
+    else
+    {
+        cc3000ChibiosLock();
+        loaded = nvmem_read(CHIBIOS_CC3000_FAST_CONNECT_FILE, sizeof(*cache),
+                            CHIBIOS_CC3000_FAST_CONNECT_OFFSET,
+                            (unsigned char *)cache) == 0;
+        cc3000ChibiosUnlock();
+    }
+
+    return loaded && cache->magic == CACHE_MAGIC &&
+           cache->ssidLen <= CACHE_SSID_MAX &&
+           cache->check == cacheHash(cache);
+}
+
+/** @brief Writes the cache to storage.
+ *  @param cache The cache, connectCache::check is set.
+ *  @return False if the cache could not be stored. */
+static bool cacheSave(connectCache * cache)
+{
+    bool saved;
+
+    cache->magic = CACHE_MAGIC;
+    cache->check = cacheHash(cache);
+
+    if (connectStorage != NULL)
+    {
+        return connectStorage->save(cache, sizeof(*cache));
+    }
+
+    cc3000ChibiosLock();
+    saved = nvmem_write(CHIBIOS_CC3000_FAST_CONNECT_FILE, sizeof(*cache),
+                        CHIBIOS_CC3000_FAST_CONNECT_OFFSET,
+                        (unsigned char *)cache) == 0;
+    cc3000ChibiosUnlock();
+
+    return saved;
+}
+
+/** @brief Sets the IP configuration the CC3000 uses from its next start.
+ *  @param lease The static configuration, or NULL for DHCP.
+ *  @return True on success. */
+static bool setIpConfiguration(const tNetappDhcpParams * lease)
+{
+    /* In the byte order the CC3000 reports them. */
+    unsigned long ip = 0;
+    unsigned long mask = 0;
+    unsigned long gateway = 0;
+    unsigned long dns = 0;
+    long result;
+
+    if (lease != NULL)
+    {
+        memcpy(&ip, lease->aucIP, sizeof(ip));
+        memcpy(&mask, lease->aucSubnetMask, sizeof(mask));
+        memcpy(&gateway, lease->aucDefaultGateway, sizeof(gateway));
+        memcpy(&dns, lease->aucDNSServer, sizeof(dns));
+    }
+
+    cc3000ChibiosLock();
+    result = netapp_dhcp(&ip, &mask, &gateway, &dns);
+    cc3000ChibiosUnlock();
+
+    return result == 0;
+}
+
+/** @brief Connects and waits for DHCP information.
+ *  @details Disconnects again on a timeout.
+ *  @param secType See wlan_connect().
+ *  @param ssid See wlan_connect().
+ *  @param ssidLen See wlan_connect().
+ *  @param bssid See wlan_connect(), may be NULL.
+ *  @param key See wlan_connect().
+ *  @param keyLen See wlan_connect().
+ *  @param timeout Maximum time to wait.
+ *  @return True if connected with DHCP information. */
+static bool connectAndWait(long secType, const char * ssid, long ssidLen,
+                           const unsigned char * bssid,
+                           const unsigned char * key, long keyLen,
+                           systime_t timeout)
+{
+    systime_t start = chTimeNow();
+    long result;
+
+    cc3000ChibiosClearAsyncData(CC3000_ASYNC_DATA_CONNECTED |
+                                CC3000_ASYNC_DATA_DHCP);
+
+    cc3000ChibiosLock();
+    result = wlan_connect(secType, (char *)ssid, ssidLen,
+                          (unsigned char *)bssid, (unsigned char *)key,
+                          keyLen);
+    cc3000ChibiosUnlock();
+
+    if (result != 0)
+    {
+        return false;
+    }
+
+    if (cc3000ChibiosWaitConnected(cc3000TimeRemaining(start, timeout)) &&
+        cc3000ChibiosWaitDhcp(cc3000TimeRemaining(start, timeout)))
+    {
+        return true;
+    }
+
+    cc3000ChibiosLock();
+    wlan_disconnect();
+    cc3000ChibiosUnlock();
+
+    return false;
+}
+
+/** @brief Connects to an access point, reusing the last DHCP lease if
+ *         possible.
+ *  @details If the cache matches @p ssid, and the CC3000 was given the
+ *           cached lease as its static IP configuration, connects without
+ *           DHCP, to the cached BSSID if known. If that does not complete
+ *           within #CHIBIOS_CC3000_FAST_CONNECT_MS, or the lease has been
+ *           used #CHIBIOS_CC3000_FAST_CONNECT_USES times, DHCP is restored,
+ *           restarting the CC3000, and a full connection made. A lease so
+ *           received is cached and set as the static configuration, which
+ *           the CC3000 applies from its next start.
+ *
+ *           The CC3000 must be started and not connected. The cached lease
+ *           is used without asking the DHCP server, so may conflict with
+ *           another host if the server has reassigned it. wlan_connect()
+ *           has no channel argument, so the channel is not cached.
+ *  @param[in] secType See wlan_connect().
+ *  @param[in] ssid See wlan_connect().
+ *  @param[in] ssidLen See wlan_connect(). At most 32.
+ *  @param[in] bssid BSSID to connect to, or NULL for the cached one if any.
+ *  @param[in] key See wlan_connect().
+ *  @param[in] keyLen See wlan_connect().
+ *  @param[in] patchesAvailableAtHost Passed to wlan_start() if the CC3000
+ *             is restarted.
+ *  @param[in] timeout Maximum time to wait for each connection.
+ *  @return How the connection was made. #CC3000_CONNECT_FAILED without
+ *          trying if @p ssidLen is out of range. */
+cc3000ConnectPath cc3000ChibiosFastConnect(long secType,
+                                           const char * ssid,
+                                           long ssidLen,
+                                           const unsigned char * bssid,
+                                           const unsigned char * key,
+                                           long keyLen,
+                                           unsigned short patchesAvailableAtHost,
+                                           systime_t timeout)
+{
+    const systime_t fastTimeout = MS2ST(CHIBIOS_CC3000_FAST_CONNECT_MS);
+    systime_t start = chTimeNow();
+    cc3000AsynchronousData asyncData;
+    connectCache cache;
+    bool cached;
+
+    if (ssidLen < 0 || ssidLen > CACHE_SSID_MAX)
+    {
+        return CC3000_CONNECT_FAILED;
+    }
+
+    cached = cacheLoad(&cache) &&
+             cache.ssidLen == ssidLen &&
+             memcmp(cache.ssid, ssid, ssidLen) == 0;
+
+    if (cached && cache.staticSet &&
+        cache.uses < CHIBIOS_CC3000_FAST_CONNECT_USES)
+    {
+        chSysLock();
+        connectStatistics.fastAttempts++;
+        chSysUnlock();
+
+        /* Counted before trying, so a lease which hangs the CC3000 is
+         * still eventually renewed. */
+        cache.uses++;
+        cacheSave(&cache);
+
+        if (bssid == NULL && cache.hasBssid)
+        {
+            bssid = cache.bssid;
+        }
+
+        if (connectAndWait(secType, ssid, ssidLen, bssid, key, keyLen,
+                           timeout < fastTimeout ? timeout : fastTimeout))
+        {
+            chSysLock();
+            connectStatistics.fastConnects++;
+            connectStatistics.lastFastTime = chTimeElapsedSince(start);
+            chSysUnlock();
+            return CC3000_CONNECT_FAST;
+        }
+    }
+
+    if (cached && cache.staticSet)
+    {
+        /* DHCP is only used again once the CC3000 restarts. */
+        if (setIpConfiguration(NULL))
+        {
+            cache.staticSet = FALSE;
+            cacheSave(&cache);
+        }
+
+        cc3000ChibiosLock();
+        wlan_stop();
+        cc3000ChibiosWlanStart(patchesAvailableAtHost);
+        cc3000ChibiosUnlock();
+    }
+
+    if (!connectAndWait(secType, ssid, ssidLen, bssid, key, keyLen, timeout))
+    {
+        chSysLock();
+        connectStatistics.failures++;
+        chSysUnlock();
+        return CC3000_CONNECT_FAILED;
+    }
+
+    chSysLock();
+    connectStatistics.dhcpConnects++;
+    connectStatistics.lastDhcpTime = chTimeElapsedSince(start);
+    chSysUnlock();
+
+    cc3000ChibiosGetAsyncData(&asyncData);
+
+    memset(&cache, 0, sizeof(cache));
+    cache.ssidLen = ssidLen;
+    memcpy(cache.ssid, ssid, ssidLen);
+    if (bssid != NULL)
+    {
+        cache.hasBssid = TRUE;
+        memcpy(cache.bssid, bssid, sizeof(cache.bssid));
+    }
+    memcpy(&cache.lease, &asyncData.dhcp.info, sizeof(cache.lease));
+    cache.staticSet = setIpConfiguration(&cache.lease);
+    cacheSave(&cache);
+
+    return CC3000_CONNECT_DHCP;
+}
+
+/** @brief Sets where the fast connect cache is stored.
+ *  @param[in] storage Storage provided by the application, or NULL for
+ *             the NVMEM file #CHIBIOS_CC3000_FAST_CONNECT_FILE. Must remain
+ *             valid while in use. */
+void cc3000ChibiosFastConnectSetStorage(const cc3000ConnectStorage * storage)
+{
+    connectStorage = storage;
+}
+
+/** @brief Discards the fast connect cache.
+ *  @details If the cached lease was set as the static IP configuration,
+ *           DHCP is restored from the next start of the CC3000. */
+void cc3000ChibiosFastConnectForget(void)
+{
+    connectCache cache;
+
+    if (cacheLoad(&cache) && cache.staticSet)
+    {
+        setIpConfiguration(NULL);
+    }
+
+    memset(&cache, 0, sizeof(cache));
+    cacheSave(&cache);
+}
+
+/** @brief Retrieves the results of cc3000ChibiosFastConnect().
+ *  @param[out] stats The results. */
+void cc3000ChibiosFastConnectGetStatistics(cc3000ConnectStatistics * stats)
+{
+    chSysLock();
+    memcpy(stats, &connectStatistics, sizeof(*stats));
+    chSysUnlock();
+}
+
+#endif /* CHIBIOS_CC3000_FAST_CONNECT */
@@ -0,0 +1,461 @@
+/** @file
+*   @brief Background monitoring of ping round trip times and loss. */
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#include "cc3000_chibios_api.h"
+#include "netapp.h"
+#include "string.h"
+
+#if CHIBIOS_CC3000_PING_MONITOR == TRUE
+
+#if CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS != TRUE
+#error "The ping monitor requires CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS."
+#endif
+
+#if CHIBIOS_CC3000_PING_PERCENTILE < 1 || CHIBIOS_CC3000_PING_PERCENTILE > 100
+#error "CHIBIOS_CC3000_PING_PERCENTILE must be between 1 and 100."
+#endif
+
+/** @brief Event of the monitor thread signalled by ping reports. */
+#define PING_REPORT_EVENT       EVENT_MASK(0)
+/** @brief Event of the monitor thread signalled to stop it. */
+#define PING_STOP_EVENT         EVENT_MASK(1)
+
+/** @brief Time, in milliseconds, to wait for a report beyond the time the
+ *         pings may take. */
+#define PING_REPORT_MARGIN_MS   1000
+
+/** @brief Summary of one ping report. */
+typedef struct {
+    uint16_t minRtt;            ///< Minimum round trip time.
+    uint16_t avgRtt;            ///< Average round trip time.
+    uint16_t maxRtt;            ///< Maximum round trip time.
+    uint8_t sent;               ///< Pings sent.
+    uint8_t received;           ///< Replies received.
+} pingSample;
+
+/** @brief A target of the monitor. */
+typedef struct {
+    bool used;                  ///< If this entry is a target.
+    bool alert;                 ///< If the thresholds were last exceeded.
+    uint8_t maxLossPercent;     ///< Loss threshold.
+    uint32_t maxRtt;            ///< Round trip time threshold, 0 for none.
+    uint32_t ip;                ///< Address pinged.
+    uint32_t rounds;            ///< Rounds of pings sent.
+    uint32_t sent;              ///< Pings sent.
+    uint32_t received;          ///< Replies received.
+    uint32_t badReports;        ///< Rounds without a usable report.
+    uint32_t samplesHead;       ///< Number of samples ever written.
+    pingSample samples[CHIBIOS_CC3000_PING_WINDOW]; ///< The latest reports.
+} pingTarget;
+
+/** @brief Protects #pingTargets. */
+static MUTEX_DECL(pingMtx);
+/** @brief Targets of the monitor. */
+static pingTarget pingTargets[CHIBIOS_CC3000_PING_TARGETS];
+/** @brief Broadcasts the alert changes of targets. */
+static EVENTSOURCE_DECL(pingEventSource);
+/** @brief The monitor thread, NULL when stopped. */
+static Thread *pingMonitorThd;
+/** @brief Working area of #pingMonitorThd. */
+static WORKING_AREA(pingMonitorWorkingArea, CHIBIOS_CC3000_PING_THD_AREA);
+
+/** @brief Checks the numbers of a ping report are consistent.
+ *  @details The CC3000 is known to send reports with some numbers wrong.
+ *  @param report The report.
+ *  @return True if the report is usable. */
+static bool pingReportValid(const netapp_pingreport_args_t * report)
+{
+    if (report->packets_sent != CHIBIOS_CC3000_PING_ATTEMPTS ||
+        report->packets_received > report->packets_sent)
+    {
+        return false;
+    }
+
+    if (report->packets_received == 0)
+    {
+        return true;
+    }
+
+    return report->min_round_time <= report->avg_round_time &&
+           report->avg_round_time <= report->max_round_time &&
+           report->max_round_time <= CHIBIOS_CC3000_PING_TIMEOUT_MS;
+}
+
+/** @brief Calculates the statistics of a target.
+ *  @details Must be called holding #pingMtx.
+ *  @param target The target.
+ *  @param stats Filled in with the statistics. */
+static void pingCalculate(const pingTarget * target,
+                          cc3000PingStatistics * stats)
+{
+    uint16_t rtts[CHIBIOS_CC3000_PING_WINDOW];
+    unsigned int count = target->samplesHead;
+    uint32_t windowSent = 0;
+    uint32_t windowReceived = 0;
+    uint32_t rttSum = 0;
+    unsigned int i;
+    unsigned int j;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->ip = target->ip;
+    stats->rounds = target->rounds;
+    stats->sent = target->sent;
+    stats->received = target->received;
+    stats->badReports = target->badReports;
+    stats->alert = target->alert;
+
+    if (count > CHIBIOS_CC3000_PING_WINDOW)
+    {
+        count = CHIBIOS_CC3000_PING_WINDOW;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        const pingSample *sample = &target->samples[i];
+
+        windowSent += sample->sent;
+        windowReceived += sample->received;
+
+        if (sample->received == 0)
+        {
+            continue;
+        }
+
+        if (stats->samples == 0 || sample->minRtt < stats->minRtt)
+        {
+            stats->minRtt = sample->minRtt;
+        }
+        if (sample->maxRtt > stats->maxRtt)
+        {
+            stats->maxRtt = sample->maxRtt;
+        }
+        rttSum += (uint32_t)sample->avgRtt * sample->received;
+
+        /* Insertion sort, the window is small. */
+        for (j = stats->samples; j > 0 && rtts[j - 1] > sample->avgRtt; j--)
+        {
+            rtts[j] = rtts[j - 1];
+        }
+        rtts[j] = sample->avgRtt;
+        stats->samples++;
+    }
+
+    if (stats->samples)
+    {
+        stats->avgRtt = rttSum / windowReceived;
+        stats->percentileRtt =
+            rtts[(stats->samples * CHIBIOS_CC3000_PING_PERCENTILE - 1) / 100];
+    }
+
+    if (windowSent)
+    {
+        stats->lossPercent = ((windowSent - windowReceived) * 100) / windowSent;
+    }
+}
+
+/** @brief Pings a target once and waits for the report.
+ *  @param ip The target.
+ *  @param listener Listener for CC3000_EVENT flags of the active instance.
+ *  @param report Filled in with the report.
+ *  @return True if a report was received, false on a timeout or stop. */
+static bool pingSend(uint32_t ip, EventListener * listener,
+                     netapp_pingreport_args_t * report)
+{
+    const systime_t timeout =
+        MS2ST(CHIBIOS_CC3000_PING_ATTEMPTS * CHIBIOS_CC3000_PING_TIMEOUT_MS +
+              PING_REPORT_MARGIN_MS);
+    systime_t start;
+    systime_t elapsed;
+    eventmask_t events;
+    unsigned long target = ip;
+    cc3000AsynchronousData asyncData;
+
+    cc3000ChibiosLock();
+    cc3000ChibiosClearAsyncData(CC3000_ASYNC_DATA_PING);
+    chEvtGetAndClearFlags(listener);
+    chEvtGetAndClearEvents(PING_REPORT_EVENT);
+    if (netapp_ping_send(&target, CHIBIOS_CC3000_PING_ATTEMPTS,
+                         CHIBIOS_CC3000_PING_SIZE,
+                         CHIBIOS_CC3000_PING_TIMEOUT_MS) != 0)
+    {
+        cc3000ChibiosUnlock();
+        return false;
+    }
+    cc3000ChibiosUnlock();
+
+    start = chTimeNow();
+
+    while ((chEvtGetAndClearFlags(listener) & CC3000_EVENT_PING_REPORT) == 0)
+    {
+        elapsed = chTimeElapsedSince(start);
+
+        if (elapsed >= timeout)
+        {
+            return false;
+        }
+
+        events = chEvtWaitAnyTimeout(PING_REPORT_EVENT | PING_STOP_EVENT,
+                                     timeout - elapsed);
+
+        if (events & PING_STOP_EVENT)
+        {
+            return false;
+        }
+    }
+
+    cc3000ChibiosGetAsyncData(&asyncData);
+    *report = asyncData.ping.report;
+
+    return asyncData.ping.present;
+}
+
+/** @brief Records the result of a round of pings of a target.
+ *  @param index Index of the target in #pingTargets.
+ *  @param ip The target pinged.
+ *  @param report The report, or NULL if none was received. */
+static void pingRecord(unsigned int index, uint32_t ip,
+                       const netapp_pingreport_args_t * report)
+{
+    pingTarget *target = &pingTargets[index];
+    cc3000PingStatistics stats;
+    pingSample *sample;
+    bool alert;
+    bool changed = false;
+
+    chMtxLock(&pingMtx);
+
+    /* The target may have been replaced during the ping. */
+    if (target->used && target->ip == ip)
+    {
+        target->rounds++;
+
+        if (report == NULL || !pingReportValid(report))
+        {
+            target->badReports++;
+        }
+        else
+        {
+            target->sent += report->packets_sent;
+            target->received += report->packets_received;
+
+            sample = &target->samples[target->samplesHead++ %
+                                      CHIBIOS_CC3000_PING_WINDOW];
+            sample->minRtt = report->min_round_time;
+            sample->avgRtt = report->avg_round_time;
+            sample->maxRtt = report->max_round_time;
+            sample->sent = report->packets_sent;
+            sample->received = report->packets_received;
+
+            pingCalculate(target, &stats);
+
+            alert = (target->maxRtt && stats.samples &&
+                     stats.avgRtt > target->maxRtt) ||
+                    stats.lossPercent > target->maxLossPercent;
+
+            changed = alert != target->alert;
+            target->alert = alert;
+        }
+    }
+
+    chMtxUnlock();
+
+    if (changed)
+    {
+        chEvtBroadcastFlags(&pingEventSource, (flagsmask_t)1 << index);
+    }
+}
+
+/** @brief Pings each target in turn, every
+ *         #CHIBIOS_CC3000_PING_INTERVAL_MS.
+ *  @param arg Unused.
+ *  @return Always 0. */
+static msg_t pingMonitorThread(void *arg)
+{
+    EventSource *asyncSource = cc3000ChibiosGetEventSource();
+    netapp_pingreport_args_t report;
+    EventListener listener;
+    unsigned int i;
+    uint32_t ip;
+    bool used;
+
+    (void)arg;
+
+#if CH_USE_REGISTRY == TRUE
+    chRegSetThreadName(__FUNCTION__);
+#endif
+
+    chEvtRegisterMask(asyncSource, &listener, PING_REPORT_EVENT);
+
+    while (!chThdShouldTerminate())
+    {
+        for (i = 0; i < CHIBIOS_CC3000_PING_TARGETS; i++)
+        {
+            chMtxLock(&pingMtx);
+            used = pingTargets[i].used;
+            ip = pingTargets[i].ip;
+            chMtxUnlock();
+
+            if (!used)
+            {
+                continue;
+            }
+
+            if (chThdShouldTerminate())
+            {
+                break;
+            }
+
+            pingRecord(i, ip,
+                       pingSend(ip, &listener, &report) ? &report : NULL);
+        }
+
+        if (!chThdShouldTerminate())
+        {
+            chEvtWaitAnyTimeout(PING_STOP_EVENT,
+                                MS2ST(CHIBIOS_CC3000_PING_INTERVAL_MS));
+        }
+    }
+
+    chEvtUnregister(asyncSource, &listener);
+
+    return 0;
+}
+
+/** @brief Starts the ping monitor thread.
+ *  @details Pings each target added with cc3000ChibiosPingMonitorAdd() in
+ *           turn, then sleeps #CHIBIOS_CC3000_PING_INTERVAL_MS. The
+ *           monitor uses the ping information of #cc3000AsyncData, so the
+ *           application should not send pings of its own while it runs,
+ *           and must hold cc3000ChibiosLock() while calling the host
+ *           driver. */
+void cc3000ChibiosPingMonitorStart(void)
+{
+    if (pingMonitorThd == NULL)
+    {
+        pingMonitorThd = chThdCreateStatic(pingMonitorWorkingArea,
+                                           sizeof(pingMonitorWorkingArea),
+                                           CHIBIOS_CC3000_PING_THD_PRIO,
+                                           pingMonitorThread, NULL);
+    }
+}
+
+/** @brief Stops the ping monitor thread.
+ *  @details Returns once the thread has exited, which may take up to the
+ *           time of the host driver call in progress. Statistics are kept. */
+void cc3000ChibiosPingMonitorStop(void)
+{
+    if (pingMonitorThd != NULL)
+    {
+        chThdTerminate(pingMonitorThd);
+        chEvtSignal(pingMonitorThd, PING_STOP_EVENT);
+        chThdWait(pingMonitorThd);
+        pingMonitorThd = NULL;
+    }
+}
+
+/** @brief Adds a target to the ping monitor.
+ *  @param[in] ip Address to ping, as given to netapp_ping_send().
+ *  @param[in] maxRtt Average round trip time, in milliseconds, above which
+ *                    the target is in alert. 0 for no limit.
+ *  @param[in] maxLossPercent Loss above which the target is in alert.
+ *  @return The index of the target, or -1 if
+ *          #CHIBIOS_CC3000_PING_TARGETS are already monitored. */
+int cc3000ChibiosPingMonitorAdd(uint32_t ip, uint32_t maxRtt,
+                                uint8_t maxLossPercent)
+{
+    int index = -1;
+    unsigned int i;
+
+    chMtxLock(&pingMtx);
+    for (i = 0; i < CHIBIOS_CC3000_PING_TARGETS; i++)
+    {
+        if (!pingTargets[i].used)
+        {
+            memset(&pingTargets[i], 0, sizeof(pingTargets[i]));
+            pingTargets[i].used = true;
+            pingTargets[i].ip = ip;
+            pingTargets[i].maxRtt = maxRtt;
+            pingTargets[i].maxLossPercent = maxLossPercent;
+            index = i;
+            break;
+        }
+    }
+    chMtxUnlock();
+
+    return index;
+}
+
+/** @brief Removes a target from the ping monitor.
+ *  @param[in] target Index returned by cc3000ChibiosPingMonitorAdd(). */
+void cc3000ChibiosPingMonitorRemove(int target)
+{
+    if (target < 0 || target >= CHIBIOS_CC3000_PING_TARGETS)
+    {
+        return;
+    }
+
+    chMtxLock(&pingMtx);
+    pingTargets[target].used = false;
+    chMtxUnlock();
+}
+
+/** @brief Retrieves the rolling statistics of a ping monitor target.
+ *  @param[in] target Index returned by cc3000ChibiosPingMonitorAdd().
+ *  @param[out] stats The statistics.
+ *  @return False if @p target is not monitored. */
+bool cc3000ChibiosPingMonitorGetStatistics(int target,
+                                           cc3000PingStatistics * stats)
+{
+    bool used;
+
+    if (target < 0 || target >= CHIBIOS_CC3000_PING_TARGETS)
+    {
+        return false;
+    }
+
+    chMtxLock(&pingMtx);
+    used = pingTargets[target].used;
+    if (used)
+    {
+        pingCalculate(&pingTargets[target], stats);
+    }
+    chMtxUnlock();
+
+    return used;
+}
+
+/** @brief Retrieves the source of ping monitor alerts.
+ *  @details Flag @p n, (1 << n), is broadcast when target @p n goes into or
+ *           out of alert. Check cc3000PingStatistics::alert for which.
+ *  @return The event source. */
+EventSource * cc3000ChibiosPingMonitorGetEventSource(void)
+{
+    return &pingEventSource;
+}
+
+#endif /* CHIBIOS_CC3000_PING_MONITOR */
@@ -0,0 +1,310 @@
+/** @file
+*   @brief Serving several sockets from one thread with select(). */
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#include "cc3000_chibios_api.h"
+#include "socket.h"
+#include "string.h"
+
+#if CHIBIOS_CC3000_REACTOR == TRUE
+
+#if CHIBIOS_CC3000_REACTOR_MIN_MS < 5
+#error "The CC3000 does not accept select() timeouts below 5 ms."
+#endif
+
+/** @brief A socket registered with the reactor. */
+typedef struct {
+    cc3000SocketCallback onRead;    ///< Called when readable, or NULL.
+    cc3000SocketCallback onWrite;   ///< Called when writable, or NULL.
+    void * arg;                     ///< Passed to the callbacks.
+    bool wantWrite;                 ///< If #onWrite is wanted.
+} reactorSocket;
+
+/** @brief Registered sockets, indexed by descriptor. Protected by a lock
+ *         zone. */
+static reactorSocket reactorSockets[CHIBIOS_CC3000_REACTOR_SOCKETS];
+/** @brief Statistics, protected by a lock zone. */
+static cc3000ReactorStatistics reactorStatistics;
+/** @brief The reactor thread, NULL when stopped. */
+static Thread *reactorThd;
+/** @brief Working area of #reactorThd. */
+static WORKING_AREA(reactorWorkingArea, CHIBIOS_CC3000_REACTOR_THD_AREA);
+
+/** @brief Builds the descriptor sets of the registered sockets.
+ *  @param readSet Filled in with the sockets to wait to read.
+ *  @param writeSet Filled in with the sockets to wait to write.
+ *  @return One more than the highest socket set, 0 if none. */
+static long reactorBuildSets(fd_set * readSet, fd_set * writeSet)
+{
+    long nfds = 0;
+    long sd;
+
+    FD_ZERO(readSet);
+    FD_ZERO(writeSet);
+
+    chSysLock();
+    for (sd = 0; sd < CHIBIOS_CC3000_REACTOR_SOCKETS; sd++)
+    {
+        if (reactorSockets[sd].onRead != NULL)
+        {
+            FD_SET(sd, readSet);
+            nfds = sd + 1;
+        }
+        if (reactorSockets[sd].onWrite != NULL &&
+            reactorSockets[sd].wantWrite)
+        {
+            FD_SET(sd, writeSet);
+            nfds = sd + 1;
+        }
+    }
+    chSysUnlock();
+
+    return nfds;
+}
+
+/** @brief Calls the callbacks of the sockets found ready.
+ *  @details Called without cc3000ChibiosLock(), from the sets copied out
+ *           of select(). A socket removed since the sets were built is
+ *           skipped.
+ *  @param nfds One more than the highest socket in the sets.
+ *  @param readSet Sockets ready to read.
+ *  @param writeSet Sockets ready to write. */
+static void reactorDispatch(long nfds, fd_set * readSet, fd_set * writeSet)
+{
+    cc3000SocketCallback callback;
+    void *arg;
+    long sd;
+
+    for (sd = 0; sd < nfds; sd++)
+    {
+        if (FD_ISSET(sd, readSet))
+        {
+            chSysLock();
+            callback = reactorSockets[sd].onRead;
+            arg = reactorSockets[sd].arg;
+            reactorStatistics.reads += callback != NULL;
+            chSysUnlock();
+
+            if (callback != NULL)
+            {
+                callback(sd, arg);
+            }
+        }
+
+        if (FD_ISSET(sd, writeSet))
+        {
+            chSysLock();
+            callback = reactorSockets[sd].wantWrite ?
+                       reactorSockets[sd].onWrite : NULL;
+            arg = reactorSockets[sd].arg;
+            reactorStatistics.writes += callback != NULL;
+            chSysUnlock();
+
+            if (callback != NULL)
+            {
+                callback(sd, arg);
+            }
+        }
+    }
+}
+
+/** @brief Waits on the registered sockets and dispatches their readiness.
+ *  @details The select() timeout drops to #CHIBIOS_CC3000_REACTOR_MIN_MS
+ *           whenever a socket is ready, and doubles with each idle poll up
+ *           to #CHIBIOS_CC3000_REACTOR_MAX_MS, or straight away while other
+ *           threads are waiting for the host driver. The host driver is
+ *           only held for the select() itself; callbacks take it as they
+ *           need it.
+ *  @param arg Unused.
+ *  @return Always 0. */
+static msg_t reactorThread(void *arg)
+{
+    uint32_t timeoutMs = CHIBIOS_CC3000_REACTOR_MIN_MS;
+    fd_set readSet;
+    fd_set writeSet;
+    timeval timeout;
+    uint32_t pollMs;
+    long nfds;
+    int ready;
+
+    (void)arg;
+
+#if CH_USE_REGISTRY == TRUE
+    chRegSetThreadName(__FUNCTION__);
+#endif
+
+    while (!chThdShouldTerminate())
+    {
+        if ((nfds = reactorBuildSets(&readSet, &writeSet)) == 0)
+        {
+            chThdSleepMilliseconds(CHIBIOS_CC3000_REACTOR_MAX_MS);
+            continue;
+        }
+
+        cc3000ChibiosLock();
+
+        /* Don't keep threads already queued on the lock waiting long. */
+        chSysLock();
+        pollMs = chMtxQueueNotEmptyS(&cc3000ActiveDriver->hostMtx) ?
+                 CHIBIOS_CC3000_REACTOR_MIN_MS : timeoutMs;
+        chSysUnlock();
+
+        timeout.tv_sec = pollMs / 1000;
+        timeout.tv_usec = (pollMs % 1000) * 1000;
+
+        ready = select(nfds, &readSet, &writeSet, NULL, &timeout);
+
+        cc3000ChibiosUnlock();
+
+        if (ready > 0)
+        {
+            reactorDispatch(nfds, &readSet, &writeSet);
+        }
+
+        if (ready > 0)
+        {
+            timeoutMs = CHIBIOS_CC3000_REACTOR_MIN_MS;
+        }
+        else if (timeoutMs < CHIBIOS_CC3000_REACTOR_MAX_MS)
+        {
+            timeoutMs = timeoutMs * 2 < CHIBIOS_CC3000_REACTOR_MAX_MS ?
+                        timeoutMs * 2 : CHIBIOS_CC3000_REACTOR_MAX_MS;
+        }
+
+        chSysLock();
+        reactorStatistics.polls++;
+        reactorStatistics.idlePolls += ready == 0;
+        reactorStatistics.errors += ready < 0;
+        reactorStatistics.timeoutMs = timeoutMs;
+        chSysUnlock();
+
+        if (ready < 0)
+        {
+            /* e.g. a socket closed under the reactor, don't spin. */
+            chThdSleepMilliseconds(CHIBIOS_CC3000_REACTOR_MIN_MS);
+        }
+    }
+
+    return 0;
+}
+
+/** @brief Starts the socket reactor thread.
+ *  @details The application must hold cc3000ChibiosLock() while calling
+ *           the host driver from other threads. */
+void cc3000ChibiosReactorStart(void)
+{
+    if (reactorThd == NULL)
+    {
+        reactorThd = chThdCreateStatic(reactorWorkingArea,
+                                       sizeof(reactorWorkingArea),
+                                       CHIBIOS_CC3000_REACTOR_THD_PRIO,
+                                       reactorThread, NULL);
+    }
+}
+
+/** @brief Stops the socket reactor thread.
+ *  @details Returns once the thread has exited, after the select() in
+ *           progress, up to #CHIBIOS_CC3000_REACTOR_MAX_MS. Sockets stay
+ *           registered. */
+void cc3000ChibiosReactorStop(void)
+{
+    if (reactorThd != NULL)
+    {
+        chThdTerminate(reactorThd);
+        chThdWait(reactorThd);
+        reactorThd = NULL;
+    }
+}
+
+/** @brief Registers a socket with the reactor.
+ *  @details Replaces any earlier registration of @p sd. Write readiness is
+ *           only waited for once requested with
+ *           cc3000ChibiosReactorWantWrite(), as sockets are almost always
+ *           writable.
+ *  @param[in] sd The socket.
+ *  @param[in] onRead Called when @p sd is readable, or NULL.
+ *  @param[in] onWrite Called when @p sd is writable, or NULL.
+ *  @param[in] arg Passed to the callbacks.
+ *  @return False if @p sd is not below #CHIBIOS_CC3000_REACTOR_SOCKETS. */
+bool cc3000ChibiosReactorAdd(long sd, cc3000SocketCallback onRead,
+                             cc3000SocketCallback onWrite, void * arg)
+{
+    if (sd < 0 || sd >= CHIBIOS_CC3000_REACTOR_SOCKETS)
+    {
+        return false;
+    }
+
+    chSysLock();
+    reactorSockets[sd].onRead = onRead;
+    reactorSockets[sd].onWrite = onWrite;
+    reactorSockets[sd].arg = arg;
+    reactorSockets[sd].wantWrite = false;
+    chSysUnlock();
+
+    return true;
+}
+
+/** @brief Sets if the reactor waits for a socket to be writable.
+ *  @details May be called from a callback, e.g. to stop once there is
+ *           nothing left to send.
+ *  @param[in] sd A registered socket.
+ *  @param[in] want If the write callback is wanted. */
+void cc3000ChibiosReactorWantWrite(long sd, bool want)
+{
+    if (sd >= 0 && sd < CHIBIOS_CC3000_REACTOR_SOCKETS)
+    {
+        chSysLock();
+        reactorSockets[sd].wantWrite = want;
+        chSysUnlock();
+    }
+}
+
+/** @brief Removes a socket from the reactor.
+ *  @details May be called from a callback. Called from another thread, a
+ *           callback of @p sd already started may still be running when
+ *           this returns. Remove a socket before closing it.
+ *  @param[in] sd The socket. */
+void cc3000ChibiosReactorRemove(long sd)
+{
+    if (sd >= 0 && sd < CHIBIOS_CC3000_REACTOR_SOCKETS)
+    {
+        chSysLock();
+        memset(&reactorSockets[sd], 0, sizeof(reactorSockets[sd]));
+        chSysUnlock();
+    }
+}
+
+/** @brief Retrieves the statistics of the socket reactor.
+ *  @param[out] stats The statistics. */
+void cc3000ChibiosReactorGetStatistics(cc3000ReactorStatistics * stats)
+{
+    chSysLock();
+    memcpy(stats, &reactorStatistics, sizeof(*stats));
+    chSysUnlock();
+}
+
+#endif /* CHIBIOS_CC3000_REACTOR */
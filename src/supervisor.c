@@ -0,0 +1,343 @@
+/** @file
+*   @brief Keeping the CC3000 connected to an access point. */
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#include "cc3000_chibios_api.h"
+#include "async_handler.h"
+#include "cc3000_trace.h"
+#include "wlan.h"
+#include "string.h"
+
+#if CHIBIOS_CC3000_SUPERVISOR == TRUE
+
+#if CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS != TRUE
+#error "The supervisor requires CHIBIOS_CC3000_ASYNC_DEFAULT_HANDLERS."
+#endif
+
+/** @brief Event of the supervisor thread signalled by asynchronous events.*/
+#define SUPERVISOR_ASYNC_EVENT  EVENT_MASK(0)
+/** @brief Event of the supervisor thread signalled to stop it. */
+#define SUPERVISOR_STOP_EVENT   EVENT_MASK(1)
+
+/** @brief Converts system ticks to milliseconds. */
+#define TICKS_TO_MS(t)          ((uint32_t)(((uint64_t)(t) * 1000) /     \
+                                            CH_FREQUENCY))
+
+/** @brief The access point to stay connected to. */
+static const cc3000NetworkConfig *supervisorConfig;
+/** @brief The supervisor thread, NULL when stopped. */
+static Thread *supervisorThd;
+/** @brief Working area of #supervisorThd. */
+static WORKING_AREA(supervisorWorkingArea, CHIBIOS_CC3000_SUPERVISOR_THD_AREA);
+/** @brief Broadcasts CC3000_NETWORK flags. */
+static EVENTSOURCE_DECL(supervisorEventSource);
+/** @brief If the network is usable. */
+static volatile bool networkUsable;
+/** @brief When the network became usable, or was lost. */
+static systime_t networkChanged;
+/** @brief Statistics, protected by a lock zone. */
+static cc3000SupervisorStatistics supervisorStatistics;
+/** @brief State of the backoff jitter generator. */
+static uint32_t jitterState;
+
+/** @brief Returns a pseudo random number.
+ *  @details xorshift32, good enough to spread reconnecting devices apart.
+ *  @return The number. */
+static uint32_t jitterNext(void)
+{
+    uint32_t x = jitterState;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return jitterState = x;
+}
+
+/** @brief Connects and waits for the network to become usable.
+ *  @param config The access point.
+ *  @return True if connected with DHCP information. */
+static bool supervisorConnect(const cc3000NetworkConfig * config)
+{
+#if CHIBIOS_CC3000_FAST_CONNECT == TRUE
+    return cc3000ChibiosFastConnect(config->secType, config->ssid,
+                                    config->ssidLen, config->bssid,
+                                    config->key, config->keyLen,
+                                    config->patchesAvailableAtHost,
+                                    MS2ST(CHIBIOS_CC3000_SUPERVISOR_CONNECT_MS))
+           != CC3000_CONNECT_FAILED;
+#else
+    const systime_t timeout = MS2ST(CHIBIOS_CC3000_SUPERVISOR_CONNECT_MS);
+    systime_t start = chTimeNow();
+    systime_t elapsed;
+    long result;
+
+    cc3000ChibiosClearAsyncData(CC3000_ASYNC_DATA_CONNECTED |
+                                CC3000_ASYNC_DATA_DHCP);
+
+    cc3000ChibiosLock();
+    result = wlan_connect(config->secType, (char *)config->ssid,
+                          config->ssidLen, (unsigned char *)config->bssid,
+                          (unsigned char *)config->key, config->keyLen);
+    cc3000ChibiosUnlock();
+
+    if (result == 0 && cc3000ChibiosWaitConnected(timeout))
+    {
+        elapsed = chTimeElapsedSince(start);
+
+        if (elapsed < timeout && cc3000ChibiosWaitDhcp(timeout - elapsed))
+        {
+            return true;
+        }
+    }
+
+    cc3000ChibiosLock();
+    wlan_disconnect();
+    cc3000ChibiosUnlock();
+
+    return false;
+#endif
+}
+
+/** @brief Records the network becoming usable or being lost.
+ *  @param usable If the network is now usable. */
+static void supervisorChange(bool usable)
+{
+    systime_t now = chTimeNow();
+    systime_t elapsed = now - networkChanged;
+    uint32_t ms;
+    unsigned int bucket = 0;
+
+    chSysLock();
+    if (usable)
+    {
+        supervisorStatistics.connects++;
+
+        /* The first connection is not a reconnection. */
+        if (supervisorStatistics.disconnects)
+        {
+            if (supervisorStatistics.minReconnectTime == 0 ||
+                elapsed < supervisorStatistics.minReconnectTime)
+            {
+                supervisorStatistics.minReconnectTime = elapsed;
+            }
+            if (elapsed > supervisorStatistics.maxReconnectTime)
+            {
+                supervisorStatistics.maxReconnectTime = elapsed;
+            }
+
+            ms = TICKS_TO_MS(elapsed);
+            while (ms && bucket < CC3000_SUPERVISOR_LATENCY_BUCKETS - 1)
+            {
+                ms >>= 1;
+                bucket++;
+            }
+            supervisorStatistics.reconnectTimes[bucket]++;
+        }
+    }
+    else
+    {
+        supervisorStatistics.disconnects++;
+        supervisorStatistics.uptime += elapsed;
+    }
+
+    networkChanged = now;
+    networkUsable = usable;
+    chSysUnlock();
+
+    chEvtBroadcastFlags(&supervisorEventSource,
+                        usable ? CC3000_NETWORK_UP : CC3000_NETWORK_DOWN);
+}
+
+/** @brief Connects, reconnecting with a jittered exponential backoff
+ *         whenever the connection or DHCP lease is lost.
+ *  @param arg Unused.
+ *  @return Always 0. */
+static msg_t supervisorThread(void *arg)
+{
+    EventSource *asyncSource = cc3000ChibiosGetEventSource();
+    uint32_t backoff = CHIBIOS_CC3000_SUPERVISOR_BACKOFF_MIN_MS;
+    EventListener listener;
+    flagsmask_t flags;
+    uint32_t delay;
+
+    (void)arg;
+
+#if CH_USE_REGISTRY == TRUE
+    chRegSetThreadName(__FUNCTION__);
+#endif
+
+    chEvtRegisterMask(asyncSource, &listener, SUPERVISOR_ASYNC_EVENT);
+
+    while (!chThdShouldTerminate())
+    {
+        if (!networkUsable)
+        {
+            chEvtGetAndClearFlags(&listener);
+
+            if (supervisorConnect(supervisorConfig))
+            {
+                /* Drop flags of earlier attempts, then check the
+                 * connection survived them. */
+                chEvtGetAndClearFlags(&listener);
+                chEvtGetAndClearEvents(SUPERVISOR_ASYNC_EVENT);
+                if (cc3000AsyncData.connected)
+                {
+                    backoff = CHIBIOS_CC3000_SUPERVISOR_BACKOFF_MIN_MS;
+                    supervisorChange(true);
+                    continue;
+                }
+
+                /* Lost again at once, back off as for a failure. */
+            }
+
+            chSysLock();
+            supervisorStatistics.failedAttempts++;
+            chSysUnlock();
+
+            /* Wait between half and all of the backoff. */
+            delay = backoff / 2 + jitterNext() % (backoff / 2 + 1);
+            chEvtWaitAnyTimeout(SUPERVISOR_STOP_EVENT, MS2ST(delay));
+
+            backoff = backoff * 2 < CHIBIOS_CC3000_SUPERVISOR_BACKOFF_MAX_MS ?
+                      backoff * 2 : CHIBIOS_CC3000_SUPERVISOR_BACKOFF_MAX_MS;
+            continue;
+        }
+
+        if (chEvtWaitAny(SUPERVISOR_ASYNC_EVENT | SUPERVISOR_STOP_EVENT) &
+            SUPERVISOR_STOP_EVENT)
+        {
+            continue;
+        }
+
+        flags = chEvtGetAndClearFlags(&listener);
+
+        if (flags & CC3000_EVENT_DISCONNECT)
+        {
+            supervisorChange(false);
+        }
+        else if ((flags & CC3000_EVENT_DHCP) && !cc3000AsyncData.dhcp.present)
+        {
+            /* The lease was lost, start again. */
+            cc3000ChibiosLock();
+            wlan_disconnect();
+            cc3000ChibiosUnlock();
+            supervisorChange(false);
+        }
+    }
+
+    chEvtUnregister(asyncSource, &listener);
+
+    return 0;
+}
+
+/** @brief Starts the connection supervisor.
+ *  @details The supervisor connects to @p config and reconnects whenever
+ *           the connection or DHCP lease is lost, waiting between
+ *           #CHIBIOS_CC3000_SUPERVISOR_BACKOFF_MIN_MS and
+ *           #CHIBIOS_CC3000_SUPERVISOR_BACKOFF_MAX_MS, doubling and with
+ *           random jitter, between failed attempts. Uses
+ *           cc3000ChibiosFastConnect() if #CHIBIOS_CC3000_FAST_CONNECT is
+ *           TRUE. The CC3000 must be started and not connected. The
+ *           application must hold cc3000ChibiosLock() while calling the
+ *           host driver.
+ *  @param[in] config The access point. Must remain valid while the
+ *             supervisor runs. */
+void cc3000ChibiosSupervisorStart(const cc3000NetworkConfig * config)
+{
+    if (supervisorThd != NULL)
+    {
+        return;
+    }
+
+    supervisorConfig = config;
+    networkUsable = false;
+    networkChanged = chTimeNow();
+    jitterState = CC3000_TIMESTAMP() | 1;
+
+    supervisorThd = chThdCreateStatic(supervisorWorkingArea,
+                                      sizeof(supervisorWorkingArea),
+                                      CHIBIOS_CC3000_SUPERVISOR_THD_PRIO,
+                                      supervisorThread, NULL);
+}
+
+/** @brief Stops the connection supervisor.
+ *  @details Returns once the thread has exited, which may take up to
+ *           #CHIBIOS_CC3000_SUPERVISOR_CONNECT_MS if a connection attempt
+ *           is in progress. The connection is left as it is. */
+void cc3000ChibiosSupervisorStop(void)
+{
+    if (supervisorThd != NULL)
+    {
+        chThdTerminate(supervisorThd);
+        chEvtSignal(supervisorThd, SUPERVISOR_STOP_EVENT);
+        chThdWait(supervisorThd);
+        supervisorThd = NULL;
+    }
+}
+
+/** @brief Checks if the supervisor has made the network usable.
+ *  @return #networkUsable. */
+static bool isNetworkUsable(void)
+{
+    return networkUsable;
+}
+
+/** @brief Waits until the supervisor has made the network usable.
+ *  @details Returns at once if it already is. Uses event
+ *           #CHIBIOS_CC3000_WAIT_EVENT_ID of the calling thread.
+ *  @param[in] timeout Maximum time to wait, or TIME_INFINITE.
+ *  @return True if the network is usable. */
+bool cc3000ChibiosWaitNetwork(systime_t timeout)
+{
+    return cc3000WaitCondition(&supervisorEventSource, isNetworkUsable,
+                               timeout);
+}
+
+/** @brief Retrieves the source of connection supervisor events.
+ *  @details Listeners are passed CC3000_NETWORK flags.
+ *  @return The event source. */
+EventSource * cc3000ChibiosSupervisorGetEventSource(void)
+{
+    return &supervisorEventSource;
+}
+
+/** @brief Retrieves the statistics of the connection supervisor.
+ *  @param[out] stats The statistics. */
+void cc3000ChibiosSupervisorGetStatistics(cc3000SupervisorStatistics * stats)
+{
+    chSysLock();
+    memcpy(stats, &supervisorStatistics, sizeof(*stats));
+    if (networkUsable)
+    {
+        stats->currentUptime = chTimeNow() - networkChanged;
+        stats->uptime += stats->currentUptime;
+    }
+    chSysUnlock();
+}
+
+#endif /* CHIBIOS_CC3000_SUPERVISOR */
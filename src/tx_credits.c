@@ -0,0 +1,130 @@
+/** @file
+*   @brief Pacing of sends by the transmit buffers free in the CC3000. */
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#include "cc3000_chibios_api.h"
+#include "async_handler.h"
+#include "cc3000_common.h"
+#include "socket.h"
+
+/** @brief Number of transmit buffers free in the CC3000 of
+ *         #cc3000ActiveDriver.
+ *  @details Each send takes a buffer, which the CC3000 returns once it has
+ *           transmitted the packet.
+ *  @return The number of buffers. */
+unsigned int cc3000ChibiosTxCredits(void)
+{
+    return tSLInformation.usNumberOfFreeBuffers;
+}
+
+/** @brief Checks if a paced send may be made.
+ *  @return True if more than #CHIBIOS_CC3000_TX_CREDIT_RESERVE buffers are
+ *          free. */
+static bool txCreditAvailable(void)
+{
+    return tSLInformation.usNumberOfFreeBuffers >
+           CHIBIOS_CC3000_TX_CREDIT_RESERVE;
+}
+
+/** @brief Waits until the CC3000 has a transmit buffer free for a paced
+ *         send.
+ *  @details Blocks on the credit event source of #cc3000ActiveDriver rather
+ *           than spinning as the host driver does when sending without a
+ *           free buffer. Another thread may take the buffer first. Uses
+ *           event #CHIBIOS_CC3000_WAIT_EVENT_ID of the calling thread.
+ *  @param[in] timeout Maximum time to wait, or TIME_INFINITE.
+ *  @return True if more than #CHIBIOS_CC3000_TX_CREDIT_RESERVE buffers are
+ *          free. */
+bool cc3000ChibiosWaitTxCredit(systime_t timeout)
+{
+    if (txCreditAvailable())
+    {
+        return true;
+    }
+
+    return cc3000WaitCondition(&cc3000ActiveDriver->txCreditSource,
+                               txCreditAvailable, timeout);
+}
+
+/** @brief Sends data on a socket once the CC3000 has a transmit buffer for
+ *         it.
+ *  @details As #cc3000ChibiosSendZeroCopy(), but waits for a credit with
+ *           #cc3000ChibiosWaitTxCredit() first, so a burst of sends keeps
+ *           the CC3000's buffers in use without the sender spinning inside
+ *           the host driver. The send is made holding cc3000ChibiosLock(),
+ *           which must not already be held.
+ *  @param sd Socket descriptor.
+ *  @param buf Data to send.
+ *  @param len Number of bytes in @p buf.
+ *  @param flags See TI's documentation for send().
+ *  @param to Destination address, or NULL to behave as send().
+ *  @param tolen Number of bytes of @p to to send.
+ *  @param timeout Maximum time to wait for a credit, or TIME_INFINITE.
+ *  @return Number of bytes sent, or a negative value on error or timeout. */
+int cc3000ChibiosSendPaced(long sd, const void *buf, long len, long flags,
+                           const sockaddr *to, socklen_t tolen,
+                           systime_t timeout)
+{
+    systime_t start = chTimeNow();
+    systime_t elapsed;
+    bool waited = false;
+    int res;
+
+    cc3000ChibiosLock();
+
+    /* Checked holding the lock, so no other paced send can take the
+     * credit before this one. */
+    while (!txCreditAvailable())
+    {
+        cc3000ChibiosUnlock();
+
+        elapsed = chTimeElapsedSince(start);
+
+        if (!waited)
+        {
+            waited = true;
+            chSysLock();
+            cc3000ActiveDriver->spiStatistics.txCreditWaits++;
+            chSysUnlock();
+        }
+
+        if ((timeout != TIME_INFINITE && elapsed >= timeout) ||
+            !cc3000ChibiosWaitTxCredit(timeout == TIME_INFINITE ?
+                                       TIME_INFINITE : timeout - elapsed))
+        {
+            return EFAIL;
+        }
+
+        cc3000ChibiosLock();
+    }
+
+    res = cc3000ChibiosSendZeroCopy(sd, buf, len, flags, to, tolen);
+
+    cc3000ChibiosUnlock();
+
+    return res;
+}
@@ -0,0 +1,138 @@
+/** @file
+*   @brief Socket sends which do not copy the payload into wlan_tx_buffer. */
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#include "cc3000_chibios_api.h"
+#include "cc3000_spi.h"
+#include "hci.h"
+#include "socket.h"
+#include "evnt_handler.h"
+
+/** @brief Size of the SPI and HCI data headers. */
+#define SEND_HEADERS_SIZE       (SPI_HEADER_SIZE + \
+                                 SIMPLE_LINK_HCI_DATA_HEADER_SIZE)
+/** @brief Size of each argument on the wire. */
+#define SEND_ARG_SIZE           (4)
+/** @brief Size of the arguments of HCI_CMND_SEND. */
+#define SEND_ARGS_LENGTH        (16)
+/** @brief Size of the arguments of HCI_CMND_SENDTO. */
+#define SENDTO_ARGS_LENGTH      (24)
+/** @brief Address length written in the HCI_CMND_SENDTO arguments.
+ *  @details Fixed, as in the host driver's simple_link_send(), whatever
+ *           the length of the address which follows the payload. */
+#define SENDTO_ADDR_LENGTH      (8)
+
+/** @brief Sends data on a socket without copying it into wlan_tx_buffer.
+ *  @details Equivalent to the host driver's send() and sendto(). The SPI
+ *           header, HCI header and arguments are built in a small buffer
+ *           and written in one SPI transaction together with @p buf and
+ *           @p to, straight from where they lie.
+ *  @warning @p buf must be readable by the DMA used by the SPI driver.
+ *  @param sd Socket descriptor.
+ *  @param buf Data to send.
+ *  @param len Number of bytes in @p buf.
+ *  @param flags See TI's documentation for send().
+ *  @param to Destination address, or NULL to behave as send().
+ *  @param tolen Number of bytes of @p to to send. Ignored if @p to is NULL.
+ *  @return Number of bytes sent, or a negative value on error. */
+int cc3000ChibiosSendZeroCopy(long sd, const void *buf, long len, long flags,
+                              const sockaddr *to, socklen_t tolen)
+{
+    unsigned char header[SEND_HEADERS_SIZE + SENDTO_ARGS_LENGTH];
+    unsigned char *stream;
+    unsigned char opcode;
+    unsigned char argsLength;
+    tSpiTxSegment segments[2];
+    tBsdReadReturnParams sendEvent;
+    int res;
+
+    if (to != NULL)
+    {
+        opcode = HCI_CMND_SENDTO;
+        argsLength = SENDTO_ARGS_LENGTH;
+    }
+    else
+    {
+        opcode = HCI_CMND_SEND;
+        argsLength = SEND_ARGS_LENGTH;
+        tolen = 0;
+    }
+
+    /* The CC3000 will not accept anything larger than the host driver
+     * could have staged. */
+    if (len < 0 || tolen < 0 ||
+        SEND_HEADERS_SIZE + argsLength + len + tolen > CC3000_TX_BUFFER_SIZE)
+    {
+        return EFAIL;
+    }
+
+    if (0 != (res = HostFlowControlConsumeBuff(sd)))
+    {
+        return res;
+    }
+
+    tSLInformation.NumberOfSentPackets++;
+
+    /* Arguments, as simple_link_send() */
+    stream = header + SEND_HEADERS_SIZE;
+    stream = UINT32_TO_STREAM(stream, sd);
+    stream = UINT32_TO_STREAM(stream, argsLength - SEND_ARG_SIZE);
+    stream = UINT32_TO_STREAM(stream, len);
+    stream = UINT32_TO_STREAM(stream, flags);
+
+    if (opcode == HCI_CMND_SENDTO)
+    {
+        stream = UINT32_TO_STREAM(stream, len + SEND_ARG_SIZE + SEND_ARG_SIZE);
+        stream = UINT32_TO_STREAM(stream, SENDTO_ADDR_LENGTH);
+    }
+
+    /* HCI data header, as hci_data_send() */
+    stream = header + SPI_HEADER_SIZE;
+    UINT8_TO_STREAM(stream, HCI_TYPE_DATA);
+    UINT8_TO_STREAM(stream, opcode);
+    UINT8_TO_STREAM(stream, argsLength);
+    stream = UINT16_TO_STREAM(stream, argsLength + len + tolen);
+
+    segments[0].pData = (const unsigned char *)buf;
+    segments[0].length = len;
+    segments[1].pData = (const unsigned char *)to;
+    segments[1].length = tolen;
+
+    SpiWriteGather(header, SEND_HEADERS_SIZE + argsLength, segments, 2);
+
+    if (opcode == HCI_CMND_SENDTO)
+    {
+        SimpleLinkWaitEvent(HCI_EVNT_SENDTO, &sendEvent);
+    }
+    else
+    {
+        SimpleLinkWaitEvent(HCI_EVNT_SEND, &sendEvent);
+    }
+
+    return len;
+}
+
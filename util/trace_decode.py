@@ -0,0 +1,183 @@
+#! /usr/bin/env python3
+#
+# Decoder for traces printed by cc3000ChibiosDumpTrace().
+# Reads a capture of the serial output, from a file or stdin, and prints a
+# timeline of each trace followed by a histogram of the latency of each phase
+# across all traces. Anything in the capture outside a trace is ignored.
+#
+# Usage: trace_decode.py [capture]
+
+import sys
+
+# Must match cc3000TraceEvent in cc3000_chibios_api.h
+EVENTS = {
+    1: "EXT_IRQ",
+    2: "IRQ_WAKE",
+    3: "STATE",
+    4: "SELECT",
+    5: "UNSELECT",
+    6: "SPI_WRITE_START",
+    7: "SPI_WRITE_END",
+    8: "SPI_READ_START",
+    9: "SPI_READ_END",
+    10: "RX_DISPATCH_START",
+    11: "RX_DISPATCH_END",
+    12: "WRITE_REQUEST",
+    13: "WRITE_DONE",
+}
+
+# Must match spiState in cc3000_chibios_api.h
+STATES = {
+    0: "POWERUP",
+    1: "INITIALIZED",
+    2: "IDLE",
+    3: "WRITE_REQUESTED",
+    4: "WRITE_PERMITTED",
+    5: "READ",
+}
+
+# Phases measured: name, starting event, ending event, and the state entered
+# if the ending event is a state change.
+PHASES = [
+    ("EXT IRQ -> IRQ thread", "EXT_IRQ", "IRQ_WAKE", None),
+    ("IRQ thread -> SPI read", "IRQ_WAKE", "SPI_READ_START", None),
+    ("SPI read", "SPI_READ_START", "SPI_READ_END", None),
+    ("SPI read -> dispatch", "SPI_READ_END", "RX_DISPATCH_START", None),
+    ("Dispatch", "RX_DISPATCH_START", "RX_DISPATCH_END", None),
+    ("Write request -> permitted", "WRITE_REQUEST", "STATE", 4),
+    ("SPI write", "SPI_WRITE_START", "SPI_WRITE_END", None),
+    ("Write request -> done", "WRITE_REQUEST", "WRITE_DONE", None),
+]
+
+BEGIN = "CC3000 TRACE BEGIN"
+END = "CC3000 TRACE END"
+
+HISTOGRAM_WIDTH = 40
+
+
+def read_traces(lines):
+    """Returns a list of (frequency, records) for each trace in lines."""
+    traces = []
+    records = None
+    freq = 0
+
+    for line in lines:
+        line = line.strip()
+
+        if line.startswith(BEGIN):
+            freq = int(line.split()[3])
+            records = []
+        elif line.startswith(END):
+            if records is not None:
+                traces.append((freq, records))
+            records = None
+        elif records is not None:
+            fields = line.split()
+            if len(fields) != 4:
+                continue
+            time, event, arg, value = (int(f, 16) for f in fields)
+            records.append((time, event, arg, value))
+
+    return traces
+
+
+def to_us(counts, freq):
+    return counts * 1000000.0 / freq
+
+
+def elapsed(start, end):
+    """Counter difference, allowing for the 32 bit counter wrapping."""
+    return (end - start) & 0xFFFFFFFF
+
+
+def describe(event, arg, value):
+    name = EVENTS.get(event, "UNKNOWN(%d)" % event)
+
+    if name == "STATE":
+        return "STATE %s -> %s" % (STATES.get(arg, arg),
+                                   STATES.get(value, value))
+    elif value:
+        return "%s %d" % (name, value)
+    else:
+        return name
+
+
+def print_timeline(freq, records):
+    print("Timeline, %d records at %d Hz:" % (len(records), freq))
+    print("%12s %10s  %s" % ("time (us)", "delta (us)", "event"))
+
+    if not records:
+        return
+
+    first = records[0][0]
+    last = first
+
+    for time, event, arg, value in records:
+        print("%12.1f %10.1f  %s" % (to_us(elapsed(first, time), freq),
+                                     to_us(elapsed(last, time), freq),
+                                     describe(event, arg, value)))
+        last = time
+
+
+def measure_phases(freq, records, latencies):
+    """Appends the latency, in us, of each phase found to latencies."""
+    for name, start_event, end_event, end_state in PHASES:
+        start = None
+
+        for time, event, arg, value in records:
+            event = EVENTS.get(event)
+
+            if event == start_event:
+                # A later start supersedes an unmatched one.
+                start = time
+            elif (event == end_event and start is not None and
+                  (end_state is None or value == end_state)):
+                latencies[name].append(to_us(elapsed(start, time), freq))
+                start = None
+
+
+def print_histogram(name, samples):
+    print("%s: %d samples" % (name, len(samples)))
+
+    if not samples:
+        return
+
+    print("  min %.1f us, avg %.1f us, max %.1f us" %
+          (min(samples), sum(samples) / len(samples), max(samples)))
+
+    # Buckets double in size, the first covering up to 1 us.
+    buckets = {}
+    for sample in samples:
+        bucket = 0
+        while sample > (1 << bucket):
+            bucket += 1
+        buckets[bucket] = buckets.get(bucket, 0) + 1
+
+    most = max(buckets.values())
+
+    for bucket in range(min(buckets), max(buckets) + 1):
+        count = buckets.get(bucket, 0)
+        bar = "#" * ((count * HISTOGRAM_WIDTH + most - 1) // most)
+        print("  <= %8d us %6d %s" % (1 << bucket, count, bar))
+
+
+if len(sys.argv) > 1:
+    with open(sys.argv[1], errors="replace") as capture:
+        traces = read_traces(capture)
+else:
+    traces = read_traces(sys.stdin)
+
+if not traces:
+    print("No traces found.")
+    sys.exit(1)
+
+latencies = dict((name, []) for name, _, _, _ in PHASES)
+
+for freq, records in traces:
+    print_timeline(freq, records)
+    print("")
+    measure_phases(freq, records, latencies)
+
+print("Phase latencies across %d traces:" % len(traces))
+for name, _, _, _ in PHASES:
+    print_histogram(name, latencies[name])